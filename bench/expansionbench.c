@@ -0,0 +1,72 @@
+/*
+Expansion benchmark.
+Times stringExpansion on lines with more and more '$$' occurrences, and a mix of $?, $VAR and ${VAR}.
+Time per expansion should stay flat as the count doubles, showing the expansion is linear.
+Build from the repository root:
+    gcc -O2 -DSMALLSH_NO_MAIN -o expansionbench bench/expansionbench.c
+Run:
+    ./expansionbench [largest count]
+*/
+#define _GNU_SOURCE
+#include "../smallsh.c"
+
+
+
+/*
+Builds a line of count expansions. Mixed lines cycle through $$, $?, $HOME and ${HOME}.
+*/
+char* generateExpansionLine(int count, int mixed) {
+    char* forms[4] = {"$$ ", "$? ", "$HOME ", "${HOME} "};
+    char* line = malloc(count * 8 + 16);
+    size_t length = sprintf(line, "echo ");
+    int i = 0;
+
+    for (i; i < count; i++) {
+        char* form = (mixed == 1) ? forms[i % 4] : forms[0];
+        strcpy(&line[length], form);
+        length += strlen(form);
+    }
+    strcpy(&line[length], "\n");
+    return line;
+}
+
+
+
+/*
+Times stringExpansion on one line, repeating it enough times for a stable reading.
+Returns nanoseconds per expansion.
+*/
+double timeExpansion(char* line, int count) {
+    struct timespec benchStart;
+    struct timespec benchEnd;
+    int iterations = 2000000 / count + 1;
+    int i = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &benchStart);
+    for (i; i < iterations; i++) {
+        resetArena(&commandArena);
+        stringExpansion(line);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &benchEnd);
+
+    double elapsedNanoseconds = (benchEnd.tv_sec - benchStart.tv_sec) * 1e9 + (benchEnd.tv_nsec - benchStart.tv_nsec);
+    return elapsedNanoseconds / iterations / count;
+}
+
+
+
+int main(int argc, char* argv[]) {
+    int largestCount = (argc > 1) ? atoi(argv[1]) : 65536;
+    int count = 1024;
+
+    setenv("HOME", "/home/benchmark", 1);
+    printf("%10s %18s %18s\n", "count", "ns/expansion $$", "ns/expansion mix");
+    for (count; count <= largestCount; count *= 2) {
+        char* pidLine = generateExpansionLine(count, 0);
+        char* mixedLine = generateExpansionLine(count, 1);
+        printf("%10d %18.1f %18.1f\n", count, timeExpansion(pidLine, count), timeExpansion(mixedLine, count));
+        free(pidLine);
+        free(mixedLine);
+    }
+    return 0;
+}
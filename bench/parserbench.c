@@ -0,0 +1,95 @@
+/*
+Parser microbenchmark.
+Times parseInputCommand on long generated command lines, and reports tokens per second.
+Build from the repository root:
+    gcc -O2 -DSMALLSH_NO_MAIN -o parserbench bench/parserbench.c
+Run:
+    ./parserbench [words per line] [iterations]
+*/
+#define _GNU_SOURCE
+#include "../smallsh.c"
+
+
+
+/*
+Builds a command line of the given number of words, mixing plain, quoted and escaped words,
+a redirection and pipeline stages, the way generated scripts do.
+Returns the line, and sets tokenCount to the number of tokens it holds.
+*/
+char* generateCommandLine(int wordCount, long long* tokenCount) {
+    char* line = malloc(wordCount * 32 + 64);
+    size_t length = 0;
+    int i = 0;
+
+    *tokenCount = 0;
+    length += sprintf(&line[length], "command");
+    (*tokenCount)++;
+    for (i; i < wordCount; i++) {
+        switch(i % 8) {
+            case 0:
+                length += sprintf(&line[length], " plain%d", i);
+                break;
+            case 1:
+                length += sprintf(&line[length], " 'single quoted %d'", i);
+                break;
+            case 2:
+                length += sprintf(&line[length], " \"double \\\"quoted\\\" %d\"", i);
+                break;
+            case 3:
+                length += sprintf(&line[length], " back\\ slash%d", i);
+                break;
+            case 4:
+                length += sprintf(&line[length], " --option=value%d", i);
+                break;
+            case 5:
+                length += sprintf(&line[length], " mixed'%d'\"x\"", i);
+                break;
+            case 6:
+                length += sprintf(&line[length], " | stage%d", i);
+                (*tokenCount)++;
+                break;
+            case 7:
+                length += sprintf(&line[length], " path/to/file%d.txt", i);
+                break;
+        }
+        (*tokenCount)++;
+    }
+    length += sprintf(&line[length], " > output.txt\n");
+    *tokenCount += 2;
+    return line;
+}
+
+
+
+int main(int argc, char* argv[]) {
+    int wordCount = (argc > 1) ? atoi(argv[1]) : 10000;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 200;
+    long long tokenCount;
+    struct timespec benchStart;
+    struct timespec benchEnd;
+    int i = 0;
+
+    char* line = generateCommandLine(wordCount, &tokenCount);
+    size_t lineLength = strlen(line);
+
+    clock_gettime(CLOCK_MONOTONIC, &benchStart);
+    for (i; i < iterations; i++) {
+        resetArena(&commandArena);
+        char* inputCommand = arenaAllocate(&commandArena, lineLength + 1);
+        memcpy(inputCommand, line, lineLength);
+        struct commandStructure* command = parseInputCommand(inputCommand);
+        if (command->parseError == 1) {
+            fprintf(stderr, "parse error\n");
+            return 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &benchEnd);
+
+    double elapsedSeconds = (benchEnd.tv_sec - benchStart.tv_sec) + (benchEnd.tv_nsec - benchStart.tv_nsec) / 1e9;
+    printf("line: %zu bytes, %lld tokens, %d iterations\n", lineLength, tokenCount, iterations);
+    printf("%.3f s, %.1f us per line, %.2f M tokens/s, %.1f MB/s\n", elapsedSeconds, \
+            elapsedSeconds / iterations * 1e6, tokenCount * iterations / elapsedSeconds / 1e6, \
+            lineLength * (double)iterations / elapsedSeconds / 1e6);
+    free(line);
+    return 0;
+}
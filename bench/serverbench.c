@@ -0,0 +1,210 @@
+/*
+Load test for 'smallsh --serve'.
+Starts a number of clients as separate processes, each sending its requests one after another to a running server,
+and reports the p50, p99 and mean time from sending a command to receiving its exit status, and requests per second.
+Each client first changes to a directory of its own, / or /tmp, and checks with pwd at the end that no other
+client's 'cd' reached it. A request with a non-zero exit status, or a failed check, counts as a failure.
+Build with 'make bench', then run against a server:
+    ./smallsh --serve /tmp/smallsh.sock -j 8 &
+    bench/serverbench -s /tmp/smallsh.sock [-c clients] [-n requests per client] [command]
+The command defaults to 'echo hello'.
+*/
+#define _GNU_SOURCE
+#include "../smallsh.c"
+#include <sys/mman.h>
+
+
+
+/*
+Returns the monotonic clock in nanoseconds.
+*/
+long long nowNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+
+/*
+Comparison function for sorting sample times.
+*/
+int compareSamples(const void* first, const void* second) {
+    long long a = *(const long long*)first;
+    long long b = *(const long long*)second;
+    return (a > b) - (a < b);
+}
+
+
+
+/*
+Reads exactly length bytes. Returns 0, or -1 if the server closed the connection first.
+*/
+int readFully(int socketFd, char* buffer, size_t length) {
+    size_t bytesRead = 0;
+
+    while (bytesRead < length) {
+        ssize_t readResult = read(socketFd, &buffer[bytesRead], length - bytesRead);
+        if ((readResult == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if (readResult <= 0) {
+            return -1;
+        }
+        bytesRead += readResult;
+    }
+    return 0;
+}
+
+
+
+/*
+Sends one command and reads frames until its exit status. stdout is collected into output, up to outputSize bytes.
+Returns the exit status, or -1 if the connection failed.
+*/
+int runRemoteCommand(int socketFd, char* commandText, char* output, size_t outputSize) {
+    char header[SERVER_FRAME_HEADER];
+    uint32_t networkLength = htonl((uint32_t)strlen(commandText));
+    size_t outputLength = 0;
+
+    header[0] = SERVER_FRAME_COMMAND;
+    memcpy(&header[1], &networkLength, 4);
+    if ((write(socketFd, header, SERVER_FRAME_HEADER) != SERVER_FRAME_HEADER) \
+            || (write(socketFd, commandText, strlen(commandText)) != (ssize_t)strlen(commandText))) {
+        return -1;
+    }
+
+    while (readFully(socketFd, header, SERVER_FRAME_HEADER) == 0) {
+        memcpy(&networkLength, &header[1], 4);
+        size_t payloadLength = ntohl(networkLength);
+        char* payload = malloc(payloadLength + 1);
+        if (readFully(socketFd, payload, payloadLength) == -1) {
+            free(payload);
+            return -1;
+        }
+        if (header[0] == SERVER_FRAME_EXIT) {
+            uint32_t networkStatus;
+            memcpy(&networkStatus, payload, 4);
+            free(payload);
+            if (output != NULL) {
+                output[outputLength] = '\0';
+            }
+            return (int)ntohl(networkStatus);
+        }
+        if ((header[0] == SERVER_FRAME_OUTPUT) && (output != NULL)) {
+            size_t copyLength = (payloadLength < outputSize - 1 - outputLength) ? payloadLength : outputSize - 1 - outputLength;
+            memcpy(&output[outputLength], payload, copyLength);
+            outputLength += copyLength;
+        }
+        free(payload);
+    }
+    return -1;
+}
+
+
+
+/*
+Runs one client: connects, changes to its directory, sends its requests and times each one, then checks pwd.
+Samples go to the shared array. Returns the number of failures.
+*/
+int runClient(char* socketPath, int clientNumber, int requestCount, char* commandText, long long* samples) {
+    struct sockaddr_un address = {0};
+    char* directory = (clientNumber % 2 == 0) ? "/tmp" : "/";
+    char command[256];
+    char output[4096];
+    int failures = 0;
+    int i = 0;
+
+    int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+    if (connect(socketFd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        fprintf(stderr, "serverbench: cannot connect to '%s': %s\n", socketPath, strerror(errno));
+        return requestCount;
+    }
+
+    snprintf(command, sizeof(command), "cd %s", directory);
+    if (runRemoteCommand(socketFd, command, NULL, 0) != 0) {
+        failures++;
+    }
+    for (i; i < requestCount; i++) {
+        long long start = nowNanoseconds();
+        int exitStatus = runRemoteCommand(socketFd, commandText, NULL, 0);
+        samples[i] = nowNanoseconds() - start;
+        if (exitStatus != 0) {
+            failures++;
+        }
+        if (exitStatus == -1) {
+            break;
+        }
+    }
+
+    snprintf(command, sizeof(command), "%s\n", directory);
+    if ((runRemoteCommand(socketFd, "pwd", output, sizeof(output)) != 0) || (strcmp(output, command) != 0)) {
+        failures++;
+    }
+    close(socketFd);
+    return failures;
+}
+
+
+
+int main(int argc, char* argv[]) {
+    char* socketPath = NULL;
+    char* commandText = "echo hello";
+    int clientCount = 8;
+    int requestCount = 1000;
+    int i = 1;
+
+    for (i; i < argc; i++) {
+        if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+            socketPath = argv[++i];
+        }
+        else if ((strcmp(argv[i], "-c") == 0) && (i + 1 < argc)) {
+            clientCount = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+            requestCount = atoi(argv[++i]);
+        }
+        else if ((argv[i][0] != '-') && (i + 1 == argc)) {
+            commandText = argv[i];
+        }
+        else {
+            socketPath = NULL;
+            break;
+        }
+    }
+    if ((socketPath == NULL) || (clientCount < 1) || (requestCount < 1)) {
+        fprintf(stderr, "Usage: serverbench -s socket [-c clients] [-n requests per client] [command]\n");
+        return 2;
+    }
+
+    // Samples are written by the client processes straight into shared memory.
+    size_t sampleCount = (size_t)clientCount * requestCount;
+    long long* samples = mmap(NULL, sampleCount * sizeof(long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    long long start = nowNanoseconds();
+    for (i = 0; i < clientCount; i++) {
+        if (fork() == 0) {
+            int failures = runClient(socketPath, i, requestCount, commandText, &samples[(size_t)i * requestCount]);
+            _exit((failures > 255) ? 255 : failures);
+        }
+    }
+    int failures = 0;
+    int childExit;
+    while (wait(&childExit) > 0) {
+        failures += WIFEXITED(childExit) ? WEXITSTATUS(childExit) : requestCount;
+    }
+    double elapsedSeconds = (nowNanoseconds() - start) / 1e9;
+
+    long long total = 0;
+    qsort(samples, sampleCount, sizeof(long long), compareSamples);
+    for (i = 0; i < (int)sampleCount; i++) {
+        total += samples[i];
+    }
+    printf("{\"clients\": %d, \"requests\": %zu, \"failures\": %d, \"p50_ns\": %lld, \"p99_ns\": %lld, " \
+            "\"mean_ns\": %.1f, \"throughput\": %.1f, \"throughput_unit\": \"requests/s\"}\n", \
+            clientCount, sampleCount, failures, samples[sampleCount / 2], samples[(sampleCount * 99) / 100], \
+            (double)total / sampleCount, sampleCount / elapsedSeconds);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,535 @@
+/*
+Benchmark suite for smallsh.
+Microbenchmarks for parseInputCommand, stringExpansion, history search and completion, and end-to-end benchmarks for
+foreground spawn latency, background fan-out and reaping, and command substitution, run inside one shell process.
+Each case reports p50, p99 and mean time per operation, and a throughput, as JSON or CSV.
+-m grows the shell's heap by that many touched megabytes before the runs, to show how spawn cost
+depends on the size of the shell for each engine.
+Build with 'make bench', then run:
+    bench/smallshbench [-f json|csv] [-n iterations] [-e posix_spawn|fork|zygote] [-m megabytes]
+*/
+#define _GNU_SOURCE
+#include "../smallsh.c"
+
+/*
+Structure for the result of one benchmark case.
+*/
+struct benchResult {
+    char* name;
+    int iterations;
+    double p50Nanoseconds;
+    double p99Nanoseconds;
+    double meanNanoseconds;
+    double throughput;
+    char* throughputUnit;
+};
+
+// Results are written here. stdout itself is pointed at /dev/null so shell messages do not mix in.
+FILE* resultOutput;
+
+
+
+/*
+Returns the monotonic clock in nanoseconds.
+*/
+long long nowNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+
+/*
+Comparison function for sorting sample times.
+*/
+int compareSamples(const void* first, const void* second) {
+    long long a = *(const long long*)first;
+    long long b = *(const long long*)second;
+    return (a > b) - (a < b);
+}
+
+
+
+/*
+Fills in p50, p99 and mean from per-operation samples. Sorts the samples.
+*/
+void summarizeSamples(struct benchResult* result, long long* samples, int sampleCount) {
+    long long total = 0;
+    int i = 0;
+
+    qsort(samples, sampleCount, sizeof(long long), compareSamples);
+    for (i; i < sampleCount; i++) {
+        total += samples[i];
+    }
+    result->iterations = sampleCount;
+    result->p50Nanoseconds = samples[sampleCount / 2];
+    result->p99Nanoseconds = samples[(sampleCount * 99) / 100];
+    result->meanNanoseconds = (double)total / sampleCount;
+}
+
+
+
+/*
+Parses a long generated line of mixed words, quotes, redirections and pipes.
+Throughput is tokens per second.
+*/
+void benchParse(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    char* line = malloc(64 * 1024);
+    size_t length = 0;
+    int tokenCount = 0;
+    int i = 0;
+
+    length += sprintf(&line[length], "command");
+    tokenCount++;
+    for (i; i < 1000; i++) {
+        char* forms[4] = {" plain%d", " 'single %d'", " \"double \\\"%d\\\"\"", " | stage%d"};
+        length += sprintf(&line[length], forms[i % 4], i);
+        tokenCount += (i % 4 == 3) ? 2 : 1;
+    }
+    length += sprintf(&line[length], " > output.txt\n");
+    tokenCount += 2;
+
+    for (i = 0; i < iterations; i++) {
+        resetArena(&commandArena);
+        char* inputCommand = arenaAllocate(&commandArena, length + 1);
+        memcpy(inputCommand, line, length);
+        long long start = nowNanoseconds();
+        parseInputCommand(inputCommand);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    result->name = "parse_long_line";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = tokenCount / (result->meanNanoseconds / 1e9);
+    result->throughputUnit = "tokens/s";
+    free(samples);
+    free(line);
+}
+
+
+
+/*
+Expands a line with 1000 mixed $$, $?, $HOME and ${HOME} forms.
+Throughput is expansions per second.
+*/
+void benchExpansion(struct benchResult* result, int iterations) {
+    char* forms[4] = {"$$ ", "$? ", "$HOME ", "${HOME} "};
+    long long* samples = malloc(iterations * sizeof(long long));
+    char* line = malloc(16 * 1024);
+    size_t length = sprintf(line, "echo ");
+    int i = 0;
+
+    for (i; i < 1000; i++) {
+        length += sprintf(&line[length], "%s", forms[i % 4]);
+    }
+    sprintf(&line[length], "\n");
+
+    for (i = 0; i < iterations; i++) {
+        resetArena(&commandArena);
+        long long start = nowNanoseconds();
+        stringExpansion(line);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    result->name = "expand_1000_forms";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = 1000 / (result->meanNanoseconds / 1e9);
+    result->throughputUnit = "expansions/s";
+    free(samples);
+    free(line);
+}
+
+
+
+/*
+Runs '/bin/true' in the foreground through otherCommand, timing spawn through reaped exit.
+Throughput is commands per second.
+*/
+void benchForegroundSpawn(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    char line[] = "/bin/true\n";
+    int i = 0;
+
+    resetArena(&commandArena);
+    struct commandStructure* command = parseInputCommand(line);
+    for (i; i < iterations; i++) {
+        long long start = nowNanoseconds();
+        otherCommand(command);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    result->name = "foreground_spawn_true";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = 1e9 / result->meanNanoseconds;
+    result->throughputUnit = "commands/s";
+    free(samples);
+}
+
+
+
+/*
+Runs 'BENCH_OVERRIDE=1 /bin/true' in the foreground with 2000 extra exported variables, timing spawn through reaped exit.
+The cached environment is only built once, and the override takes a free slot in front of it, so the shell copies
+nothing per spawn. What is left over foreground_spawn_true is exec copying the larger environment.
+Throughput is commands per second.
+*/
+void benchEnvironmentSpawn(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    char line[] = "BENCH_OVERRIDE=1 /bin/true\n";
+    char name[32];
+    int i = 0;
+
+    for (i; i < 2000; i++) {
+        snprintf(name, sizeof(name), "BENCH_VARIABLE_%d", i);
+        setVariable(name, strlen(name), "benchmark value", 1);
+    }
+    resetArena(&commandArena);
+    struct commandStructure* command = parseInputCommand(line);
+    for (i = 0; i < iterations; i++) {
+        long long start = nowNanoseconds();
+        otherCommand(command);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    result->name = "spawn_env_override";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = 1e9 / result->meanNanoseconds;
+    result->throughputUnit = "commands/s";
+    free(samples);
+}
+
+
+
+/*
+Runs 'echo' with a '>' redirect through shellCommand, which now runs it inside the shell.
+Compare with foreground_spawn_true for the cost of a child. Throughput is commands per second.
+*/
+void benchBuiltinEcho(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    char line[] = "echo benchmark > /dev/null\n";
+    int i = 0;
+
+    resetArena(&commandArena);
+    struct commandStructure* command = parseInputCommand(line);
+    for (i; i < iterations; i++) {
+        long long start = nowNanoseconds();
+        shellCommand(command);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    result->name = "foreground_builtin_echo";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = 1e9 / result->meanNanoseconds;
+    result->throughputUnit = "commands/s";
+    free(samples);
+}
+
+
+
+/*
+Starts '/bin/true &' jobs as fast as possible, then reaps them all through the SIGCHLD path.
+Samples are the time to launch each background job. Throughput is jobs launched and reaped per second.
+*/
+void benchBackgroundFanOut(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    char line[] = "/bin/true &\n";
+    int i = 0;
+
+    resetArena(&commandArena);
+    struct commandStructure* command = parseInputCommand(line);
+    long long fanOutStart = nowNanoseconds();
+    for (i; i < iterations; i++) {
+        long long start = nowNanoseconds();
+        otherCommand(command);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    // The shell's event loop reaps them, from SIGCHLD or from the zygote's socket.
+    while (jobCount > 0) {
+        processShellEvents(100, 0);
+    }
+    long long fanOutEnd = nowNanoseconds();
+
+    result->name = "background_fanout_reap_true";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = iterations / ((fanOutEnd - fanOutStart) / 1e9);
+    result->throughputUnit = "jobs/s";
+    free(samples);
+}
+
+
+
+/*
+Searches a history file of iterations * 1000 entries, alternating '!prefix' lookups and substring searches
+for entries spread through the file. The file is written, mapped and indexed before the samples start;
+that one-time cost is measured separately and reported on stderr.
+Throughput is searches per second.
+*/
+void benchHistorySearch(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    char historyFile[] = "/tmp/smallshbench_historyXXXXXX";
+    int entryCount = iterations * 1000;
+    char text[64];
+    int i = 0;
+
+    int historyFd = mkstemp(historyFile);
+    FILE* historyOutput = fdopen(historyFd, "w");
+    for (i; i < entryCount; i++) {
+        if (i % 3 == 0) {
+            fprintf(historyOutput, "ssh deploy@host%d.example.com uptime\n", i);
+        }
+        else if (i % 3 == 1) {
+            fprintf(historyOutput, "make -j8 target%d CFLAGS=-O2\n", i);
+        }
+        else {
+            fprintf(historyOutput, "git commit -m 'change %d'\n", i);
+        }
+    }
+    fclose(historyOutput);
+    setenv("SMALLSH_HISTFILE", historyFile, 1);
+
+    long long indexStart = nowNanoseconds();
+    searchHistory("ssh", 3, 0, 1);
+    fprintf(stderr, "history: %d entries mapped and indexed in %.1f ms\n", syncHistory(), (nowNanoseconds() - indexStart) / 1e6);
+
+    for (i = 0; i < iterations; i++) {
+        int entry = (int)(((long long)i * 7919 * 1000) % entryCount);
+        long long start = nowNanoseconds();
+        if (i % 2 == 0) {
+            snprintf(text, sizeof(text), "make -j8 target%d", entry - entry % 3 + 1);
+            searchHistory(text, strlen(text), 0, 1);
+        }
+        else {
+            snprintf(text, sizeof(text), "host%d.", entry - entry % 3);
+            searchHistory(text, strlen(text), 0, 0);
+        }
+        samples[i] = nowNanoseconds() - start;
+    }
+    unlink(historyFile);
+
+    result->name = "history_search";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = 1e9 / result->meanNanoseconds;
+    result->throughputUnit = "searches/s";
+    free(samples);
+}
+
+
+
+/*
+Completes command names against a PATH directory of iterations * 30 executables. Every tenth sample
+adds one more executable first, so the time includes picking it up from inotify. The index is built before
+the samples start; that one-time cost is reported on stderr.
+Throughput is completions per second.
+*/
+void benchCommandCompletion(struct benchResult* result, int iterations) {
+    long long* samples = malloc(iterations * sizeof(long long));
+    struct completionList completions = {0};
+    char directoryName[] = "/tmp/smallshbench_pathXXXXXX";
+    char fileName[128];
+    char prefix[32];
+    size_t prefixLength;
+    int fileCount = iterations * 30;
+    int i = 0;
+
+    mkdtemp(directoryName);
+    for (i; i < fileCount; i++) {
+        snprintf(fileName, sizeof(fileName), "%s/tool%06d", directoryName, i);
+        close(open(fileName, O_WRONLY | O_CREAT, 0755));
+    }
+    char* savedPATH = strdup(getenv("PATH"));
+    setenv("PATH", directoryName, 1);
+
+    long long indexStart = nowNanoseconds();
+    completeWord("tool", 4, 1, &completions, &prefixLength);
+    fprintf(stderr, "completion: %d commands indexed in %.1f ms\n", commandNameCount, (nowNanoseconds() - indexStart) / 1e6);
+
+    for (i = 0; i < iterations; i++) {
+        if (i % 10 == 0) {
+            snprintf(fileName, sizeof(fileName), "%s/tool%06d", directoryName, fileCount + i);
+            close(open(fileName, O_WRONLY | O_CREAT, 0755));
+        }
+        snprintf(prefix, sizeof(prefix), "tool%05d", (i * 7919) % (fileCount / 10));
+        long long start = nowNanoseconds();
+        completeWord(prefix, strlen(prefix), 1, &completions, &prefixLength);
+        samples[i] = nowNanoseconds() - start;
+    }
+
+    for (i = 0; i < fileCount + iterations; i++) {
+        snprintf(fileName, sizeof(fileName), "%s/tool%06d", directoryName, i);
+        unlink(fileName);
+    }
+    rmdir(directoryName);
+    setenv("PATH", savedPATH, 1);
+    free(savedPATH);
+    clearCompletions(&completions);
+
+    result->name = "complete_command";
+    summarizeSamples(result, samples, iterations);
+    result->throughput = 1e9 / result->meanNanoseconds;
+    result->throughputUnit = "completions/s";
+    free(samples);
+}
+
+
+
+/*
+Expands '$(cat file)' on a 100 MB file of short lines, iterations / 100 + 1 times, which captures the output,
+trims it and escapes it for word splitting. With assignment set, the line is 'x=$(cat file)', whose value is
+kept as one word instead. For comparison, the time to read the same file from cat through a plain pipe is
+reported on stderr.
+Throughput is megabytes captured per second.
+*/
+void benchCommandSubstitution(struct benchResult* result, int iterations, int assignment) {
+    char fileName[] = "/tmp/smallshbench_substitutionXXXXXX";
+    size_t fileSize = 100 * 1024 * 1024;
+    char line[4096];
+    size_t written = 0;
+    int i = 0;
+
+    int fileFd = mkstemp(fileName);
+    FILE* fileOutput = fdopen(fileFd, "w");
+    for (i; i < (int)sizeof(line); i++) {
+        line[i] = (i % 16 == 15) ? '\n' : 'a' + (i % 26);
+    }
+    while (written < fileSize) {
+        written += fwrite(line, 1, sizeof(line), fileOutput);
+    }
+    fclose(fileOutput);
+
+    // Raw pipe bandwidth: cat into a pipe, read in large chunks and thrown away.
+    int rawPipe[2];
+    char* readBuffer = malloc(1024 * 1024);
+    pipe(rawPipe);
+    fcntl(rawPipe[0], F_SETPIPE_SZ, 1024 * 1024);
+    long long rawStart = nowNanoseconds();
+    pid_t catPID = fork();
+    if (catPID == 0) {
+        dup2(rawPipe[1], STDOUT_FILENO);
+        execlp("cat", "cat", fileName, NULL);
+        _exit(127);
+    }
+    close(rawPipe[1]);
+    while (read(rawPipe[0], readBuffer, 1024 * 1024) > 0) {
+    }
+    close(rawPipe[0]);
+    waitpid(catPID, NULL, 0);
+    fprintf(stderr, "substitution: raw pipe read of %zu MB in %.1f ms\n", written >> 20, (nowNanoseconds() - rawStart) / 1e6);
+    free(readBuffer);
+
+    int sampleCount = iterations / 100 + 1;
+    long long* samples = malloc(sampleCount * sizeof(long long));
+    char command[128];
+    snprintf(command, sizeof(command), (assignment == 1) ? "x=$(cat %s)\n" : "echo $(cat %s)\n", fileName);
+    for (i = 0; i < sampleCount; i++) {
+        resetArena(&commandArena);
+        long long start = nowNanoseconds();
+        stringExpansion(command);
+        samples[i] = nowNanoseconds() - start;
+    }
+    resetArena(&commandArena);
+    unlink(fileName);
+
+    result->name = (assignment == 1) ? "assign_substitute_100mb" : "substitute_100mb";
+    summarizeSamples(result, samples, sampleCount);
+    result->throughput = (written / 1048576.0) / (result->meanNanoseconds / 1e9);
+    result->throughputUnit = "MB/s";
+    free(samples);
+}
+
+
+
+/*
+Writes every result as one JSON object, or as CSV with a header row.
+*/
+void printResults(struct benchResult* results, int resultCount, int csvFormat) {
+    int i = 0;
+
+    if (csvFormat == 1) {
+        fprintf(resultOutput, "name,iterations,p50_ns,p99_ns,mean_ns,throughput,throughput_unit\n");
+        for (i; i < resultCount; i++) {
+            fprintf(resultOutput, "%s,%d,%.0f,%.0f,%.1f,%.1f,%s\n", results[i].name, results[i].iterations, \
+                    results[i].p50Nanoseconds, results[i].p99Nanoseconds, results[i].meanNanoseconds, \
+                    results[i].throughput, results[i].throughputUnit);
+        }
+        return;
+    }
+
+    fprintf(resultOutput, "{\n  \"spawn_engine\": \"%s\",\n  \"benchmarks\": [\n", \
+            (spawnEngine == SPAWN_ENGINE_FORK) ? "fork" : (spawnEngine == SPAWN_ENGINE_ZYGOTE) ? "zygote" : "posix_spawn");
+    for (i; i < resultCount; i++) {
+        fprintf(resultOutput, "    {\"name\": \"%s\", \"iterations\": %d, \"p50_ns\": %.0f, \"p99_ns\": %.0f, " \
+                "\"mean_ns\": %.1f, \"throughput\": %.1f, \"throughput_unit\": \"%s\"}%s\n", \
+                results[i].name, results[i].iterations, results[i].p50Nanoseconds, results[i].p99Nanoseconds, \
+                results[i].meanNanoseconds, results[i].throughput, results[i].throughputUnit, \
+                (i + 1 < resultCount) ? "," : "");
+    }
+    fprintf(resultOutput, "  ]\n}\n");
+}
+
+
+
+int main(int argc, char* argv[]) {
+    struct benchResult results[10];
+    int csvFormat = 0;
+    int iterations = 1000;
+    int heapMegabytes = 0;
+    int i = 1;
+
+    for (i; i < argc; i++) {
+        if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc)) {
+            csvFormat = (strcmp(argv[++i], "csv") == 0);
+        }
+        else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+            iterations = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-m") == 0) && (i + 1 < argc)) {
+            heapMegabytes = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-e") == 0) && (i + 1 < argc)) {
+            if (setSpawnEngine(argv[++i]) == -1) {
+                fprintf(stderr, "Unknown spawn engine '%s'.\n", argv[i]);
+                return 2;
+            }
+        }
+        else {
+            fprintf(stderr, "Usage: smallshbench [-f json|csv] [-n iterations] [-e posix_spawn|fork|zygote] [-m megabytes]\n");
+            return 2;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    // Grow the shell after the engine is picked, so a zygote is still forked from the small shell.
+    if (heapMegabytes > 0) {
+        size_t heapSize = (size_t)heapMegabytes << 20;
+        memset(malloc(heapSize), 1, heapSize);
+    }
+
+    // Keep results on the real stdout, and send shell messages to /dev/null.
+    resultOutput = fdopen(dup(STDOUT_FILENO), "w");
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+
+    setenv("HOME", "/home/benchmark", 1);
+    setSignals();
+
+    benchParse(&results[0], iterations * 10);
+    benchExpansion(&results[1], iterations * 10);
+    benchForegroundSpawn(&results[2], iterations);
+    benchBackgroundFanOut(&results[3], iterations);
+    benchBuiltinEcho(&results[4], iterations * 10);
+    benchHistorySearch(&results[5], iterations);
+    benchCommandCompletion(&results[6], iterations);
+    benchCommandSubstitution(&results[7], iterations, 0);
+    benchCommandSubstitution(&results[8], iterations, 1);
+    benchEnvironmentSpawn(&results[9], iterations);
+
+    printResults(results, 10, csvFormat);
+    fclose(resultOutput);
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -8,7 +9,33 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <signal.h>
+#include <errno.h>
+#include <sys/signalfd.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include "smallsh.h"
+#include "smallsharena.c"
+#include "smallshinput.c"
+#include "smallshlexer.c"
+#include "smallshcontrol.c"
+#include "smallshhash.c"
+#include "smallshvariables.c"
+#include "smallshhistory.c"
+#include "smallshcomplete.c"
+#include "smallshedit.c"
+#include "smallshtrace.c"
+#include "smallshstats.c"
+#include "smallshjobs.c"
+#include "smallshredirect.c"
+#include "smallshevents.c"
+#include "smallshtimeout.c"
+#include "smallshrun.c"
+#include "smallshspawn.c"
+#include "smallshzygote.c"
+#include "smallshparallel.c"
+#include "smallshbuiltins.c"
 #include "smallshfunctions.c"
+#include "smallshserver.c"
 /* Danny Chung | CS344_400_W2022 | chungdan@oregonstate.edu */
 
 
@@ -16,129 +43,155 @@
 /*
 Fills in structure for parsing and saving data associated with command input.
 Returns a structure that can be used by the shell for processing.
+The line is split into words and operators by nextToken in a single pass, and the words are kept in place
+inside the line. The structure and its arguments live in commandArena, and are released when 'main' resets
+it for the next line.
 If the command is a comment or NULL, 'main' program will discard it and start over.
 Takes input of a string.
 Returns commandStructure.
 */
 struct commandStructure* parseInputCommand(char* inputCommand) {
-    struct commandStructure* commandData = malloc(sizeof(struct commandStructure));
+    struct commandStructure* commandData = arenaAllocate(&commandArena, sizeof(struct commandStructure));
+    size_t inputLength = strlen(inputCommand);
 
     //Save a full command line for bash command in case it is needed, and remove '&' from end if present.
-    commandData->bashCommand = calloc(strlen(inputCommand) + 1, sizeof(char));
-    strcpy(commandData->bashCommand, inputCommand);
-    if (strncmp(" &\n", &commandData->bashCommand[strlen(inputCommand) - 3], strlen(" &\n")) == 0) {
-        commandData->bashCommand[strlen(commandData->bashCommand)-2] = '\0';
-    }
-
-    //Take first token of input, and initialize some values of commandStructure commandData.
-    char* savePointer;
-    char* token = strtok_r(inputCommand, " \n", &savePointer);
-    char poundSign = '#';
-    char inputRedir = '<';
-    char outputRedir = '>';
-    char ampersand = '&';
-    commandData->argumentCounter = 0;
-    commandData->outputRedirect = 0;
-    commandData->inputRedirect = 0;
-    commandData->backgroundProcess = 0;
-
-    //Return if first token is NULL. 'main' will reprompt for another command.
-    if (token == NULL) {
-        return commandData;
-    }
-
-    //Return if first token is #, or space.
-    if ((strchr(token, poundSign) != NULL) || ((strcmp(token, "\n") == 0)) || ((strcmp(token, " \n") == 0))) {
-        return commandData;
-    }
-    
-    //Put first real token into commandData->command, and commandData->arguments[]. Increment argumentCounter.
-    commandData->command = calloc(strlen(token) + 1, sizeof(char));
-    strcpy(commandData->command, token);
-    commandData->arguments[commandData->argumentCounter] = token;
-    commandData->argumentCounter++;
-
-    //Take remaining tokens until a NULL token is reached.
-    token = strtok_r(NULL, " \n", &savePointer);
-
-    while (token != NULL) {
-        // Case for when a '>' token is encountered.
-        // Turn commandData->outputRedirect flag to true (1).
-        if (strchr(token, outputRedir) != NULL) {
-            commandData->outputRedirect = commandData->outputRedirect + 1;
-
-            //Check if there has already been a '>' symbol before, and another is found, error. 'main' will reprompt.
-            if (commandData->outputRedirect > 1) {
-                printf("Input/Output Redirection Error. Please limit to one output and one input redirection per command.");
-                fflush(stdout);
-                return commandData;
-            }
+    commandData->bashCommand = arenaCopyString(&commandArena, inputCommand);
+    if ((inputLength >= 3) && (strcmp(" &\n", &commandData->bashCommand[inputLength - 3]) == 0)) {
+        commandData->bashCommand[inputLength - 2] = '\0';
+    }
 
-            // After '>' is encountered, the next argument should be the output File Name.
-            token = strtok_r(NULL, " \n", &savePointer);
+    //Initialize some values of commandStructure commandData. Everything else starts zeroed by the arena.
+    commandData->pipelineStages = 1;
+
+    // Stage currently being filled in. Starts as commandData, and moves down the list at each '|'.
+    struct commandStructure* stage = commandData;
+
+    struct lexerState lexer;
+    char* word;
+    initializeLexer(&lexer, inputCommand);
+    int token = nextToken(&lexer, &word);
+
+    //Take tokens until the end of the line. A blank line or comment returns with no arguments, and 'main' will reprompt.
+    while (token != TOKEN_END) {
+        // An unterminated quote. Error, 'main' will reprompt.
+        if (token == TOKEN_ERROR) {
+            printf("Invalid quoting. Please try again.\n");
+            fflush(stdout);
+            commandData->parseError = 1;
+            return commandData;
+        }
 
-            // If it's not, error. 'main' will reprompt.
-            if ((token == NULL) || (strchr(token, inputRedir) != NULL) || (strchr(token, outputRedir) != NULL) \
-                    || ((strcmp(token, "\n") == 0)) || ((strcmp(token, " \n") == 0)) ) {
-                printf("Invalid input/output redirection. Please try again.");
+        // Case for when a '|' token is encountered.
+        // Close off the current stage and start filling in a new one linked to it.
+        else if (token == TOKEN_PIPE) {
+            // A stage needs a command on both sides of the '|'. If not, error. 'main' will reprompt.
+            if (stage->argumentCounter == 0) {
+                printf("Invalid pipeline. Please try again.\n");
                 fflush(stdout);
+                commandData->parseError = 1;
                 return commandData;
             }
 
-            // Put output File Name into commandData->outputFileName
-            commandData->outputFileName = calloc(strlen(token) + 1, sizeof(char));
-            strcpy(commandData->outputFileName, token);
+            struct commandStructure* newStage = arenaAllocate(&commandArena, sizeof(struct commandStructure));
+            newStage->bashCommand = commandData->bashCommand;
+            stage->nextStage = newStage;
+            stage = newStage;
+            commandData->pipelineStages++;
+        }
 
+        // Case for when '2>&1' or '>&2' is encountered. One stream follows the other, with no file name.
+        else if ((token == TOKEN_STDERR_TO_STDOUT) || (token == TOKEN_STDOUT_TO_STDERR)) {
+            if (token == TOKEN_STDERR_TO_STDOUT) {
+                stage->errorToOutput = 1;
+            }
+            else {
+                stage->outputToError = 1;
+            }
         }
 
-        // Case for when a '<' token is encountered.
-        // Turn commandData->inputRedirect flag to true (1).
-        else if (strchr(token, inputRedir) != NULL) {
-            commandData->inputRedirect = commandData->inputRedirect + 1;
+        // Case for when a '<', '>', '>>', '2>', '2>>', '&>' or '&>>' token is encountered.
+        // Turn the stage's inputRedirect, outputRedirect or errorRedirect flag to true (1).
+        else if ((token == TOKEN_INPUT) || (token == TOKEN_OUTPUT) || (token == TOKEN_APPEND) || (token == TOKEN_STDERR) \
+                || (token == TOKEN_STDERR_APPEND) || (token == TOKEN_BOTH) || (token == TOKEN_BOTH_APPEND)) {
+            int* redirectCount = &stage->outputRedirect;
+            if (token == TOKEN_INPUT) {
+                redirectCount = &stage->inputRedirect;
+            }
+            else if ((token == TOKEN_STDERR) || (token == TOKEN_STDERR_APPEND)) {
+                redirectCount = &stage->errorRedirect;
+            }
+            *redirectCount = *redirectCount + 1;
 
-            //Check if there has already been a '<' symbol before, and another is found, error. 'main' will reprompt.
-            if (commandData->inputRedirect > 1) {
-                printf("Input/Output Redirection Error. Please limit to one output and one input redirection per command.");
+            //Check if there has already been the same symbol before, and another is found, error. 'main' will reprompt.
+            if (*redirectCount > 1) {
+                printf("Input/Output Redirection Error. Please limit to one output, one error and one input redirection per command.");
                 fflush(stdout);
+                commandData->parseError = 1;
                 return commandData;
             }
 
-            // After '<' is encountered, the next argument should be the input File Name.
-            token = strtok_r(NULL, " \n", &savePointer);
-
-            // If it's not, error. 'main' will reprompt.
-            if ((token == NULL) || (strchr(token, inputRedir) != NULL) || (strchr(token, outputRedir) != NULL) \
-                    || ((strcmp(token, "\n") == 0)) || ((strcmp(token, " \n") == 0)) ) {
+            // After '<' or '>' is encountered, the next token should be the File Name. If it's not, error.
+            if (nextToken(&lexer, &word) != TOKEN_WORD) {
                 printf("Invalid input/output redirection. Please try again.");
                 fflush(stdout);
+                commandData->parseError = 1;
                 return commandData;
             }
 
-            // Put input File Name into commandData->inputFileName
-            commandData->inputFileName = calloc(strlen(token) + 1, sizeof(char));
-            strcpy(commandData->inputFileName, token);
+            if (token == TOKEN_INPUT) {
+                stage->inputFileName = word;
+            }
+            else if ((token == TOKEN_STDERR) || (token == TOKEN_STDERR_APPEND)) {
+                stage->errorFileName = word;
+                stage->errorAppend = (token == TOKEN_STDERR_APPEND);
+            }
+            else {
+                stage->outputFileName = word;
+                stage->outputAppend = ((token == TOKEN_APPEND) || (token == TOKEN_BOTH_APPEND));
+                if ((token == TOKEN_BOTH) || (token == TOKEN_BOTH_APPEND)) {
+                    stage->errorToOutput = 1;
+                }
+            }
         }
 
-        //If token is not one of the previous symbols, put the token into the arguments array, and increment it.
-        else {
-            commandData->arguments[commandData->argumentCounter] = token;
-            commandData->argumentCounter++;
+        // Case for when a '&' token is encountered.
+        // It must end the line, and changes commandData->backgroundProcess flag to 1 for the whole pipeline.
+        else if (token == TOKEN_AMPERSAND) {
+            if (nextToken(&lexer, &word) != TOKEN_END) {
+                printf("Invalid use of '&'. It can only end a command.\n");
+                fflush(stdout);
+                commandData->parseError = 1;
+                return commandData;
+            }
+            commandData->backgroundProcess = 1;
+            break;
         }
 
-        //Next token. If it is null, exits while loop.
-        token = strtok_r(NULL, " \n", &savePointer);
-    }
+        //If token is a word, put it into the arguments array.
+        //The first argument of each stage is also that stage's command. NAME=value words before it are assignments,
+        //when the NAME= was typed as it is, with no quotes, backslashes or expansions in it.
+        else {
+            size_t nameLength = assignmentNameLength(word);
+            if ((stage->argumentCounter == 0) && (nameLength > 0) && (nameLength < lexer.literalLength)) {
+                addAssignment(stage, word);
+            }
+            else {
+                if (stage->argumentCounter == 0) {
+                    stage->command = word;
+                }
+                addArgument(stage, word);
+            }
+        }
 
-    // If final argument token is '&' character, remove it by making it null.
-    // Then, change commandData->backGroundProcess flag to 1.
-    if ((strcmp(commandData->arguments[commandData->argumentCounter-1], "&") == 0)) {
-        commandData->backgroundProcess = 1;
-        commandData->arguments[commandData->argumentCounter-1] = NULL;
+        //Next token.
+        token = nextToken(&lexer, &word);
     }
 
-    //If final argument token is not '&' character, make sure the next argument in the array is null for termination.
-    else if ((strcmp(commandData->arguments[commandData->argumentCounter-1], "&") != 0)) {
-        commandData->arguments[commandData->argumentCounter] = NULL;
+    // A trailing '|' leaves the last stage empty. Error, 'main' will reprompt.
+    if ((stage != commandData) && (stage->argumentCounter == 0)) {
+        printf("Invalid pipeline. Please try again.\n");
+        fflush(stdout);
+        commandData->parseError = 1;
     }
 
     //Return the structure.
@@ -148,118 +201,659 @@ struct commandStructure* parseInputCommand(char* inputCommand) {
 
 
 /*
-Expands '$$' string into the process ID number.
-Takes input of a string.
+Structure for the output of stringExpansion. Grows by doubling inside commandArena.
 */
-void stringExpansion(char* inputCommand) {
-    int pid;
-    pid = getpid();
-    char moneySign = '$';
-    char beforeMoneySigns[1024];
-    char afterMoneySigns[1024];
-    int i = 0;
+struct expansionBuffer {
+    char* text;
+    size_t length;
+    size_t capacity;
+};
+
+
+
+/*
+Makes room for at least extraLength more bytes, plus a terminating NUL, in an expansion buffer.
+*/
+void reserveExpansion(struct expansionBuffer* output, size_t extraLength) {
+    if (output->length + extraLength + 1 <= output->capacity) {
+        return;
+    }
+
+    // Doubling keeps many small appends linear. One append bigger than that gets just the room it needs on top.
+    size_t newCapacity = output->capacity * 2;
+    if (output->length + extraLength + 1 > newCapacity) {
+        newCapacity = output->length + extraLength + 1 + output->capacity;
+    }
+    char* newText = arenaAllocate(&commandArena, newCapacity);
+    memcpy(newText, output->text, output->length);
+    output->text = newText;
+    output->capacity = newCapacity;
+}
 
-    // If a '$' is encountered, then check if the next character is also '$'.
-    // If so, split the string where the '$$' was encountered, insert pid, and then
-    // copy back into the inputCommand variable.
-    for (i; i < strlen(inputCommand); i++) {
-        if ((inputCommand[i] == moneySign) && (inputCommand[i+1] == moneySign)) {
-            snprintf(beforeMoneySigns, i+1, "%s", inputCommand);
-            strcpy(afterMoneySigns, &inputCommand[i+2]);
-            sprintf(inputCommand, "%s%d%s", beforeMoneySigns, pid, afterMoneySigns);
-            i=0;
+
+
+/*
+Where a '$' form being expanded stands, which decides how appendExpandedValue writes its value.
+*/
+#define EXPAND_UNQUOTED 0
+#define EXPAND_DOUBLE_QUOTED 1
+// Outside quotes, in the value of a NAME=value word before the command. Like other shells, it is not split.
+#define EXPAND_ASSIGNMENT 2
+
+
+
+/*
+Appends an expanded value to the output so that nextToken reads it back as plain text.
+Inside double quotes, the characters nextToken unescapes there get a backslash.
+Outside quotes, every quoting and operator character and '=' gets a backslash, and newlines and tabs become
+spaces, so the value is still split into words at blanks but nothing in it is treated as syntax. The first
+character of each of its words gets a backslash too, so no word starting with expanded text is an assignment.
+In an assignment value, the value is written as it would be inside double quotes, with the quotes around it.
+value must have a NUL at valueLength, and none before it.
+*/
+void appendExpandedValue(struct expansionBuffer* output, char* value, size_t valueLength, int quoting) {
+    // What each byte needs outside quotes: 1 for a backslash before it, 2 to become a space, 3 for a blank kept
+    // as it is. A table lookup per byte keeps the cost flat however many blanks the value has.
+    static const unsigned char plainHandling[256] = {['\''] = 1, ['"'] = 1, ['\\'] = 1, ['|'] = 1, ['<'] = 1, ['>'] = 1, \
+            ['&'] = 1, ['#'] = 1, [';'] = 1, ['('] = 1, [')'] = 1, ['='] = 1, ['\n'] = 2, ['\t'] = 2, [' '] = 3};
+    // Inside double quotes only these need a backslash.
+    static const char quotedSpecials[] = "\"\\$`";
+    size_t escapeCount = 0;
+    char* writePosition;
+    int wordStart = 1;
+    size_t i = 0;
+
+    // Count the backslashes first, so a large value, like a big '$(...)', reserves only what it needs.
+    // Quoted text rarely needs any, so strcspn finds them, and the runs between are copied whole.
+    if (quoting != EXPAND_UNQUOTED) {
+        for (i; (i += strcspn(&value[i], quotedSpecials)) < valueLength; i++) {
+            escapeCount++;
+        }
+        reserveExpansion(output, valueLength + escapeCount + 2);
+        writePosition = &output->text[output->length];
+        if (quoting == EXPAND_ASSIGNMENT) {
+            *writePosition++ = '"';
+        }
+        for (i = 0; i < valueLength; i++) {
+            size_t runLength = strcspn(&value[i], quotedSpecials);
+            memcpy(writePosition, &value[i], runLength);
+            writePosition += runLength;
+            i += runLength;
+            if (i < valueLength) {
+                *writePosition++ = '\\';
+                *writePosition++ = value[i];
+            }
         }
+        if (quoting == EXPAND_ASSIGNMENT) {
+            *writePosition++ = '"';
+        }
+        output->length = writePosition - output->text;
+        return;
+    }
+
+    for (i; i < valueLength; i++) {
+        unsigned char action = plainHandling[(unsigned char)value[i]];
+        escapeCount += (action == 1) || ((action == 0) && (wordStart == 1));
+        wordStart = (action >= 2);
+    }
+    reserveExpansion(output, valueLength + escapeCount);
+    writePosition = &output->text[output->length];
+    wordStart = 1;
+    for (i = 0; i < valueLength; i++) {
+        char character = value[i];
+        unsigned char action = plainHandling[(unsigned char)character];
+        if ((action == 1) || ((action == 0) && (wordStart == 1))) {
+            *writePosition++ = '\\';
+        }
+        else if (action == 2) {
+            character = ' ';
+        }
+        wordStart = (action >= 2);
+        *writePosition++ = character;
     }
+    output->length = writePosition - output->text;
 }
 
 
 
 /*
-Signal function for handling SIGSTP in the case of the parent.
-Toggles global variable backgroundProcessAllowed.
-Displays a message indicating the toggle status.
+Runs the commands of a '$(...)' in a forked copy of the shell, and appends what they write to stdout.
+The output is read through an enlarged pipe in large reads, straight into a mapping that starts small and
+that mremap grows without copying. Inside double quotes and in assignment values it is then copied in runs, but
+unquoted output is escaped byte by byte for word splitting and costs several times the pipe read. NUL bytes are
+dropped, trailing newlines removed, and the rest goes through appendExpandedValue with the given quoting, so outside double
+quotes and assignment values it is split into words at blanks and newlines. $? becomes the exit status of the commands.
 */
-void handle_SIGTSTP(int signo) {
-    if (backgroundProcessAllowed == 1) {
-        backgroundProcessAllowed = 0;
-        char* message = "\nEntering foreground-only mode (& is now ignored)\n";
-        write(STDOUT_FILENO, message, 50);
+void appendSubstitution(struct expansionBuffer* output, char* commandText, size_t commandLength, int quoting) {
+    int capturePipe[2];
+
+    if (pipe2(capturePipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        lastExitStatus = 1;
+        return;
+    }
+    fcntl(capturePipe[0], F_SETPIPE_SZ, 1024 * 1024);
+
+    substitutionsRun++;
+    // Anything still buffered would be written twice, once by each copy of the shell.
+    fflush(stdout);
+    pid_t processID = fork();
+    if (processID == 0) {
+        struct controlNode* program;
+        dup2(capturePipe[1], STDOUT_FILENO);
+        close(capturePipe[0]);
+        close(capturePipe[1]);
+        detachForkedShell();
+
+        char* innerCommand = arenaAllocate(&commandArena, commandLength + 2);
+        memcpy(innerCommand, commandText, commandLength);
+        innerCommand[commandLength] = '\n';
+        if ((compileControl(innerCommand, &program) == CONTROL_COMPLETE) && (program != NULL)) {
+            runControl(program);
+        }
+        fflush(stdout);
+        _exit(lastExitStatus);
+    }
+    close(capturePipe[1]);
+    if (processID == -1) {
+        perror("fork");
+        close(capturePipe[0]);
+        lastExitStatus = 1;
         return;
     }
 
-    else if (backgroundProcessAllowed == 0) {
-        backgroundProcessAllowed = 1;
-        char* message = "\nExited foreground-only mode.\n";
-        write(STDOUT_FILENO, message, 30);
+    size_t capacity = 65536;
+    size_t length = 0;
+    char* captured = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int captureFailed = (captured == MAP_FAILED);
+    while (captureFailed == 0) {
+        if (length == capacity) {
+            char* grown = mremap(captured, capacity, capacity * 2, MREMAP_MAYMOVE);
+            if (grown == MAP_FAILED) {
+                captureFailed = 1;
+                break;
+            }
+            captured = grown;
+            capacity *= 2;
+        }
+        ssize_t bytesRead = read(capturePipe[0], &captured[length], capacity - length);
+        if ((bytesRead == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            break;
+        }
+        length += bytesRead;
+    }
+    close(capturePipe[0]);
+
+    int childExit;
+    // Output that cannot be held stops the commands, and the substitution expands to nothing.
+    if (captureFailed == 1) {
+        perror("$(...)");
+        kill(processID, SIGKILL);
+        waitForChild(processID, &childExit, 0, NULL);
+        if (captured != MAP_FAILED) {
+            munmap(captured, capacity);
+        }
+        lastExitStatus = 1;
         return;
     }
+    waitForChild(processID, &childExit, 0, NULL);
+    lastExitStatus = WIFEXITED(childExit) ? WEXITSTATUS(childExit) : 128 + WTERMSIG(childExit);
+
+    // A word cannot hold a NUL, so they are dropped, like other shells do.
+    char* nullByte = memchr(captured, '\0', length);
+    if (nullByte != NULL) {
+        size_t kept = nullByte - captured;
+        size_t i = kept;
+        for (i; i < length; i++) {
+            if (captured[i] != '\0') {
+                captured[kept++] = captured[i];
+            }
+        }
+        length = kept;
+    }
+    while ((length > 0) && (captured[length - 1] == '\n')) {
+        length--;
+    }
+    // The read loop grows the mapping before its last read, so there is always room for the NUL.
+    captured[length] = '\0';
+    appendExpandedValue(output, captured, length, quoting);
+    munmap(captured, capacity);
+}
+
+
+
+/*
+Expands '$' forms in a command line in a single left-to-right pass:
+$$         the shell's process ID, found once and cached.
+$?         lastExitStatus.
+$VAR       the value of an environment variable (letters, digits and '_'), empty if it is not set.
+${VAR}     the same, with the name closed off by braces.
+$(...)     what the commands inside write to stdout, see appendSubstitution.
+Nothing is expanded inside '...' or after a backslash, matching how nextToken reads the line.
+A '$' that does not start one of these forms is kept as it is.
+With findAssignments set, the line is a command, and the values of the NAME=value words typed before each
+stage's command are not split into words. A 'for' word list is expanded without it.
+Every input byte is looked at once and every output byte written once, so the time is linear in the
+length of the line plus the length of what is put in, however many expansions there are.
+Takes input of a string.
+Returns the expanded string, in commandArena.
+*/
+char* expandLine(char* inputCommand, int findAssignments) {
+    static char processID[16];
+    static int processIDLength = 0;
+    char statusText[16];
+    char moneySign = '$';
+    int quoteState = LEX_PLAIN;
+    size_t i = 0;
+    // Outside quotes, words are followed as nextToken will split them. A stage has its command once a word that
+    // is not NAME=value or a redirection target has started, and assignmentWord is set in a NAME=value before it.
+    static const unsigned char wordBreak[256] = {[' '] = 1, ['\t'] = 1, ['\n'] = 1, ['|'] = 1, ['&'] = 1, [';'] = 1, \
+            ['<'] = 1, ['>'] = 1, ['('] = 1, [')'] = 1};
+    int wordStart = 1;
+    int stageHasCommand = (findAssignments == 0);
+    int redirectTarget = 0;
+    int assignmentWord = 0;
+
+    TRACE_BEGIN(TRACE_EXPAND);
+    if (processIDLength == 0) {
+        processIDLength = sprintf(processID, "%d", getpid());
+    }
+
+    size_t inputLength = strlen(inputCommand);
+    struct expansionBuffer output;
+    output.capacity = inputLength + 64;
+    output.text = arenaAllocate(&commandArena, output.capacity);
+    output.length = 0;
+
+    while (i < inputLength) {
+        char character = inputCommand[i];
+
+        if ((quoteState == LEX_PLAIN) && (wordBreak[(unsigned char)character] == 1)) {
+            wordStart = 1;
+            assignmentWord = 0;
+            if (character == '|') {
+                stageHasCommand = (findAssignments == 0);
+            }
+            else if ((character == '<') || (character == '>')) {
+                redirectTarget = 1;
+            }
+        }
+        else if ((quoteState == LEX_PLAIN) && (wordStart == 1)) {
+            wordStart = 0;
+            if (redirectTarget == 1) {
+                redirectTarget = 0;
+            }
+            else if ((stageHasCommand == 0) && (assignmentNameLength(&inputCommand[i]) > 0)) {
+                assignmentWord = 1;
+            }
+            // The '2' of '2>' is part of the operator, not the command.
+            else if ((character != '2') || (inputCommand[i + 1] != '>')) {
+                stageHasCommand = 1;
+            }
+        }
+
+        // Backslash keeps the next character as it is, except inside single quotes where it is literal.
+        if ((character == '\\') && (quoteState != LEX_SINGLE_QUOTE) && (i + 1 < inputLength)) {
+            reserveExpansion(&output, 2);
+            output.text[output.length++] = character;
+            output.text[output.length++] = inputCommand[i+1];
+            i += 2;
+            continue;
+        }
+
+        if ((character == '\'') && (quoteState != LEX_DOUBLE_QUOTE)) {
+            quoteState = (quoteState == LEX_SINGLE_QUOTE) ? LEX_PLAIN : LEX_SINGLE_QUOTE;
+        }
+        else if ((character == '"') && (quoteState != LEX_SINGLE_QUOTE)) {
+            quoteState = (quoteState == LEX_DOUBLE_QUOTE) ? LEX_PLAIN : LEX_DOUBLE_QUOTE;
+        }
+        else if ((character == moneySign) && (quoteState != LEX_SINGLE_QUOTE)) {
+            char nextCharacter = inputCommand[i+1];
+            int quoting = (quoteState == LEX_DOUBLE_QUOTE) ? EXPAND_DOUBLE_QUOTED \
+                    : ((assignmentWord == 1) ? EXPAND_ASSIGNMENT : EXPAND_UNQUOTED);
+
+            // $$ expands to the process ID.
+            if (nextCharacter == moneySign) {
+                appendExpandedValue(&output, processID, processIDLength, quoting);
+                i += 2;
+                continue;
+            }
+
+            // $? expands to the last exit status.
+            if (nextCharacter == '?') {
+                int statusLength = sprintf(statusText, "%d", lastExitStatus);
+                appendExpandedValue(&output, statusText, statusLength, quoting);
+                i += 2;
+                continue;
+            }
+
+            // $(...) expands to the output of the commands inside.
+            if (nextCharacter == '(') {
+                size_t closePosition = findSubstitutionEnd(inputCommand, i + 1);
+                if (closePosition != 0) {
+                    appendSubstitution(&output, &inputCommand[i + 2], closePosition - i - 2, quoting);
+                    i = closePosition + 1;
+                    continue;
+                }
+            }
+
+            // $VAR and ${VAR} expand to the variable's value.
+            size_t nameStart = i + 1;
+            int braced = (nextCharacter == '{');
+            if (braced == 1) {
+                nameStart++;
+            }
+            size_t nameEnd = nameStart;
+            while ((nameEnd < inputLength) && ((inputCommand[nameEnd] == '_') || isalnum((unsigned char)inputCommand[nameEnd]))) {
+                nameEnd++;
+            }
+
+            int validName = (nameEnd > nameStart) && !isdigit((unsigned char)inputCommand[nameStart]);
+            if ((validName == 1) && ((braced == 0) || (inputCommand[nameEnd] == '}'))) {
+                char savedCharacter = inputCommand[nameEnd];
+                inputCommand[nameEnd] = '\0';
+                char* value = getVariable(&inputCommand[nameStart]);
+                inputCommand[nameEnd] = savedCharacter;
+
+                if (value != NULL) {
+                    appendExpandedValue(&output, value, strlen(value), quoting);
+                }
+                i = (braced == 1) ? nameEnd + 1 : nameEnd;
+                continue;
+            }
+        }
+
+        reserveExpansion(&output, 1);
+        output.text[output.length++] = character;
+        i++;
+    }
+
+    output.text[output.length] = '\0';
+    TRACE_END(TRACE_EXPAND, 0, (int)output.length, NULL);
+    return output.text;
+}
+
+
+
+/*
+Expands a command line, see expandLine.
+*/
+char* stringExpansion(char* inputCommand) {
+    return expandLine(inputCommand, 1);
 }
 
 
 
 /*
-Sets the SIGINT and SIGTSTP signal handlers.
-SIGINT to SIG_IGN
-SIGTSTP to handle_SIGTSTP function.
+Sets up the shell's signals. SIGINT, SIGTSTP and SIGCHLD are blocked and read from shellSignalFd
+by the event loop (smallshevents.c), so no signal handler runs in the shell at all.
+Their dispositions are put back to default first, since a signalfd never sees an ignored signal.
+Children get their own mask and dispositions from the spawn engine, so this is done once.
 */
 void setSignals() {
-    struct sigaction SIGINT_action = {0};
-    struct sigaction SIGTSTP_action = {0};
-
-    SIGINT_action.sa_handler = SIG_IGN;
-    sigfillset(&SIGINT_action.sa_mask);
-    SIGINT_action.sa_flags = 0;
-    sigaction(SIGINT, &SIGINT_action, NULL);
-
-    SIGTSTP_action.sa_handler = handle_SIGTSTP;
-    sigfillset(&SIGTSTP_action.sa_mask);
-    SIGTSTP_action.sa_flags = 0;
-    sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+    struct sigaction defaultAction = {0};
+    sigset_t shellSignals;
+
+    defaultAction.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &defaultAction, NULL);
+    sigaction(SIGTSTP, &defaultAction, NULL);
+    sigaction(SIGCHLD, &defaultAction, NULL);
+
+    sigemptyset(&shellSignals);
+    sigaddset(&shellSignals, SIGINT);
+    sigaddset(&shellSignals, SIGTSTP);
+    sigaddset(&shellSignals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &shellSignals, NULL);
+
+    shellSignalFd = signalfd(-1, &shellSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (shellSignalFd == -1) {
+        perror("signalfd");
+        exit(1);
+    }
 }
 
 
 
-int main(void) {
-    char inputCommand[2048];
+/*
+Waits until a line can be read from stdin, when the input reader has no whole line left.
+While waiting, the event loop reports background children that finish, handles SIGTSTP and SIGINT,
+runs timers, and prints the prompt again after any message.
+*/
+void waitForInput() {
+    while (processShellEvents(-1, 1) == 0) {
+    }
+}
 
-    // Initialize the childProcesses global array.
-    initializeChildArray();
-    while (1) {
-        // Set signal handlers.
-        setSignals();
 
-         // Check for zombie or ended child processes and clear them.
-        checkChildProcesses();
 
-        // Prompt for inputCommand.
-        memset(inputCommand, 0, sizeof(inputCommand));
+/*
+Throughput report globals, for 'smallsh -t'.
+*/
+struct inputReader shellInput;
+long long commandsRun = 0;
+// Counts '$(...)' runs, so a command of only assignments can tell whether it ran one.
+long long substitutionsRun = 0;
+struct timespec shellStartTime;
+pid_t shellPID;
+
+
+
+/*
+Prints the number of lines and commands run, and the rate, to stderr when the shell exits.
+Registered with atexit for 'smallsh -t'. Children that exit after a failed exec skip it.
+*/
+void reportThroughput() {
+    struct timespec shellEndTime;
+    if (getpid() != shellPID) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &shellEndTime);
+    double elapsedSeconds = (shellEndTime.tv_sec - shellStartTime.tv_sec) \
+            + (shellEndTime.tv_nsec - shellStartTime.tv_nsec) / 1e9;
+    fprintf(stderr, "smallsh: %lld lines, %lld commands, %lld bytes in %.3f s (%.0f commands/s)\n", \
+            shellInput.linesRead, commandsRun, shellInput.bytesRead, elapsedSeconds, \
+            (elapsedSeconds > 0) ? commandsRun / elapsedSeconds : 0.0);
+}
+
+
+
+/*
+Prints how to start the shell, and exits with status 2.
+*/
+void printUsage() {
+    fprintf(stderr, "Usage: smallsh [-t] [-c commands | script]\n       smallsh --serve socket [-j workers]\n");
+    exit(2);
+}
+
+
+
+/*
+Reads one line of input, waiting for it without blocking background notices. With the line editor, the editor
+prints the prompt and waits on the event loop itself. On a terminal, a '!' history reference is expanded and
+the line is added to the history.
+Returns the line, ending in a newline, in commandArena, or NULL at the end of input. A history reference that
+is not found returns an empty line.
+*/
+char* readCommandLine(int interactiveShell, int lineEditing, char* prompt) {
+    size_t lineLength;
+    char* inputLine;
+
+    if ((interactiveShell == 1) && (lineEditing == 0)) {
+        printf("%s", prompt);
         fflush(stdout);
+        if (inputLineBuffered(&shellInput) == 0) {
+            waitForInput();
+        }
+    }
+
+    TRACE_BEGIN(TRACE_READ);
+    if (lineEditing == 1) {
+        inputLine = editInputLine(&lineEditor, prompt, &lineLength);
+    }
+    else {
+        inputLine = readInputLine(&shellInput, &lineLength);
+    }
+    TRACE_END(TRACE_READ, 0, (inputLine != NULL) ? (int)lineLength : -1, NULL);
+    if (inputLine == NULL) {
+        return NULL;
+    }
+
+    // Copy the line into the arena, and make sure it ends in a newline like a typed line does.
+    char* inputCommand = arenaAllocate(&commandArena, lineLength + 2);
+    memcpy(inputCommand, inputLine, lineLength);
+    if (inputCommand[lineLength - 1] != '\n') {
+        inputCommand[lineLength] = '\n';
+    }
+
+    // Expand a '!' history reference, and add the line to the history. Only done for a terminal, like bash.
+    if (interactiveShell == 1) {
+        char* expandedCommand = expandHistory(inputCommand);
+        if (expandedCommand == NULL) {
+            return "\n";
+        }
+        recordHistory(expandedCommand, strlen(expandedCommand));
+        return expandedCommand;
+    }
+    return inputCommand;
+}
+
+
 
-        // Short sleep to make sure background terminating messages can be printed before ': ' is reprompted.
-        usleep(400);
+#ifndef SMALLSH_NO_MAIN
+int main(int argc, char* argv[]) {
+    char* commandString = NULL;
+    char* scriptName = NULL;
+    char* socketPath = NULL;
+    int workerLimit = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int reportRequested = 0;
+    int argumentIndex = 1;
+
+    // Options. -c runs the given commands, a file name runs a script, and -t reports throughput at exit.
+    // --serve runs commands sent to a Unix socket instead, at most -j at once (one per CPU by default).
+    for (argumentIndex; argumentIndex < argc; argumentIndex++) {
+        if (strcmp(argv[argumentIndex], "-t") == 0) {
+            reportRequested = 1;
+        }
+        else if (strcmp(argv[argumentIndex], "-c") == 0) {
+            if ((argumentIndex + 1 >= argc) || (scriptName != NULL)) {
+                printUsage();
+            }
+            argumentIndex++;
+            commandString = argv[argumentIndex];
+        }
+        else if ((strcmp(argv[argumentIndex], "--serve") == 0) && (argumentIndex + 1 < argc)) {
+            argumentIndex++;
+            socketPath = argv[argumentIndex];
+        }
+        else if ((strcmp(argv[argumentIndex], "-j") == 0) && (argumentIndex + 1 < argc)) {
+            argumentIndex++;
+            workerLimit = atoi(argv[argumentIndex]);
+            if (workerLimit < 1) {
+                printUsage();
+            }
+        }
+        else if ((argv[argumentIndex][0] == '-') || (scriptName != NULL) || (commandString != NULL)) {
+            printUsage();
+        }
+        else {
+            scriptName = argv[argumentIndex];
+        }
+    }
 
-        printf(": ");
+    // Select the spawn engine from the environment if one is given, e.g. SMALLSH_SPAWN=fork.
+    if ((getenv("SMALLSH_SPAWN") != NULL) && (setSpawnEngine(getenv("SMALLSH_SPAWN")) == -1)) {
+        printf("Invalid SMALLSH_SPAWN value. Using posix_spawn.\n");
         fflush(stdout);
-        fgets(inputCommand, 2048, stdin);
+    }
 
-        // Expand any '$$' string into PID.
-        stringExpansion(inputCommand);
+    // Turn on tracing from SMALLSH_TRACE, before anything worth tracing happens.
+    initializeTracing();
 
-        // Create a commandStructure structure from the input command.
-        struct commandStructure* command = parseInputCommand(inputCommand);
+    // Open the /dev/null fd that background stages share.
+    openDevNull();
 
-        // When the command is returned, check if it is valid.
-        // If invalid, free it, and return to beginning of loop to get another input command.
-        if ((command->argumentCounter < 1) || (command->inputRedirect > 1) || (command->outputRedirect > 1)) {
-            free(command);
-            continue;
+    // Move SIGINT, SIGTSTP and SIGCHLD onto the signalfd that the event loop reads.
+    setSignals();
+
+    if (socketPath != NULL) {
+        if ((commandString != NULL) || (scriptName != NULL)) {
+            printUsage();
+        }
+        serveCommands(socketPath, workerLimit);
+    }
+
+    // Pick the input. Only a terminal on stdin gets the ': ' prompt; anything else runs in batch mode.
+    int interactiveShell = 0;
+    if (commandString != NULL) {
+        initializeStringReader(&shellInput, commandString);
+    }
+    else if (scriptName != NULL) {
+        int scriptFile = open(scriptName, O_RDONLY | O_CLOEXEC);
+        if (scriptFile == -1) {
+            fprintf(stderr, "smallsh: cannot open script '%s'.\n", scriptName);
+            exit(1);
+        }
+        initializeInputReader(&shellInput, scriptFile);
+    }
+    else {
+        initializeInputReader(&shellInput, STDIN_FILENO);
+        interactiveShell = isatty(STDIN_FILENO);
+    }
+    // A terminal gets the line editor, with completion and history, unless it is a dumb one.
+    int lineEditing = ((interactiveShell == 1) && (initializeLineEditor(&lineEditor) == 0));
+
+    if (reportRequested == 1) {
+        shellPID = getpid();
+        clock_gettime(CLOCK_MONOTONIC, &shellStartTime);
+        atexit(reportThroughput);
+    }
+
+    while (1) {
+        // Everything parsed from the previous line is released at once.
+        resetArena(&commandArena);
+
+        // Handle signals from while the last command ran, and report background children that have finished since.
+        handleShellSignals(0);
+        reapChildProcesses(0);
+
+        // End of input exits the shell the same way the exit command does, with the last status.
+        char* inputCommand = readCommandLine(interactiveShell, lineEditing, ": ");
+        if (inputCommand == NULL) {
+            exitShell(lastExitStatus);
         }
 
-        // Process the command structure in the shell.
-        shellCommand(command);
+        // Compile the line into a tree of commands. A line that leaves an 'if', 'for' or 'while' open, or ends
+        // in '&&' or '||', is joined with the lines after it until the tree is complete.
+        struct controlNode* program;
+        int compileResult;
+        TRACE_BEGIN(TRACE_PARSE);
+        while ((compileResult = compileControl(inputCommand, &program)) == CONTROL_INCOMPLETE) {
+            char* nextLine = readCommandLine(interactiveShell, lineEditing, "> ");
+            if (nextLine == NULL) {
+                printf("Unexpected end of input. Please try again.\n");
+                fflush(stdout);
+                break;
+            }
+            char* joinedCommand = arenaAllocate(&commandArena, strlen(inputCommand) + strlen(nextLine) + 1);
+            strcpy(joinedCommand, inputCommand);
+            strcat(joinedCommand, nextLine);
+            inputCommand = joinedCommand;
+        }
+        TRACE_END(TRACE_PARSE, 0, compileResult, NULL);
+
+        // A blank line, a comment or a syntax error returns to the beginning of the loop to get another input command.
+        if ((compileResult != CONTROL_COMPLETE) || (program == NULL)) {
+            continue;
+        }
 
-        // Free the command structure when done working with it.
-        free(command);
+        // Run the tree. '$' forms are expanded as each command runs, so they see what ran before them.
+        foregroundInterrupted = 0;
+        runControl(program);
     }
 
 }
+#endif
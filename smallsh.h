@@ -0,0 +1,296 @@
+#ifndef SMALLSH_H
+#define SMALLSH_H
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+/*
+Global Variables
+*/
+// Keep track of child's last exit status.
+int lastExitStatus = 0;
+// Toggle flag for foreground-only mode.
+int backgroundProcessAllowed = 1;
+// Set with 'set -e'. Exit the shell when a foreground command fails.
+int exitOnFailure = 0;
+// signalfd for SIGINT, SIGTSTP and SIGCHLD, which the shell keeps blocked. Read by handleShellSignals.
+int shellSignalFd = -1;
+// Set when SIGCHLD is read from shellSignalFd. Lets reapChildProcesses skip all work when no child has changed state.
+int childSignalled = 0;
+// Requested pipe buffer size in bytes for pipelines. 0 keeps the kernel default.
+int pipeBufferSize = 0;
+// Socket to the zygote spawn helper, or -1 when it is not running.
+int zygoteSocket = -1;
+// Wait status recorded for a child whose real status was lost, like one started by a zygote that has exited.
+// It reads as exit status 1, so 'set -e' and $? see the child as failed.
+#define LOST_CHILD_EXIT (1 << 8)
+// Set by 'trace on' or SMALLSH_TRACE. The TRACE macros test it first, so tracing costs one branch when off.
+int traceEnabled = 0;
+
+/*
+Trace event types and recording macros, see smallshtrace.c.
+*/
+#define TRACE_READ 0
+#define TRACE_EXPAND 1
+#define TRACE_PARSE 2
+#define TRACE_SPAWN 3
+#define TRACE_EXEC 4
+#define TRACE_EXIT 5
+#define TRACE_REAP 6
+#define TRACE_BEGIN(type) \
+    do { if (__builtin_expect(traceEnabled, 0)) recordTraceEvent((type), 'B', 0, 0, NULL); } while (0)
+#define TRACE_END(type, processID, value, name) \
+    do { if (__builtin_expect(traceEnabled, 0)) recordTraceEvent((type), 'E', (processID), (value), (name)); } while (0)
+#define TRACE_INSTANT(type, processID, value, name) \
+    do { if (__builtin_expect(traceEnabled, 0)) recordTraceEvent((type), 'i', (processID), (value), (name)); } while (0)
+// Summed rusage of the foreground processes waited for since the last 'time' started. Read by 'time'.
+struct rusage foregroundUsage = {0};
+
+/*
+Structure for parsing and saving data associated with command input.
+Commands with '|' are a list of these, one per stage, linked through nextStage.
+*/
+struct commandStructure {
+    char* command;
+    char* bashCommand;
+    char** arguments;
+    int argumentCounter;
+    int argumentCapacity;
+    // NAME=value words in front of the command. They set shell variables when there is no command,
+    // and are added to the command's environment otherwise.
+    char** assignments;
+    int assignmentCount;
+    int assignmentCapacity;
+    char* inputFileName;
+    char* outputFileName;
+    int outputRedirect;
+    int inputRedirect;
+    // '>>' and '&>>' append to outputFileName instead of truncating it.
+    int outputAppend;
+    // '2>' and '2>>' send stderr to errorFileName.
+    char* errorFileName;
+    int errorRedirect;
+    int errorAppend;
+    // '2>&1' and '&>' send stderr wherever stdout goes. '>&2' sends stdout wherever stderr goes.
+    int errorToOutput;
+    int outputToError;
+    int backgroundProcess;
+    struct commandStructure* nextStage;
+    int pipelineStages;
+    int parseError;
+};
+
+/*
+Structure for the stdin, stdout and stderr of one stage, filled in by openRedirects.
+fds holds the fd for each of 0, 1 and 2, or -1 to keep the shell's own. opened holds the files that were opened for it.
+*/
+struct redirectFds {
+    int fds[3];
+    int opened[3];
+};
+
+/*
+Structure for the CPU affinity, nice value, I/O priority and limits to apply to a child before exec.
+Filled in by the 'run' prefix and 'bgpolicy'. Fields that are not set leave the child as it would be.
+Plain data, so it can be copied into a zygote request as it is.
+*/
+#define RUN_LIMIT_CPU 0
+#define RUN_LIMIT_AS 1
+#define RUN_LIMIT_NOFILE 2
+#define RUN_LIMIT_COUNT 3
+struct runPolicy {
+    // 1 if any setting below is set.
+    int active;
+    int affinitySet;
+    cpu_set_t affinity;
+    int niceSet;
+    int niceValue;
+    // Value for ioprio_set, or 0 for none.
+    int ioPriority;
+    int limitSet[RUN_LIMIT_COUNT];
+    rlim_t limits[RUN_LIMIT_COUNT];
+};
+
+/*
+Structure for a command's timeout, see smallshtimeout.c. processIDs belong to the command, or to job for a
+background command. timer is the event loop timer still to fire, or NULL.
+*/
+struct commandTimeout {
+    pid_t* processIDs;
+    int processCount;
+    struct jobEntry* job;
+    long long graceNanoseconds;
+    // Set once SIGTERM has been sent. The command's exit status is then 124.
+    int timedOut;
+    struct eventSource* timer;
+};
+
+/*
+Functions shared between files.
+*/
+// smallshspawn.c
+pid_t spawnCommand(struct commandStructure* stage, int childFds[3], int background);
+void printSpawnEngine();
+int setSpawnEngine(char* engineName);
+pid_t spawnWithRunPolicy(char* programPath, char** arguments, char** environment, int childFds[3], int background, \
+        sigset_t* defaultSignals, struct runPolicy* policy, int* spawnError);
+
+// smallshevents.c
+struct eventSource;
+void toggleForegroundOnly();
+int handleShellSignals(int atPrompt);
+struct eventSource* startShellTimer(long long delayNanoseconds, void (*expire)(void* data), void* data);
+void cancelShellTimer(struct eventSource* timer);
+int waitForShellEvents(int timeoutMilliseconds, int atPrompt, int* inputReady);
+int processShellEvents(int timeoutMilliseconds, int atPrompt);
+pid_t waitForChildWithTimers(pid_t processID, int* childExit, int options, struct rusage* usage);
+
+// smallshtimeout.c
+extern long long pendingTimeoutNanoseconds;
+extern long long pendingGraceNanoseconds;
+extern long long backgroundTimeoutNanoseconds;
+extern long long defaultGraceNanoseconds;
+void startCommandTimeout(struct commandTimeout* timeout, pid_t* processIDs, int processCount, struct jobEntry* job, \
+        long long timeoutNanoseconds, long long graceNanoseconds);
+void stopCommandTimeout(struct commandTimeout* timeout);
+void timeoutCommand(struct commandStructure* command);
+void backgroundTimeoutCommand(struct commandStructure* command);
+
+// smallshrun.c
+int effectiveRunPolicy(int background, struct runPolicy* policy);
+int applyRunPolicy(struct runPolicy* policy);
+void runCommand(struct commandStructure* command);
+void backgroundPolicyCommand(struct commandStructure* command);
+
+// smallshzygote.c
+int startZygote();
+pid_t spawnWithZygote(struct commandStructure* stage, char* programPath, char** environment, int childFds[3], int background, \
+        struct runPolicy* policy);
+pid_t waitForChild(pid_t processID, int* childExit, int options, struct rusage* usage);
+void drainZygoteMessages();
+
+// smallsharena.c
+struct arena;
+extern struct arena commandArena;
+void* arenaAllocate(struct arena* memoryArena, size_t size);
+char* arenaCopyString(struct arena* memoryArena, char* text);
+void resetArena(struct arena* memoryArena);
+struct arenaMark;
+struct arenaMark markArena(struct arena* memoryArena);
+void rewindArena(struct arena* memoryArena, struct arenaMark* mark);
+
+// smallshcontrol.c
+#define CONTROL_COMPLETE 0
+#define CONTROL_INCOMPLETE 1
+#define CONTROL_ERROR 2
+struct controlNode;
+extern int foregroundInterrupted;
+int compileControl(char* inputCommand, struct controlNode** program);
+void runControl(struct controlNode* node);
+
+// smallsh.c
+extern long long commandsRun;
+extern long long substitutionsRun;
+char* expandLine(char* inputCommand, int findAssignments);
+char* stringExpansion(char* inputCommand);
+struct commandStructure* parseInputCommand(char* inputCommand);
+void printArenaStats();
+void setSignals();
+
+// smallshhash.c
+char* lookupCommandPath(char* commandName);
+void hashCommand(struct commandStructure* command);
+
+// smallshvariables.c
+size_t assignmentNameLength(char* word);
+char* getVariable(char* name);
+void setVariable(char* name, size_t nameLength, char* value, int export);
+char** shellEnvironment();
+char** commandEnvironment(struct commandStructure* stage);
+void restoreEnvironment(struct commandStructure* stage);
+void assignVariables(struct commandStructure* command);
+void exportCommand(struct commandStructure* command);
+void unsetCommand(struct commandStructure* command);
+int printEnvironment();
+
+// smallshhistory.c
+void recordHistory(char* line, size_t lineLength);
+int syncHistory();
+char* historyEntry(unsigned int entryNumber, size_t* entryLength);
+unsigned int searchHistory(char* text, size_t textLength, unsigned int before, int prefixOnly);
+char* expandHistory(char* inputCommand);
+void historyCommand(struct commandStructure* command);
+
+// smallshcomplete.c
+struct completionList;
+int completeWord(char* word, size_t wordLength, int commandPosition, struct completionList* list, size_t* prefixLength);
+
+// smallshedit.c
+struct lineEditor;
+int initializeLineEditor(struct lineEditor* editor);
+char* editInputLine(struct lineEditor* editor, char* prompt, size_t* lineLength);
+
+// smallshtrace.c
+void recordTraceEvent(int type, char phase, pid_t processID, int value, char* name);
+void initializeTracing();
+void traceCommand(struct commandStructure* command);
+
+// smallshstats.c
+long long nanosecondsSince(struct timespec* startTime);
+void recordProcessUsage(char* commandName, long long wallNanoseconds, struct rusage* usage);
+void addUsage(struct rusage* total, struct rusage* usage);
+void statsCommand(struct commandStructure* command);
+void printCommandTime(long long wallNanoseconds, struct rusage* usage);
+
+// smallshjobs.c
+struct jobEntry;
+struct jobEntry* addJob(char* commandText, pid_t* processIDs, char** processNames, int processCount);
+struct jobEntry* findJobByProcess(pid_t processID);
+int updateJobProcess(struct jobEntry* job, pid_t processID, int childExit, struct rusage* usage);
+void setJobTimeout(struct jobEntry* job, long long timeoutNanoseconds, long long graceNanoseconds);
+void removeJob(struct jobEntry* job);
+void jobsCommand(struct commandStructure* command);
+void waitCommand(struct commandStructure* command);
+void fgCommand(struct commandStructure* command);
+void bgCommand(struct commandStructure* command);
+void killAllJobs();
+void forgetAllJobs();
+
+// smallshparallel.c
+void parallelCommand(struct commandStructure* command);
+
+// smallshbuiltins.c
+int runFastBuiltin(struct commandStructure* command);
+
+// smallshredirect.c
+int openDevNull();
+int openRedirects(struct commandStructure* stage, int pipeInput, int pipeOutput, int background, struct redirectFds* redirects);
+void closeRedirects(struct redirectFds* redirects);
+void applyRedirects(struct redirectFds* redirects, int savedFds[3]);
+void restoreRedirects(int savedFds[3]);
+
+// smallshfunctions.c
+void exitShell(int exitStatus);
+void detachForkedShell();
+void setSignalsForegroundChild();
+void setSignalsBackgroundChild();
+int reapChildProcesses(int promptShown);
+int isShellBuiltin(char* commandName);
+void runShellBuiltin(struct commandStructure* command);
+int shellCommand(struct commandStructure* command);
+
+// smallshserver.c
+void serveCommands(char* socketPath, int workerLimit);
+
+#endif
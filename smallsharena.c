@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smallsh.h"
+
+// Size of a normal arena block. Larger requests get a block of their own size.
+#define ARENA_BLOCK_SIZE 65536
+// Blocks bigger than this, made for one large allocation like a big '$(...)' output, are freed at reset.
+#define ARENA_KEEP_LIMIT (1024 * 1024)
+// Every allocation is rounded up to this, so any type can be stored.
+#define ARENA_ALIGNMENT 16
+
+/*
+Structure for one block of arena memory. Blocks are chained, and kept across resets.
+*/
+struct arenaBlock {
+    struct arenaBlock* nextBlock;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/*
+Structure for a bump-pointer arena.
+Allocations are never freed one at a time. resetArena releases everything at once and keeps the blocks.
+*/
+struct arena {
+    struct arenaBlock* firstBlock;
+    struct arenaBlock* currentBlock;
+    int blockCount;
+    // Debug counters, shown by 'arenastats'.
+    size_t bytesInUse;
+    size_t highWaterMark;
+    long long bytesRecycled;
+    long long resetCount;
+};
+
+/*
+Structure for a point in an arena to go back to. Everything allocated after it is released by rewindArena.
+*/
+struct arenaMark {
+    struct arenaBlock* block;
+    size_t used;
+    size_t bytesInUse;
+};
+
+/*
+Arena for everything parsed from one command line. Reset by 'main' before each line.
+*/
+struct arena commandArena = {0};
+
+
+
+/*
+Allocates a new, zeroed block with room for at least minimumSize bytes and links it after the current block.
+calloc gets a large block straight from fresh pages without clearing it, so a big '$(...)' output is not written twice.
+*/
+struct arenaBlock* addArenaBlock(struct arena* memoryArena, size_t minimumSize) {
+    size_t blockSize = (minimumSize > ARENA_BLOCK_SIZE) ? minimumSize : ARENA_BLOCK_SIZE;
+    struct arenaBlock* block = calloc(1, sizeof(struct arenaBlock) + blockSize);
+
+    if (block == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    block->size = blockSize;
+    block->used = 0;
+
+    if (memoryArena->currentBlock == NULL) {
+        block->nextBlock = NULL;
+        memoryArena->firstBlock = block;
+    }
+    else {
+        block->nextBlock = memoryArena->currentBlock->nextBlock;
+        memoryArena->currentBlock->nextBlock = block;
+    }
+    memoryArena->blockCount++;
+    return block;
+}
+
+
+
+/*
+Returns size bytes of zeroed memory from the arena, like calloc.
+Moves on to the next kept block, or adds a new one, when the current block is full.
+A new block is already zeroed, so memory from it is not cleared again.
+*/
+void* arenaAllocate(struct arena* memoryArena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    struct arenaBlock* block = memoryArena->currentBlock;
+    int newBlock = 0;
+    while ((block == NULL) || (block->size - block->used < size)) {
+        if ((block != NULL) && (block->nextBlock != NULL)) {
+            block = block->nextBlock;
+            block->used = 0;
+            newBlock = 0;
+        }
+        else {
+            block = addArenaBlock(memoryArena, size);
+            newBlock = 1;
+        }
+        memoryArena->currentBlock = block;
+    }
+
+    void* memory = &block->data[block->used];
+    block->used += size;
+    memoryArena->bytesInUse += size;
+    if (memoryArena->bytesInUse > memoryArena->highWaterMark) {
+        memoryArena->highWaterMark = memoryArena->bytesInUse;
+    }
+
+    if (!newBlock) {
+        memset(memory, 0, size);
+    }
+    return memory;
+}
+
+
+
+/*
+Copies a string into the arena.
+*/
+char* arenaCopyString(struct arena* memoryArena, char* text) {
+    size_t textLength = strlen(text);
+    char* copy = arenaAllocate(memoryArena, textLength + 1);
+    memcpy(copy, text, textLength);
+    return copy;
+}
+
+
+
+/*
+Releases every allocation in the arena at once. Blocks are kept for the next command line, except
+oversized ones, so one huge line does not hold on to its memory for the rest of the session.
+*/
+void resetArena(struct arena* memoryArena) {
+    struct arenaBlock** link = &memoryArena->firstBlock;
+    while (*link != NULL) {
+        struct arenaBlock* block = *link;
+        if (block->size > ARENA_KEEP_LIMIT) {
+            *link = block->nextBlock;
+            free(block);
+            memoryArena->blockCount--;
+        }
+        else {
+            link = &block->nextBlock;
+        }
+    }
+
+    memoryArena->bytesRecycled += memoryArena->bytesInUse;
+    memoryArena->bytesInUse = 0;
+    memoryArena->resetCount++;
+    memoryArena->currentBlock = memoryArena->firstBlock;
+    if (memoryArena->firstBlock != NULL) {
+        memoryArena->firstBlock->used = 0;
+    }
+}
+
+
+
+/*
+Returns the current point in the arena, for rewindArena.
+*/
+struct arenaMark markArena(struct arena* memoryArena) {
+    struct arenaMark mark;
+
+    mark.block = memoryArena->currentBlock;
+    mark.used = (mark.block != NULL) ? mark.block->used : 0;
+    mark.bytesInUse = memoryArena->bytesInUse;
+    return mark;
+}
+
+
+
+/*
+Releases everything allocated since mark was taken, and keeps what came before it.
+Used to run the commands of a loop over and over inside the memory of the line that holds the loop.
+*/
+void rewindArena(struct arena* memoryArena, struct arenaMark* mark) {
+    if (mark->block == NULL) {
+        resetArena(memoryArena);
+        return;
+    }
+    memoryArena->bytesRecycled += memoryArena->bytesInUse - mark->bytesInUse;
+    memoryArena->bytesInUse = mark->bytesInUse;
+    memoryArena->currentBlock = mark->block;
+    mark->block->used = mark->used;
+}
+
+
+
+/*
+Prints the command arena's debug counters.
+*/
+void printArenaStats() {
+    printf("Arena: %d blocks, %zu bytes in use, high-water mark %zu bytes, %lld bytes recycled over %lld resets\n", \
+            commandArena.blockCount, commandArena.bytesInUse, commandArena.highWaterMark, \
+            commandArena.bytesRecycled, commandArena.resetCount);
+    fflush(stdout);
+}
@@ -0,0 +1,639 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "smallsh.h"
+
+// Largest chunk handed to copy_file_range or sendfile at once.
+#define CAT_CHUNK_SIZE (1 << 30)
+
+
+
+/*
+Prints one character escape from echo -e or printf, like \n or \t.
+Takes input of the text just after the backslash.
+Returns the number of characters used after the backslash, or -1 for \c (stop all output).
+*/
+int printEscape(char* text) {
+    switch(text[0]) {
+        case 'n':
+            putchar('\n');
+            return 1;
+        case 't':
+            putchar('\t');
+            return 1;
+        case 'r':
+            putchar('\r');
+            return 1;
+        case 'a':
+            putchar('\a');
+            return 1;
+        case 'b':
+            putchar('\b');
+            return 1;
+        case 'f':
+            putchar('\f');
+            return 1;
+        case 'v':
+            putchar('\v');
+            return 1;
+        case '\\':
+            putchar('\\');
+            return 1;
+        case 'c':
+            return -1;
+        case '0': {
+            int value = 0;
+            int used = 1;
+            while ((used < 4) && (text[used] >= '0') && (text[used] <= '7')) {
+                value = value * 8 + (text[used] - '0');
+                used++;
+            }
+            putchar(value);
+            return used;
+        }
+    }
+    putchar('\\');
+    return 0;
+}
+
+
+
+/*
+Runs 'echo'. -n leaves off the newline, and -e turns on backslash escapes.
+Returns the exit status.
+*/
+int echoBuiltin(struct commandStructure* command) {
+    int printNewline = 1;
+    int escapes = 0;
+    int i = 1;
+
+    while ((i < command->argumentCounter) && (command->arguments[i][0] == '-') && (command->arguments[i][1] != '\0') \
+            && (strspn(&command->arguments[i][1], "neE") == strlen(&command->arguments[i][1]))) {
+        char* option = &command->arguments[i][1];
+        for (option; *option != '\0'; option++) {
+            if (*option == 'n') {
+                printNewline = 0;
+            }
+            else {
+                escapes = (*option == 'e');
+            }
+        }
+        i++;
+    }
+
+    for (i; i < command->argumentCounter; i++) {
+        char* text = command->arguments[i];
+        if (escapes == 0) {
+            fputs(text, stdout);
+        }
+        else {
+            while (*text != '\0') {
+                if (*text == '\\') {
+                    int used = printEscape(text + 1);
+                    if (used == -1) {
+                        return 0;
+                    }
+                    text += used + 1;
+                }
+                else {
+                    putchar(*text);
+                    text++;
+                }
+            }
+        }
+        if (i + 1 < command->argumentCounter) {
+            putchar(' ');
+        }
+    }
+
+    if (printNewline == 1) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+
+
+/*
+Runs 'printf format [arguments...]'.
+Supports the %s %b %c %d %i %u %o %x %X %e %f %g and %% conversions with flags, width and precision,
+and backslash escapes in the format. The format is reused until every argument is printed.
+Returns the exit status, 1 if a numeric argument was not a number.
+*/
+int printfBuiltin(struct commandStructure* command) {
+    int argumentIndex = 2;
+    int exitStatus = 0;
+
+    if (command->argumentCounter < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    do {
+        char* format = command->arguments[1];
+        int conversionsUsed = 0;
+
+        while (*format != '\0') {
+            if (*format == '\\') {
+                int used = printEscape(format + 1);
+                if (used == -1) {
+                    return exitStatus;
+                }
+                format += used + 1;
+                continue;
+            }
+            if (*format != '%') {
+                putchar(*format);
+                format++;
+                continue;
+            }
+            if (format[1] == '%') {
+                putchar('%');
+                format += 2;
+                continue;
+            }
+
+            // Copy the conversion spec, leaving room for an 'll' length modifier.
+            char spec[64];
+            size_t specLength = strspn(format + 1, "-+ #0123456789.") + 1;
+            char conversion = format[specLength];
+            if ((conversion == '\0') || (specLength > sizeof(spec) - 4)) {
+                fputs(format, stdout);
+                break;
+            }
+            memcpy(spec, format, specLength);
+            spec[specLength] = '\0';
+            format += specLength + 1;
+
+            char* argument = (argumentIndex < command->argumentCounter) ? command->arguments[argumentIndex] : NULL;
+            if (argument != NULL) {
+                argumentIndex++;
+            }
+            conversionsUsed++;
+
+            if ((conversion == 's') || (conversion == 'b')) {
+                strcat(spec, "s");
+                if ((conversion == 'b') && (argument != NULL)) {
+                    char* text = argument;
+                    while (*text != '\0') {
+                        if (*text == '\\') {
+                            int used = printEscape(text + 1);
+                            if (used == -1) {
+                                return exitStatus;
+                            }
+                            text += used + 1;
+                        }
+                        else {
+                            putchar(*text);
+                            text++;
+                        }
+                    }
+                }
+                else {
+                    printf(spec, (argument != NULL) ? argument : "");
+                }
+            }
+            else if (conversion == 'c') {
+                strcat(spec, "c");
+                printf(spec, ((argument != NULL) && (argument[0] != '\0')) ? argument[0] : '\0');
+            }
+            else if (strchr("diouxX", conversion) != NULL) {
+                char* end = "";
+                long long value = 0;
+                if (argument != NULL) {
+                    errno = 0;
+                    value = strtoll(argument, &end, 0);
+                    if ((end == argument) || (*end != '\0') || (errno != 0)) {
+                        fprintf(stderr, "printf: %s: invalid number\n", argument);
+                        exitStatus = 1;
+                    }
+                }
+                size_t specEnd = strlen(spec);
+                spec[specEnd] = 'l';
+                spec[specEnd + 1] = 'l';
+                spec[specEnd + 2] = conversion;
+                spec[specEnd + 3] = '\0';
+                printf(spec, value);
+            }
+            else if (strchr("eEfgG", conversion) != NULL) {
+                double value = (argument != NULL) ? strtod(argument, NULL) : 0.0;
+                size_t specEnd = strlen(spec);
+                spec[specEnd] = conversion;
+                spec[specEnd + 1] = '\0';
+                printf(spec, value);
+            }
+            else {
+                fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+                return 1;
+            }
+        }
+
+        // A format without conversions is printed once, whatever the arguments.
+        if (conversionsUsed == 0) {
+            break;
+        }
+    } while (argumentIndex < command->argumentCounter);
+
+    return exitStatus;
+}
+
+
+
+/*
+Runs 'pwd'. Returns the exit status.
+*/
+int pwdBuiltin() {
+    char directory[4096];
+
+    if (getcwd(directory, sizeof(directory)) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    printf("%s\n", directory);
+    return 0;
+}
+
+
+
+/*
+Evaluates a unary file or string test like '-f name' or '-n text'.
+Returns 1 if true, 0 if false, or -1 if the operator is unknown.
+*/
+int unaryTest(char* operator, char* operand) {
+    struct stat fileInfo;
+
+    if (strcmp(operator, "-n") == 0) {
+        return (operand[0] != '\0');
+    }
+    if (strcmp(operator, "-z") == 0) {
+        return (operand[0] == '\0');
+    }
+    if ((strcmp(operator, "-L") == 0) || (strcmp(operator, "-h") == 0)) {
+        return ((lstat(operand, &fileInfo) == 0) && S_ISLNK(fileInfo.st_mode));
+    }
+    if (strcmp(operator, "-r") == 0) {
+        return (access(operand, R_OK) == 0);
+    }
+    if (strcmp(operator, "-w") == 0) {
+        return (access(operand, W_OK) == 0);
+    }
+    if (strcmp(operator, "-x") == 0) {
+        return (access(operand, X_OK) == 0);
+    }
+    if ((operator[0] != '-') || (operator[1] == '\0') || (operator[2] != '\0') || (strchr("efdsp", operator[1]) == NULL)) {
+        return -1;
+    }
+
+    if (stat(operand, &fileInfo) != 0) {
+        return 0;
+    }
+    switch(operator[1]) {
+        case 'e':
+            return 1;
+        case 'f':
+            return S_ISREG(fileInfo.st_mode);
+        case 'd':
+            return S_ISDIR(fileInfo.st_mode);
+        case 's':
+            return (fileInfo.st_size > 0);
+        case 'p':
+            return S_ISFIFO(fileInfo.st_mode);
+    }
+    return -1;
+}
+
+
+
+/*
+Evaluates a binary test like 'a = b' or '1 -lt 2'.
+Returns 1 if true, 0 if false, or -1 if the operator is unknown or an operand is not a number.
+*/
+int binaryTest(char* left, char* operator, char* right) {
+    if (strcmp(operator, "=") == 0) {
+        return (strcmp(left, right) == 0);
+    }
+    if (strcmp(operator, "!=") == 0) {
+        return (strcmp(left, right) != 0);
+    }
+
+    char* leftEnd;
+    char* rightEnd;
+    long long leftValue = strtoll(left, &leftEnd, 10);
+    long long rightValue = strtoll(right, &rightEnd, 10);
+    if ((leftEnd == left) || (*leftEnd != '\0') || (rightEnd == right) || (*rightEnd != '\0')) {
+        return -1;
+    }
+
+    if (strcmp(operator, "-eq") == 0) {
+        return (leftValue == rightValue);
+    }
+    if (strcmp(operator, "-ne") == 0) {
+        return (leftValue != rightValue);
+    }
+    if (strcmp(operator, "-lt") == 0) {
+        return (leftValue < rightValue);
+    }
+    if (strcmp(operator, "-le") == 0) {
+        return (leftValue <= rightValue);
+    }
+    if (strcmp(operator, "-gt") == 0) {
+        return (leftValue > rightValue);
+    }
+    if (strcmp(operator, "-ge") == 0) {
+        return (leftValue >= rightValue);
+    }
+    return -1;
+}
+
+
+
+/*
+Evaluates 'test' arguments by how many there are, as POSIX describes for up to four.
+Returns 1 if true, 0 if false, or -1 for a bad expression.
+*/
+int evaluateTest(char** arguments, int argumentCount) {
+    switch(argumentCount) {
+        case 0:
+            return 0;
+        case 1:
+            return (arguments[0][0] != '\0');
+        case 2:
+            if (strcmp(arguments[0], "!") == 0) {
+                return (arguments[1][0] == '\0');
+            }
+            return unaryTest(arguments[0], arguments[1]);
+        case 3: {
+            int result = binaryTest(arguments[0], arguments[1], arguments[2]);
+            if ((result == -1) && (strcmp(arguments[0], "!") == 0)) {
+                result = evaluateTest(&arguments[1], 2);
+                return (result == -1) ? -1 : !result;
+            }
+            return result;
+        }
+        case 4:
+            if (strcmp(arguments[0], "!") == 0) {
+                int result = evaluateTest(&arguments[1], 3);
+                return (result == -1) ? -1 : !result;
+            }
+            return -1;
+    }
+    return -1;
+}
+
+
+
+/*
+Runs 'test' or '['. '[' needs a closing ']'.
+Returns the exit status: 0 for true, 1 for false, 2 for a bad expression.
+*/
+int testBuiltin(struct commandStructure* command) {
+    int argumentCount = command->argumentCounter - 1;
+
+    if (strcmp(command->command, "[") == 0) {
+        if ((argumentCount == 0) || (strcmp(command->arguments[argumentCount], "]") != 0)) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        argumentCount--;
+    }
+
+    int result = evaluateTest(&command->arguments[1], argumentCount);
+    if (result == -1) {
+        fprintf(stderr, "%s: bad expression\n", command->command);
+        return 2;
+    }
+    return (result == 1) ? 0 : 1;
+}
+
+
+
+/*
+Copies everything from one fd to another for 'cat'.
+Tries copy_file_range first (file to file, may share extents), then sendfile (file to anything),
+and falls back to read and write for pipes and terminals.
+Returns 0, or -1 on a read or write error.
+*/
+int copyFileDescriptor(int inputFd, int outputFd) {
+    int useCopyRange = 1;
+    int useSendfile = 1;
+    ssize_t copied;
+
+    while (useCopyRange == 1) {
+        copied = copy_file_range(inputFd, NULL, outputFd, NULL, CAT_CHUNK_SIZE, 0);
+        if (copied == 0) {
+            return 0;
+        }
+        if (copied == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            useCopyRange = 0;
+        }
+        // Each call moves the fd offsets, so a method tried next carries on where this one stopped.
+    }
+
+    while (useSendfile == 1) {
+        copied = sendfile(outputFd, inputFd, NULL, CAT_CHUNK_SIZE);
+        if (copied == 0) {
+            return 0;
+        }
+        if (copied == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EINVAL) && (errno != ENOSYS)) {
+                return -1;
+            }
+            useSendfile = 0;
+        }
+    }
+
+    char copyBuffer[65536];
+    while (1) {
+        ssize_t bytesRead = read(inputFd, copyBuffer, sizeof(copyBuffer));
+        if (bytesRead == 0) {
+            return 0;
+        }
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        ssize_t bytesWritten = 0;
+        while (bytesWritten < bytesRead) {
+            ssize_t writeResult = write(outputFd, &copyBuffer[bytesWritten], bytesRead - bytesWritten);
+            if (writeResult == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            bytesWritten += writeResult;
+        }
+    }
+}
+
+
+
+/*
+Runs 'cat [file...]'. With no files, or '-', copies stdin.
+Returns the exit status, 1 if any file could not be read.
+*/
+int catBuiltin(struct commandStructure* command) {
+    int exitStatus = 0;
+    int i = 1;
+
+    if (command->argumentCounter == 1) {
+        return (copyFileDescriptor(0, 1) == 0) ? 0 : 1;
+    }
+
+    for (i; i < command->argumentCounter; i++) {
+        if (strcmp(command->arguments[i], "-") == 0) {
+            if (copyFileDescriptor(0, 1) != 0) {
+                exitStatus = 1;
+            }
+            continue;
+        }
+
+        int inputFd = open(command->arguments[i], O_RDONLY | O_CLOEXEC);
+        if (inputFd == -1) {
+            fprintf(stderr, "cat: %s: %s\n", command->arguments[i], strerror(errno));
+            exitStatus = 1;
+            continue;
+        }
+        if (copyFileDescriptor(inputFd, 1) != 0) {
+            fprintf(stderr, "cat: %s: %s\n", command->arguments[i], strerror(errno));
+            exitStatus = 1;
+        }
+        close(inputFd);
+    }
+    return exitStatus;
+}
+
+
+
+/*
+Returns 1 if a command name is one of the in-process builtins.
+*/
+int isFastBuiltin(char* commandName) {
+    char* builtinNames[] = {"echo", "printf", "pwd", "true", "false", "test", "[", "cat", "env", NULL};
+    int i = 0;
+
+    for (i; builtinNames[i] != NULL; i++) {
+        if (strcmp(commandName, builtinNames[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Returns 1 if the in-process version of a builtin handles these arguments the same way the program would.
+Anything else is left to the program: 'pwd' with options, a 'test' or '[' expression with an operator
+evaluateTest does not know, and 'cat' unless every argument is an existing regular file not starting with '-'.
+'cat' with no files or '-' reads stdin, which would block the shell where Ctrl-C cannot reach it.
+*/
+int fastBuiltinApplies(struct commandStructure* command) {
+    struct stat fileInfo;
+    int argumentCount = command->argumentCounter - 1;
+    int i = 1;
+
+    if (strcmp(command->command, "pwd") == 0) {
+        return (argumentCount == 0);
+    }
+    if ((strcmp(command->command, "test") == 0) || (strcmp(command->command, "[") == 0)) {
+        // A '[' without its ']' is reported by testBuiltin.
+        if ((command->command[0] == '[') && ((argumentCount == 0) || (strcmp(command->arguments[argumentCount], "]") != 0))) {
+            return 1;
+        }
+        if (command->command[0] == '[') {
+            argumentCount--;
+        }
+        return (evaluateTest(&command->arguments[1], argumentCount) != -1);
+    }
+    if (strcmp(command->command, "cat") == 0) {
+        if (argumentCount == 0) {
+            return 0;
+        }
+        for (i; i < command->argumentCounter; i++) {
+            if ((command->arguments[i][0] == '-') || (stat(command->arguments[i], &fileInfo) != 0) \
+                    || !S_ISREG(fileInfo.st_mode)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+
+/*
+Runs echo, printf, pwd, true, false, test, [, cat and env inside the shell, without spawning a child.
+Only single-stage foreground commands are run this way. Pipelines and background commands still spawn,
+so they behave exactly as before, and so are arguments the builtin does not handle (see fastBuiltinApplies).
+A command with NAME=value words in front spawns too, so the variables are in its environment.
+'env' is only run here with no arguments, when it just prints the environment.
+Redirections are opened by openRedirects, the same as for a child, and dup'ed over stdin, stdout and stderr
+in the shell while the builtin runs. The shell's own fds are put back afterwards.
+Sets lastExitStatus, and applies 'set -e' like a foreground child.
+Returns 1 if the command was run here, 0 if it should be spawned.
+Input: commandStructure
+*/
+int runFastBuiltin(struct commandStructure* command) {
+    struct redirectFds redirects;
+    int savedFds[3];
+    int exitStatus = 0;
+
+    if ((command->pipelineStages != 1) || ((backgroundProcessAllowed == 1) && (command->backgroundProcess == 1)) \
+            || (command->assignmentCount > 0) || (isFastBuiltin(command->command) == 0) || (fastBuiltinApplies(command) == 0)) {
+        return 0;
+    }
+    if ((strcmp(command->command, "env") == 0) && (command->argumentCounter > 1)) {
+        return 0;
+    }
+
+    if (openRedirects(command, -1, -1, 0, &redirects) == -1) {
+        lastExitStatus = 1;
+        return 1;
+    }
+    applyRedirects(&redirects, savedFds);
+
+    if (strcmp(command->command, "echo") == 0) {
+        exitStatus = echoBuiltin(command);
+    }
+    else if (strcmp(command->command, "printf") == 0) {
+        exitStatus = printfBuiltin(command);
+    }
+    else if (strcmp(command->command, "pwd") == 0) {
+        exitStatus = pwdBuiltin();
+    }
+    else if (strcmp(command->command, "false") == 0) {
+        exitStatus = 1;
+    }
+    else if ((strcmp(command->command, "test") == 0) || (strcmp(command->command, "[") == 0)) {
+        exitStatus = testBuiltin(command);
+    }
+    else if (strcmp(command->command, "cat") == 0) {
+        exitStatus = catBuiltin(command);
+    }
+    else if (strcmp(command->command, "env") == 0) {
+        exitStatus = printEnvironment();
+    }
+
+    restoreRedirects(savedFds);
+    closeRedirects(&redirects);
+
+    lastExitStatus = exitStatus;
+    if ((exitOnFailure == 1) && (lastExitStatus != 0)) {
+        exitShell(lastExitStatus);
+    }
+    return 1;
+}
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "smallsh.h"
+
+// Changes in a PATH directory that can add or remove a command.
+#define COMMAND_WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE \
+        | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+Structure for the matches of one completion, each a name of its own.
+*/
+struct completionList {
+    char** names;
+    int count;
+    int capacity;
+};
+
+/*
+Command index globals.
+Every command name that can be completed: the shell's own commands, and each executable file in a PATH
+directory. The names are kept sorted, so the names with a prefix are one run found by binary search.
+The index is built the first time a command is completed. After that, inotify reports each file created,
+removed, renamed or chmodded in a PATH directory, and only that name is checked again. The events wait in
+the inotify queue until the next completion reads them, so a busy PATH directory never wakes the shell.
+*/
+char** commandNames = NULL;
+int commandNameCount = 0;
+int commandNameCapacity = 0;
+// Copy of PATH when the index was built, split into its directories. A different PATH rebuilds the index.
+char* commandIndexPATH = NULL;
+char** commandDirectories = NULL;
+int commandDirectoryCount = 0;
+int commandInotifyFd = -1;
+
+// Commands the shell runs itself, which are not in PATH, or may not be.
+char* shellCommandNames[] = {"arenastats", "bg", "bgpolicy", "bgtimeout", "cat", "cd", "echo", "env", "exit", "export", "false", "fg", \
+        "hash", "history", "jobs", "parallel", "pipesize", "printf", "pwd", "run", "set", "spawnengine", "stats", \
+        "status", "test", "time", "timeout", "trace", "true", "unset", "wait", NULL};
+
+
+
+/*
+Compares two names for qsort.
+*/
+int compareCommandNames(const void* first, const void* second) {
+    return strcmp(*(char**)first, *(char**)second);
+}
+
+
+
+/*
+Returns the position of the first name in the index that is not less than the first nameLength bytes of name.
+*/
+int findCommandName(char* name, size_t nameLength) {
+    int low = 0;
+    int high = commandNameCount;
+
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (strncmp(commandNames[middle], name, nameLength) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+
+
+/*
+Returns 1 if name is one of the shell's own commands, or an executable file in one of the PATH directories.
+*/
+int commandNameExists(char* name) {
+    char filePath[4096];
+    struct stat fileStatus;
+    int i = 0;
+
+    for (i; shellCommandNames[i] != NULL; i++) {
+        if (strcmp(shellCommandNames[i], name) == 0) {
+            return 1;
+        }
+    }
+    for (i = 0; i < commandDirectoryCount; i++) {
+        snprintf(filePath, sizeof(filePath), "%s/%s", commandDirectories[i], name);
+        if ((stat(filePath, &fileStatus) == 0) && S_ISREG(fileStatus.st_mode) && ((fileStatus.st_mode & 0111) != 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Checks one name again after inotify reported a change to it, and adds it to the index or removes it.
+*/
+void refreshCommandName(char* name) {
+    size_t nameLength = strlen(name);
+    int position = findCommandName(name, nameLength + 1);
+    int listed = ((position < commandNameCount) && (strcmp(commandNames[position], name) == 0));
+    int exists = commandNameExists(name);
+
+    if ((exists == 1) && (listed == 0)) {
+        if (commandNameCount == commandNameCapacity) {
+            commandNameCapacity = (commandNameCapacity == 0) ? 1024 : commandNameCapacity * 2;
+            commandNames = realloc(commandNames, commandNameCapacity * sizeof(char*));
+        }
+        memmove(&commandNames[position + 1], &commandNames[position], (commandNameCount - position) * sizeof(char*));
+        commandNames[position] = strdup(name);
+        commandNameCount++;
+    }
+    else if ((exists == 0) && (listed == 1)) {
+        free(commandNames[position]);
+        memmove(&commandNames[position], &commandNames[position + 1], (commandNameCount - position - 1) * sizeof(char*));
+        commandNameCount--;
+    }
+}
+
+
+
+/*
+Adds a name to the end of the index while it is being built. buildCommandIndex sorts it afterwards.
+*/
+void appendCommandName(char* name) {
+    if (commandNameCount == commandNameCapacity) {
+        commandNameCapacity = (commandNameCapacity == 0) ? 1024 : commandNameCapacity * 2;
+        commandNames = realloc(commandNames, commandNameCapacity * sizeof(char*));
+    }
+    commandNames[commandNameCount] = strdup(name);
+    commandNameCount++;
+}
+
+
+
+/*
+Builds the command index from scratch for the current PATH, and starts watching each PATH directory.
+*/
+void buildCommandIndex(char* currentPATH) {
+    int i = 0;
+
+    for (i; i < commandNameCount; i++) {
+        free(commandNames[i]);
+    }
+    for (i = 0; i < commandDirectoryCount; i++) {
+        free(commandDirectories[i]);
+    }
+    commandNameCount = 0;
+    commandDirectoryCount = 0;
+    free(commandIndexPATH);
+    commandIndexPATH = strdup(currentPATH);
+
+    // A new inotify fd drops every old watch at once.
+    if (commandInotifyFd != -1) {
+        close(commandInotifyFd);
+    }
+    commandInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    for (i = 0; shellCommandNames[i] != NULL; i++) {
+        appendCommandName(shellCommandNames[i]);
+    }
+
+    char* pathCopy = strdup(currentPATH);
+    char* savePointer;
+    char* directoryName = strtok_r(pathCopy, ":", &savePointer);
+    while (directoryName != NULL) {
+        commandDirectories = realloc(commandDirectories, (commandDirectoryCount + 1) * sizeof(char*));
+        commandDirectories[commandDirectoryCount] = strdup(directoryName);
+        inotify_add_watch(commandInotifyFd, directoryName, COMMAND_WATCH_EVENTS);
+        commandDirectoryCount++;
+
+        // The watch is added before the directory is read, so nothing added in between is missed.
+        DIR* directory = opendir(directoryName);
+        if (directory != NULL) {
+            int directoryFd = dirfd(directory);
+            struct dirent* entry;
+            while ((entry = readdir(directory)) != NULL) {
+                struct stat fileStatus;
+                if ((entry->d_name[0] == '.') || (entry->d_type == DT_DIR)) {
+                    continue;
+                }
+                if ((fstatat(directoryFd, entry->d_name, &fileStatus, 0) == 0) && S_ISREG(fileStatus.st_mode) \
+                        && ((fileStatus.st_mode & 0111) != 0)) {
+                    appendCommandName(entry->d_name);
+                }
+            }
+            closedir(directory);
+        }
+        directoryName = strtok_r(NULL, ":", &savePointer);
+    }
+    free(pathCopy);
+
+    // Sort, and drop names found in more than one place.
+    qsort(commandNames, commandNameCount, sizeof(char*), compareCommandNames);
+    int kept = 0;
+    for (i = 0; i < commandNameCount; i++) {
+        if ((kept > 0) && (strcmp(commandNames[kept - 1], commandNames[i]) == 0)) {
+            free(commandNames[i]);
+            continue;
+        }
+        commandNames[kept] = commandNames[i];
+        kept++;
+    }
+    commandNameCount = kept;
+}
+
+
+
+/*
+Brings the command index up to date before it is used. Builds it the first time, and again if PATH has changed.
+Otherwise reads the inotify events queued since the last call, and checks again only the names they mention.
+A directory that was removed or renamed, or a queue that overflowed, rebuilds the index.
+*/
+void updateCommandIndex() {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char* currentPATH = getVariable("PATH");
+    ssize_t bytesRead;
+
+    if (currentPATH == NULL) {
+        currentPATH = "";
+    }
+    if ((commandIndexPATH == NULL) || (strcmp(commandIndexPATH, currentPATH) != 0)) {
+        buildCommandIndex(currentPATH);
+        return;
+    }
+
+    while ((bytesRead = read(commandInotifyFd, events, sizeof(events))) > 0) {
+        char* position = events;
+        while (position < events + bytesRead) {
+            struct inotify_event* event = (struct inotify_event*)position;
+            if ((event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+                buildCommandIndex(currentPATH);
+                return;
+            }
+            if ((event->len > 0) && (event->name[0] != '\0')) {
+                refreshCommandName(event->name);
+            }
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+
+
+/*
+Adds one match to a completion list.
+*/
+void addCompletion(struct completionList* list, char* name, int isDirectory) {
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        list->names = realloc(list->names, list->capacity * sizeof(char*));
+    }
+    list->names[list->count] = malloc(strlen(name) + 2);
+    sprintf(list->names[list->count], "%s%s", name, (isDirectory == 1) ? "/" : "");
+    list->count++;
+}
+
+
+
+/*
+Empties a completion list, freeing the names in it.
+*/
+void clearCompletions(struct completionList* list) {
+    int i = 0;
+    for (i; i < list->count; i++) {
+        free(list->names[i]);
+    }
+    list->count = 0;
+}
+
+
+
+/*
+Finds the completions of a word. The first word of a command is completed from the command index, unless
+it has a '/'. Any other word is completed as a file name, relative to its directory part if it has one.
+Directories end in '/'. Names starting with '.' only match a word that does too.
+Takes input of the word, its length, and whether it is in command position.
+Returns the number of completions, which are added to list. The part to insert is each name past prefixLength.
+*/
+int completeWord(char* word, size_t wordLength, int commandPosition, struct completionList* list, size_t* prefixLength) {
+    clearCompletions(list);
+
+    if ((commandPosition == 1) && (memchr(word, '/', wordLength) == NULL)) {
+        updateCommandIndex();
+        int position = findCommandName(word, wordLength);
+        for (position; (position < commandNameCount) && (strncmp(commandNames[position], word, wordLength) == 0); position++) {
+            addCompletion(list, commandNames[position], 0);
+        }
+        *prefixLength = wordLength;
+        return list->count;
+    }
+
+    // Split the word into the directory to read and the start of the name in it.
+    char directoryName[4096];
+    char* lastSlash = memrchr(word, '/', wordLength);
+    char* baseName = (lastSlash != NULL) ? lastSlash + 1 : word;
+    size_t baseLength = wordLength - (baseName - word);
+    if (lastSlash == NULL) {
+        strcpy(directoryName, ".");
+    }
+    else if ((word[0] == '~') && (word + 1 == lastSlash) && (getVariable("HOME") != NULL)) {
+        snprintf(directoryName, sizeof(directoryName), "%s/", getVariable("HOME"));
+    }
+    else {
+        snprintf(directoryName, sizeof(directoryName), "%.*s", (int)(baseName - word), word);
+    }
+
+    DIR* directory = opendir(directoryName);
+    if (directory != NULL) {
+        int directoryFd = dirfd(directory);
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL) {
+            if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0) \
+                    || ((entry->d_name[0] == '.') && (baseName[0] != '.')) || (strncmp(entry->d_name, baseName, baseLength) != 0)) {
+                continue;
+            }
+            int isDirectory = (entry->d_type == DT_DIR);
+            if ((entry->d_type == DT_LNK) || (entry->d_type == DT_UNKNOWN)) {
+                struct stat fileStatus;
+                isDirectory = ((fstatat(directoryFd, entry->d_name, &fileStatus, 0) == 0) && S_ISDIR(fileStatus.st_mode));
+            }
+            addCompletion(list, entry->d_name, isDirectory);
+        }
+        closedir(directory);
+    }
+    qsort(list->names, list->count, sizeof(char*), compareCommandNames);
+    *prefixLength = baseLength;
+    return list->count;
+}
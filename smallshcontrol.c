@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include "smallsh.h"
+
+/*
+Node types of a compiled command line.
+*/
+// One command or pipeline, as text, with its parsed form when it has nothing to expand.
+#define CONTROL_COMMAND 0
+// Commands separated by ';', '&' or newlines, chained through next.
+#define CONTROL_LIST 1
+#define CONTROL_AND 2
+#define CONTROL_OR 3
+#define CONTROL_IF 4
+#define CONTROL_WHILE 5
+#define CONTROL_UNTIL 6
+#define CONTROL_FOR 7
+
+/*
+Separators found at the end of a command by scanControlCommand.
+*/
+#define SEPARATOR_END 0
+#define SEPARATOR_SEMICOLON 1
+#define SEPARATOR_NEWLINE 2
+#define SEPARATOR_BACKGROUND 3
+#define SEPARATOR_AND 4
+#define SEPARATOR_OR 5
+
+/*
+Values of controlJump, set by 'break' and 'continue'.
+*/
+#define JUMP_NONE 0
+#define JUMP_BREAK 1
+#define JUMP_CONTINUE 2
+
+/*
+Structure for one node of a compiled command line. The tree and the text in it live in commandArena
+with the line, and are built once however many times a loop runs them.
+CONTROL_COMMAND     text, parsed if text has no '$', background.
+CONTROL_LIST        body, the first of the nodes chained through next.
+CONTROL_AND, _OR    condition, then body if condition succeeded (AND) or failed (OR).
+CONTROL_IF          condition, body, and elseBody, which is another CONTROL_IF for 'elif'.
+CONTROL_WHILE, _UNTIL  condition, body.
+CONTROL_FOR         variableName, wordsText, body.
+*/
+struct controlNode {
+    int type;
+    char* text;
+    struct commandStructure* parsed;
+    int background;
+    struct controlNode* condition;
+    struct controlNode* body;
+    struct controlNode* elseBody;
+    struct controlNode* next;
+    char* variableName;
+    char* wordsText;
+};
+
+/*
+Structure for compiling one command line, which may be several lines joined together.
+*/
+struct controlParser {
+    char* text;
+    size_t position;
+    // Set when the text ends before something it started, like an 'if' without its 'fi'.
+    int incomplete;
+    int error;
+};
+
+/*
+Control flow globals.
+*/
+// Set by otherCommand when a foreground command is killed by SIGINT. Stops the rest of the line, like Ctrl-C should.
+int foregroundInterrupted = 0;
+int controlJump = JUMP_NONE;
+// Loops running, so 'break' and 'continue' know whether they mean anything.
+int loopDepth = 0;
+
+char* controlKeywords[] = {"if", "then", "elif", "else", "fi", "for", "while", "until", "do", "done", NULL};
+
+
+
+/*
+Moves past blanks, and past newlines and ';' too if skipSeparators is 1.
+*/
+void skipControlBlanks(struct controlParser* parser, int skipSeparators) {
+    char* text = parser->text;
+
+    while ((text[parser->position] == ' ') || (text[parser->position] == '\t') \
+            || ((skipSeparators == 1) && ((text[parser->position] == '\n') || (text[parser->position] == ';')))) {
+        parser->position++;
+    }
+    // A comment runs to the end of its line.
+    if (text[parser->position] == '#') {
+        while ((text[parser->position] != '\0') && (text[parser->position] != '\n')) {
+            parser->position++;
+        }
+        if (skipSeparators == 1) {
+            skipControlBlanks(parser, 1);
+        }
+    }
+}
+
+
+
+/*
+Returns 1 if the text at the parser's position is the word keyword on its own, 0 otherwise.
+*/
+int atControlKeyword(struct controlParser* parser, char* keyword) {
+    size_t keywordLength = strlen(keyword);
+    char* text = &parser->text[parser->position];
+
+    return ((strncmp(text, keyword, keywordLength) == 0) && (strchr(" \t\n;&|", text[keywordLength]) != NULL));
+}
+
+
+
+/*
+Returns 1 if the parser is at any reserved word, 0 otherwise.
+*/
+int atAnyControlKeyword(struct controlParser* parser) {
+    int i = 0;
+
+    for (i; controlKeywords[i] != NULL; i++) {
+        if (atControlKeyword(parser, controlKeywords[i]) == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Reports a syntax error at the parser's position, once. If the text simply ended, the line is incomplete instead,
+and nothing is printed, so that 'main' can read more of it.
+*/
+void controlSyntaxError(struct controlParser* parser) {
+    char* text = &parser->text[parser->position];
+    size_t wordLength = 0;
+
+    if (parser->error == 1) {
+        return;
+    }
+    parser->error = 1;
+    if (text[0] == '\0') {
+        parser->incomplete = 1;
+        return;
+    }
+    while ((text[wordLength] != '\0') && (strchr(" \t\n", text[wordLength]) == NULL)) {
+        wordLength++;
+    }
+    printf("Invalid syntax near '%.*s'. Please try again.\n", (int)wordLength, text);
+    fflush(stdout);
+}
+
+
+
+/*
+Reads past keyword, or reports a syntax error if it is not there.
+*/
+void expectControlKeyword(struct controlParser* parser, char* keyword) {
+    skipControlBlanks(parser, 1);
+    if ((parser->error == 0) && (atControlKeyword(parser, keyword) == 1)) {
+        parser->position += strlen(keyword);
+    }
+    else {
+        controlSyntaxError(parser);
+    }
+}
+
+
+
+/*
+Finds the end of one command or pipeline, reading quotes the way nextToken does, so that ';', '&&', '||', '&'
+and newlines inside quotes, after a backslash or inside a '$(...)' do not count. '&' in '&>', '>&2' and '2>&1'
+is part of a redirection.
+Returns the length of the command, and sets separator to what ended it, or -1 for an unterminated quote or '$('.
+*/
+long scanControlCommand(char* text, int* separator) {
+    int quoteState = LEX_PLAIN;
+    int wordStart = 1;
+    long i = 0;
+
+    *separator = SEPARATOR_END;
+    for (i; text[i] != '\0'; i++) {
+        char character = text[i];
+        if (quoteState == LEX_SINGLE_QUOTE) {
+            quoteState = (character == '\'') ? LEX_PLAIN : quoteState;
+            continue;
+        }
+        if ((character == '$') && (text[i + 1] == '(')) {
+            i = findSubstitutionEnd(text, i + 1);
+            if (i == 0) {
+                return -1;
+            }
+            wordStart = 0;
+            continue;
+        }
+        if (quoteState == LEX_DOUBLE_QUOTE) {
+            if ((character == '\\') && (text[i + 1] != '\0')) {
+                i++;
+            }
+            else if (character == '"') {
+                quoteState = LEX_PLAIN;
+            }
+            continue;
+        }
+
+        if ((character == '#') && (wordStart == 1)) {
+            while ((text[i + 1] != '\0') && (text[i + 1] != '\n')) {
+                i++;
+            }
+            continue;
+        }
+        wordStart = (strchr(" \t|<>", character) != NULL);
+        if (character == '\'') {
+            quoteState = LEX_SINGLE_QUOTE;
+        }
+        else if (character == '"') {
+            quoteState = LEX_DOUBLE_QUOTE;
+        }
+        else if ((character == '\\') && (text[i + 1] != '\0')) {
+            i++;
+        }
+        else if ((character == '>') && (text[i + 1] == '&')) {
+            i++;
+        }
+        else if (character == ';') {
+            *separator = SEPARATOR_SEMICOLON;
+            return i;
+        }
+        else if (character == '\n') {
+            *separator = SEPARATOR_NEWLINE;
+            return i;
+        }
+        else if ((character == '&') && (text[i + 1] == '&')) {
+            *separator = SEPARATOR_AND;
+            return i;
+        }
+        else if ((character == '|') && (text[i + 1] == '|')) {
+            *separator = SEPARATOR_OR;
+            return i;
+        }
+        else if ((character == '&') && (text[i + 1] != '>')) {
+            *separator = SEPARATOR_BACKGROUND;
+            return i;
+        }
+    }
+    return (quoteState == LEX_PLAIN) ? i : -1;
+}
+
+
+
+/*
+Returns a new node of the given type.
+*/
+struct controlNode* newControlNode(int type) {
+    struct controlNode* node = arenaAllocate(&commandArena, sizeof(struct controlNode));
+    node->type = type;
+    return node;
+}
+
+
+
+struct controlNode* parseControlList(struct controlParser* parser);
+
+
+
+/*
+Compiles one command or pipeline up to the separator after it, which is left for the caller.
+A command with no '$' in it is parsed now, and runs from that parsed form every time.
+Others are kept as text, and expanded and split into words each time they run, since what they expand to can change.
+Returns the node, or NULL if there is no command here.
+*/
+struct controlNode* parseControlCommand(struct controlParser* parser) {
+    int separator;
+    long commandLength = scanControlCommand(&parser->text[parser->position], &separator);
+
+    if (commandLength == -1) {
+        printf("Invalid quoting. Please try again.\n");
+        fflush(stdout);
+        parser->error = 1;
+        return NULL;
+    }
+    if (commandLength == 0) {
+        return NULL;
+    }
+
+    struct controlNode* node = newControlNode(CONTROL_COMMAND);
+    node->text = arenaAllocate(&commandArena, commandLength + 4);
+    memcpy(node->text, &parser->text[parser->position], commandLength);
+    parser->position += commandLength;
+    if (separator == SEPARATOR_BACKGROUND) {
+        memcpy(&node->text[commandLength], " &", 2);
+        commandLength += 2;
+        node->background = 1;
+        parser->position++;
+    }
+    node->text[commandLength] = '\n';
+
+    if (strchr(node->text, '$') == NULL) {
+        char* parseText = arenaCopyString(&commandArena, node->text);
+        node->parsed = parseInputCommand(parseText);
+        if (node->parsed->parseError == 1) {
+            parser->error = 1;
+        }
+    }
+    return node;
+}
+
+
+
+/*
+Compiles 'if list then list [elif list then list]... [else list] fi', after the 'if' or 'elif'.
+*/
+struct controlNode* parseControlIf(struct controlParser* parser) {
+    struct controlNode* node = newControlNode(CONTROL_IF);
+
+    node->condition = parseControlList(parser);
+    expectControlKeyword(parser, "then");
+    node->body = parseControlList(parser);
+    skipControlBlanks(parser, 1);
+    if (atControlKeyword(parser, "elif") == 1) {
+        parser->position += 4;
+        node->elseBody = parseControlIf(parser);
+        return node;
+    }
+    if (atControlKeyword(parser, "else") == 1) {
+        parser->position += 4;
+        node->elseBody = parseControlList(parser);
+    }
+    expectControlKeyword(parser, "fi");
+    return node;
+}
+
+
+
+/*
+Compiles 'for name in words; do list done', after the 'for'.
+*/
+struct controlNode* parseControlFor(struct controlParser* parser) {
+    struct controlNode* node = newControlNode(CONTROL_FOR);
+    char* text = parser->text;
+    int separator;
+
+    skipControlBlanks(parser, 0);
+    size_t nameStart = parser->position;
+    while ((text[parser->position] == '_') || isalnum((unsigned char)text[parser->position])) {
+        parser->position++;
+    }
+    if ((parser->position == nameStart) || isdigit((unsigned char)text[nameStart])) {
+        controlSyntaxError(parser);
+        return node;
+    }
+    node->variableName = arenaAllocate(&commandArena, parser->position - nameStart + 1);
+    memcpy(node->variableName, &text[nameStart], parser->position - nameStart);
+
+    skipControlBlanks(parser, 0);
+    if (atControlKeyword(parser, "in") == 0) {
+        controlSyntaxError(parser);
+        return node;
+    }
+    parser->position += 2;
+    long wordsLength = scanControlCommand(&text[parser->position], &separator);
+    if ((wordsLength == -1) || ((separator != SEPARATOR_SEMICOLON) && (separator != SEPARATOR_NEWLINE))) {
+        if (wordsLength == -1) {
+            parser->position += strlen(&text[parser->position]);
+        }
+        else {
+            parser->position += (size_t)wordsLength;
+        }
+        controlSyntaxError(parser);
+        return node;
+    }
+    node->wordsText = arenaAllocate(&commandArena, wordsLength + 2);
+    memcpy(node->wordsText, &text[parser->position], wordsLength);
+    node->wordsText[wordsLength] = '\n';
+    parser->position += wordsLength + 1;
+
+    expectControlKeyword(parser, "do");
+    node->body = parseControlList(parser);
+    expectControlKeyword(parser, "done");
+    return node;
+}
+
+
+
+/*
+Compiles one command, or one 'if', 'for', 'while' or 'until' block. Compound commands cannot have
+redirections or '&' after them.
+Returns the node, or NULL if there is none here.
+*/
+struct controlNode* parseControlItem(struct controlParser* parser) {
+    struct controlNode* node;
+
+    skipControlBlanks(parser, 0);
+    if (atControlKeyword(parser, "if") == 1) {
+        parser->position += 2;
+        node = parseControlIf(parser);
+    }
+    else if ((atControlKeyword(parser, "while") == 1) || (atControlKeyword(parser, "until") == 1)) {
+        node = newControlNode((parser->text[parser->position] == 'w') ? CONTROL_WHILE : CONTROL_UNTIL);
+        parser->position += 5;
+        node->condition = parseControlList(parser);
+        expectControlKeyword(parser, "do");
+        node->body = parseControlList(parser);
+        expectControlKeyword(parser, "done");
+    }
+    else if (atControlKeyword(parser, "for") == 1) {
+        parser->position += 3;
+        node = parseControlFor(parser);
+    }
+    else if (atAnyControlKeyword(parser) == 1) {
+        controlSyntaxError(parser);
+        return NULL;
+    }
+    else {
+        return parseControlCommand(parser);
+    }
+
+    // Only a separator, '&&', '||' or a comment can follow the block.
+    skipControlBlanks(parser, 0);
+    char* next = &parser->text[parser->position];
+    if ((parser->error == 0) && (next[0] != '\0') && (next[0] != '\n') && (next[0] != ';') \
+            && (strncmp(next, "&&", 2) != 0) && (strncmp(next, "||", 2) != 0)) {
+        controlSyntaxError(parser);
+    }
+    return node;
+}
+
+
+
+/*
+Compiles commands joined by '&&' and '||', which group from the left.
+*/
+struct controlNode* parseControlAndOr(struct controlParser* parser) {
+    struct controlNode* node = parseControlItem(parser);
+
+    while ((node != NULL) && (parser->error == 0)) {
+        char* text = &parser->text[parser->position];
+        int type;
+        if ((text[0] == '&') && (text[1] == '&')) {
+            type = CONTROL_AND;
+        }
+        else if ((text[0] == '|') && (text[1] == '|')) {
+            type = CONTROL_OR;
+        }
+        else {
+            break;
+        }
+        parser->position += 2;
+
+        // The command after '&&' or '||' may be on the next line.
+        skipControlBlanks(parser, 0);
+        while (parser->text[parser->position] == '\n') {
+            parser->position++;
+            skipControlBlanks(parser, 0);
+        }
+        struct controlNode* joined = newControlNode(type);
+        joined->condition = node;
+        joined->body = parseControlItem(parser);
+        if (joined->body == NULL) {
+            controlSyntaxError(parser);
+        }
+        node = joined;
+    }
+    return node;
+}
+
+
+
+/*
+Compiles commands separated by ';', '&' and newlines, up to a reserved word that ends the list
+(then, elif, else, fi, do, done) or the end of the text.
+Returns a CONTROL_LIST node, or NULL if there are no commands.
+*/
+struct controlNode* parseControlList(struct controlParser* parser) {
+    struct controlNode* list = NULL;
+    struct controlNode* last = NULL;
+
+    while (parser->error == 0) {
+        skipControlBlanks(parser, 1);
+        if ((parser->text[parser->position] == '\0') || (atControlKeyword(parser, "then") == 1) \
+                || (atControlKeyword(parser, "elif") == 1) || (atControlKeyword(parser, "else") == 1) \
+                || (atControlKeyword(parser, "fi") == 1) || (atControlKeyword(parser, "do") == 1) \
+                || (atControlKeyword(parser, "done") == 1)) {
+            break;
+        }
+
+        struct controlNode* node = parseControlAndOr(parser);
+        if (node == NULL) {
+            if (parser->error == 0) {
+                controlSyntaxError(parser);
+            }
+            break;
+        }
+        if (list == NULL) {
+            list = newControlNode(CONTROL_LIST);
+            list->body = node;
+        }
+        else {
+            last->next = node;
+        }
+        last = node;
+    }
+    return list;
+}
+
+
+
+/*
+Compiles a command line into a tree: commands and pipelines joined by ';', '&', '&&' and '||', and
+if/then/elif/else/fi, while/until/do/done and for/in/do/done blocks. The text is kept unchanged.
+Returns CONTROL_COMPLETE with program set (NULL for a blank line), CONTROL_INCOMPLETE if the text ends
+inside a block or after '&&' or '||' and more lines are needed, or CONTROL_ERROR (message printed).
+*/
+int compileControl(char* inputCommand, struct controlNode** program) {
+    struct controlParser parser = {inputCommand, 0, 0, 0};
+
+    *program = parseControlList(&parser);
+    if ((parser.error == 0) && (parser.text[parser.position] != '\0')) {
+        controlSyntaxError(&parser);
+    }
+    if (parser.incomplete == 1) {
+        return CONTROL_INCOMPLETE;
+    }
+    return (parser.error == 1) ? CONTROL_ERROR : CONTROL_COMPLETE;
+}
+
+
+
+/*
+Makes a copy of a parsed command to run, so that a prefix like 'time' moving its arguments along does not
+change the compiled one. Only the structures are copied. The words are shared.
+*/
+struct commandStructure* copyCompiledCommand(struct commandStructure* compiled) {
+    struct commandStructure* command = arenaAllocate(&commandArena, sizeof(struct commandStructure));
+    struct commandStructure* stage = command;
+
+    *command = *compiled;
+    while (stage->nextStage != NULL) {
+        struct commandStructure* nextStage = arenaAllocate(&commandArena, sizeof(struct commandStructure));
+        *nextStage = *stage->nextStage;
+        stage->nextStage = nextStage;
+        stage = nextStage;
+    }
+    return command;
+}
+
+
+
+/*
+Runs one command node. Text with '$' in it is expanded and parsed here, every time.
+Whatever it allocates in commandArena is released when it is done, so a loop runs in constant memory.
+*/
+void runControlCommand(struct controlNode* node) {
+    struct arenaMark mark = markArena(&commandArena);
+    struct commandStructure* command;
+    long long substitutionsBefore = substitutionsRun;
+
+    if (node->parsed != NULL) {
+        command = copyCompiledCommand(node->parsed);
+    }
+    else {
+        char* inputCommand = stringExpansion(arenaCopyString(&commandArena, node->text));
+        TRACE_BEGIN(TRACE_PARSE);
+        command = parseInputCommand(inputCommand);
+        TRACE_END(TRACE_PARSE, 0, command->pipelineStages, command->command);
+        if (command->parseError == 1) {
+            lastExitStatus = 1;
+        }
+    }
+
+    if ((command->argumentCounter == 0) && (command->assignmentCount > 0) && (command->parseError == 0)) {
+        int substitutionStatus = lastExitStatus;
+        assignVariables(command);
+        // Like other shells, assignments alone take the status of the last '$(...)' in them.
+        if (substitutionsRun != substitutionsBefore) {
+            lastExitStatus = substitutionStatus;
+        }
+    }
+    else if ((command->argumentCounter > 0) && (command->parseError == 0)) {
+        if ((strcmp(command->command, "break") == 0) || (strcmp(command->command, "continue") == 0)) {
+            if (loopDepth > 0) {
+                controlJump = (command->command[0] == 'b') ? JUMP_BREAK : JUMP_CONTINUE;
+            }
+            else {
+                printf("%s: only meaningful in a loop\n", command->command);
+                fflush(stdout);
+            }
+            lastExitStatus = 0;
+        }
+        else {
+            commandsRun++;
+            shellCommand(command);
+            // Children have already ended the shell for 'set -e'. This catches the builtins run in the shell.
+            if ((exitOnFailure == 1) && (lastExitStatus != 0)) {
+                exitShell(lastExitStatus);
+            }
+        }
+    }
+    rewindArena(&commandArena, &mark);
+}
+
+
+
+/*
+Runs a condition. 'set -e' does not end the shell for a condition that fails, like other shells.
+Returns 1 if it succeeded, 0 if it failed.
+*/
+int runControlCondition(struct controlNode* condition) {
+    int savedExitOnFailure = exitOnFailure;
+
+    exitOnFailure = 0;
+    runControl(condition);
+    if (exitOnFailure == 0) {
+        exitOnFailure = savedExitOnFailure;
+    }
+    return (lastExitStatus == 0);
+}
+
+
+
+/*
+Runs 'for': expands and splits its words once, then runs the body with the variable set to each in turn.
+The variable is a shell variable, so '$name' finds it. It is only in the environment of commands if exported.
+*/
+void runControlFor(struct controlNode* node) {
+    struct arenaMark mark = markArena(&commandArena);
+    struct lexerState lexer;
+    char* word;
+    int token;
+
+    initializeLexer(&lexer, expandLine(arenaCopyString(&commandArena, node->wordsText), 0));
+    lastExitStatus = 0;
+    loopDepth++;
+    while ((token = nextToken(&lexer, &word)) == TOKEN_WORD) {
+        setVariable(node->variableName, strlen(node->variableName), word, 0);
+        runControl(node->body);
+        if (controlJump == JUMP_CONTINUE) {
+            controlJump = JUMP_NONE;
+        }
+        if ((controlJump == JUMP_BREAK) || (foregroundInterrupted == 1)) {
+            break;
+        }
+    }
+    if ((token != TOKEN_WORD) && (token != TOKEN_END)) {
+        printf("Invalid word list for '%s'. Please try again.\n", node->variableName);
+        fflush(stdout);
+        lastExitStatus = 1;
+    }
+    loopDepth--;
+    controlJump = JUMP_NONE;
+    rewindArena(&commandArena, &mark);
+}
+
+
+
+/*
+Runs a compiled tree. '&&' and '||' test lastExitStatus as soon as the command before them is done.
+Stops early after 'break' or 'continue', or when a foreground command was ended by Ctrl-C.
+*/
+void runControl(struct controlNode* node) {
+    if ((node == NULL) || (controlJump != JUMP_NONE) || (foregroundInterrupted == 1)) {
+        return;
+    }
+
+    switch (node->type) {
+        case CONTROL_COMMAND:
+            runControlCommand(node);
+            break;
+
+        case CONTROL_LIST:
+            for (node = node->body; node != NULL; node = node->next) {
+                runControl(node);
+                if ((controlJump != JUMP_NONE) || (foregroundInterrupted == 1)) {
+                    break;
+                }
+            }
+            break;
+
+        case CONTROL_AND:
+        case CONTROL_OR:
+            if ((runControlCondition(node->condition) == 1) == (node->type == CONTROL_AND)) {
+                runControl(node->body);
+            }
+            break;
+
+        case CONTROL_IF:
+            if (runControlCondition(node->condition) == 1) {
+                lastExitStatus = 0;
+                runControl(node->body);
+            }
+            else {
+                lastExitStatus = 0;
+                runControl(node->elseBody);
+            }
+            break;
+
+        case CONTROL_WHILE:
+        case CONTROL_UNTIL: {
+            int bodyStatus = 0;
+            loopDepth++;
+            while ((runControlCondition(node->condition) == 1) == (node->type == CONTROL_WHILE)) {
+                if ((controlJump != JUMP_NONE) || (foregroundInterrupted == 1)) {
+                    break;
+                }
+                lastExitStatus = 0;
+                runControl(node->body);
+                bodyStatus = lastExitStatus;
+                if (controlJump == JUMP_CONTINUE) {
+                    controlJump = JUMP_NONE;
+                }
+                if ((controlJump == JUMP_BREAK) || (foregroundInterrupted == 1)) {
+                    break;
+                }
+            }
+            loopDepth--;
+            controlJump = JUMP_NONE;
+            lastExitStatus = bodyStatus;
+            break;
+        }
+
+        case CONTROL_FOR:
+            runControlFor(node);
+            break;
+    }
+}
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+#include "smallsh.h"
+
+// Keys read from escape sequences, numbered past every byte value.
+#define KEY_UP 256
+#define KEY_DOWN 257
+#define KEY_RIGHT 258
+#define KEY_LEFT 259
+#define KEY_HOME 260
+#define KEY_END 261
+#define KEY_DELETE 262
+#define KEY_CONTROL(letter) ((letter) - 'a' + 1)
+// Completions listed after a second Tab before the rest are only counted.
+#define COMPLETIONS_LISTED 100
+
+/*
+Structure for the line editor used at the prompt of an interactive shell.
+The terminal is only in raw mode while a line is being edited, so commands start with it as the user had it.
+*/
+struct lineEditor {
+    char* buffer;
+    size_t length;
+    size_t cursor;
+    size_t capacity;
+    // Bytes read from the terminal and not handled yet. A paste or typed-ahead line comes in one read.
+    unsigned char pending[256];
+    int pendingStart;
+    int pendingEnd;
+    struct termios savedTerminal;
+    // ': ', or '> ' for the next line of an unfinished 'if', 'for' or 'while'.
+    char* prompt;
+    int lastKeyWasTab;
+    struct completionList completions;
+    // Entry shown by Up and Down, or 0 for the line being typed, which is kept in savedLine meanwhile.
+    unsigned int historyPosition;
+    char* savedLine;
+    size_t savedLength;
+};
+
+struct lineEditor lineEditor;
+
+
+
+/*
+Sets up the line editor for a terminal on stdin.
+Returns 0, or -1 if the terminal cannot be put in raw mode or is a dumb one, and lines should be read as they are.
+*/
+int initializeLineEditor(struct lineEditor* editor) {
+    char* terminalType = getenv("TERM");
+
+    memset(editor, 0, sizeof(struct lineEditor));
+    if ((terminalType == NULL) || (strcmp(terminalType, "dumb") == 0) || (tcgetattr(STDIN_FILENO, &editor->savedTerminal) == -1)) {
+        return -1;
+    }
+    editor->capacity = 256;
+    editor->buffer = malloc(editor->capacity);
+    return 0;
+}
+
+
+
+/*
+Makes room for extraLength more bytes in the line, and for the newline added when it is done.
+*/
+void growEditorLine(struct lineEditor* editor, size_t extraLength) {
+    while (editor->length + extraLength + 2 > editor->capacity) {
+        editor->capacity *= 2;
+        editor->buffer = realloc(editor->buffer, editor->capacity);
+    }
+}
+
+
+
+/*
+Puts text into the line at the cursor, and moves the cursor past it.
+*/
+void insertEditorText(struct lineEditor* editor, char* text, size_t textLength) {
+    growEditorLine(editor, textLength);
+    memmove(&editor->buffer[editor->cursor + textLength], &editor->buffer[editor->cursor], editor->length - editor->cursor);
+    memcpy(&editor->buffer[editor->cursor], text, textLength);
+    editor->length += textLength;
+    editor->cursor += textLength;
+}
+
+
+
+/*
+Removes deleteLength bytes of the line, starting at position.
+*/
+void deleteEditorText(struct lineEditor* editor, size_t position, size_t deleteLength) {
+    memmove(&editor->buffer[position], &editor->buffer[position + deleteLength], editor->length - position - deleteLength);
+    editor->length -= deleteLength;
+    if (editor->cursor > position + deleteLength) {
+        editor->cursor -= deleteLength;
+    }
+    else if (editor->cursor > position) {
+        editor->cursor = position;
+    }
+}
+
+
+
+/*
+Replaces the whole line with text, with the cursor at its end.
+*/
+void setEditorLine(struct lineEditor* editor, char* text, size_t textLength) {
+    editor->length = 0;
+    editor->cursor = 0;
+    insertEditorText(editor, text, textLength);
+}
+
+
+
+/*
+Draws the prompt and the line again over the current terminal line, and puts the cursor back in place.
+*/
+void refreshEditorLine(struct lineEditor* editor) {
+    printf("\r%s%.*s\x1b[K", editor->prompt, (int)editor->length, editor->buffer);
+    if (editor->cursor < editor->length) {
+        printf("\x1b[%zuD", editor->length - editor->cursor);
+    }
+    fflush(stdout);
+}
+
+
+
+/*
+Returns the next byte typed, waiting on the event loop until there is one. Background notices and signals
+are handled while waiting, and the line is drawn again under any message they print.
+Returns -1 at the end of input.
+*/
+int readEditorByte(struct lineEditor* editor) {
+    while (editor->pendingStart == editor->pendingEnd) {
+        int inputReady;
+        int messagesPrinted = waitForShellEvents(-1, 1, &inputReady);
+
+        messagesPrinted += reapChildProcesses(1);
+        if (messagesPrinted > 0) {
+            refreshEditorLine(editor);
+        }
+        if (inputReady == 0) {
+            continue;
+        }
+
+        ssize_t bytesRead = read(STDIN_FILENO, editor->pending, sizeof(editor->pending));
+        if (bytesRead > 0) {
+            editor->pendingStart = 0;
+            editor->pendingEnd = bytesRead;
+        }
+        else if ((bytesRead == 0) || ((errno != EINTR) && (errno != EAGAIN))) {
+            return -1;
+        }
+    }
+    return editor->pending[editor->pendingStart++];
+}
+
+
+
+/*
+Returns the next key typed: a byte, or one of the KEY values for the arrow, Home, End and Delete keys.
+Other escape sequences are read and returned as the escape byte, which is ignored.
+Returns -1 at the end of input.
+*/
+int readEditorKey(struct lineEditor* editor) {
+    int key = readEditorByte(editor);
+
+    if (key != 27) {
+        return key;
+    }
+    int introducer = readEditorByte(editor);
+    if ((introducer != '[') && (introducer != 'O')) {
+        return (introducer == -1) ? -1 : 27;
+    }
+    int final = readEditorByte(editor);
+    if ((final >= '0') && (final <= '9')) {
+        int number = final;
+        while ((final >= '0') && (final <= ';')) {
+            final = readEditorByte(editor);
+        }
+        if (final != '~') {
+            return 27;
+        }
+        return (number == '3') ? KEY_DELETE : ((number == '1') || (number == '7')) ? KEY_HOME \
+                : ((number == '4') || (number == '8')) ? KEY_END : 27;
+    }
+    return (final == 'A') ? KEY_UP : (final == 'B') ? KEY_DOWN : (final == 'C') ? KEY_RIGHT : (final == 'D') ? KEY_LEFT \
+            : (final == 'H') ? KEY_HOME : (final == 'F') ? KEY_END : (final == -1) ? -1 : 27;
+}
+
+
+
+/*
+Completes the word before the cursor, for Tab.
+A single match is put in with a space after it, or a '/' for a directory. Several matches put in as much as
+they all share. When that adds nothing, a second Tab lists them.
+*/
+void completeEditorWord(struct lineEditor* editor) {
+    size_t wordStart = editor->cursor;
+    size_t prefixLength;
+    int commandPosition = 1;
+    int i = 0;
+
+    while ((wordStart > 0) && (strchr(" \t|;&<>", editor->buffer[wordStart - 1]) == NULL)) {
+        wordStart--;
+    }
+    // The word names a command if nothing but spaces comes between it and the start of the line or a '|', ';' or '&'.
+    size_t before = wordStart;
+    while ((before > 0) && ((editor->buffer[before - 1] == ' ') || (editor->buffer[before - 1] == '\t'))) {
+        before--;
+    }
+    if ((before > 0) && (strchr("|;&", editor->buffer[before - 1]) == NULL)) {
+        commandPosition = 0;
+    }
+
+    int matchCount = completeWord(&editor->buffer[wordStart], editor->cursor - wordStart, commandPosition, &editor->completions, &prefixLength);
+    char** names = editor->completions.names;
+    if (matchCount == 0) {
+        printf("\a");
+        fflush(stdout);
+        return;
+    }
+    if (matchCount == 1) {
+        size_t nameLength = strlen(names[0]);
+        insertEditorText(editor, &names[0][prefixLength], nameLength - prefixLength);
+        if (names[0][nameLength - 1] != '/') {
+            insertEditorText(editor, " ", 1);
+        }
+        refreshEditorLine(editor);
+        return;
+    }
+
+    size_t sharedLength = strlen(names[0]);
+    for (i = 1; i < matchCount; i++) {
+        size_t j = prefixLength;
+        for (j; (j < sharedLength) && (names[i][j] == names[0][j]); j++) {
+        }
+        sharedLength = j;
+    }
+    if (sharedLength > prefixLength) {
+        insertEditorText(editor, &names[0][prefixLength], sharedLength - prefixLength);
+        refreshEditorLine(editor);
+    }
+    else if (editor->lastKeyWasTab == 1) {
+        printf("\n");
+        for (i = 0; (i < matchCount) && (i < COMPLETIONS_LISTED); i++) {
+            printf("%s  ", names[i]);
+        }
+        if (matchCount > COMPLETIONS_LISTED) {
+            printf("... and %d more", matchCount - COMPLETIONS_LISTED);
+        }
+        printf("\n");
+        refreshEditorLine(editor);
+    }
+    else {
+        printf("\a");
+        fflush(stdout);
+    }
+}
+
+
+
+/*
+Moves through the history for Up (direction -1) and Down (direction 1). The line being typed is kept,
+and comes back after the newest entry.
+*/
+void moveEditorHistory(struct lineEditor* editor, int direction) {
+    int entryCount = syncHistory();
+    size_t entryLength;
+
+    if (entryCount <= 0) {
+        return;
+    }
+    if (editor->historyPosition == 0) {
+        if (direction == 1) {
+            return;
+        }
+        editor->savedLine = realloc(editor->savedLine, editor->length + 1);
+        memcpy(editor->savedLine, editor->buffer, editor->length);
+        editor->savedLength = editor->length;
+        editor->historyPosition = entryCount;
+    }
+    else if ((direction == -1) && (editor->historyPosition > 1)) {
+        editor->historyPosition--;
+    }
+    else if (direction == 1) {
+        editor->historyPosition++;
+    }
+
+    if (editor->historyPosition > (unsigned int)entryCount) {
+        editor->historyPosition = 0;
+        setEditorLine(editor, editor->savedLine, editor->savedLength);
+    }
+    else {
+        char* entry = historyEntry(editor->historyPosition, &entryLength);
+        setEditorLine(editor, entry, entryLength);
+    }
+}
+
+
+
+/*
+Runs an incremental search of the history, for Ctrl-R. Each key typed narrows the search to the newest
+entry containing the text so far, and Ctrl-R again goes on to older ones.
+Enter runs the entry found. Ctrl-G or Ctrl-C goes back to the line as it was. Any other key keeps the
+entry found in the line, to edit.
+Returns 1 if the line should be run, 0 to carry on editing.
+*/
+int searchEditorHistory(struct lineEditor* editor) {
+    char query[256];
+    size_t queryLength = 0;
+    unsigned int match = 0;
+    size_t entryLength = 0;
+    char* entry = "";
+
+    while (1) {
+        printf("\r(reverse-i-search)`%.*s': %.*s\x1b[K", (int)queryLength, query, (int)entryLength, entry);
+        fflush(stdout);
+
+        int key = readEditorKey(editor);
+        unsigned int found = 0;
+        if ((key >= 32) && (key < 256) && (key != 127) && (queryLength < sizeof(query))) {
+            query[queryLength] = key;
+            queryLength++;
+            found = searchHistory(query, queryLength, 0, 0);
+        }
+        else if (((key == 127) || (key == 8)) && (queryLength > 0)) {
+            queryLength--;
+            found = (queryLength > 0) ? searchHistory(query, queryLength, 0, 0) : 0;
+        }
+        else if ((key == KEY_CONTROL('r')) && (match != 0)) {
+            found = searchHistory(query, queryLength, match, 0);
+            found = (found == 0) ? match : found;
+        }
+        else if ((key == KEY_CONTROL('g')) || (key == KEY_CONTROL('c'))) {
+            refreshEditorLine(editor);
+            return 0;
+        }
+        else if (key != KEY_CONTROL('r')) {
+            if (match != 0) {
+                entry = historyEntry(match, &entryLength);
+                setEditorLine(editor, entry, entryLength);
+            }
+            refreshEditorLine(editor);
+            return ((key == '\r') || (key == '\n'));
+        }
+        else {
+            continue;
+        }
+
+        match = found;
+        entryLength = 0;
+        entry = "";
+        if (match != 0) {
+            entry = historyEntry(match, &entryLength);
+        }
+    }
+}
+
+
+
+/*
+Reads one line from the terminal with editing, completion and history. Replaces readInputLine when the shell
+reads from a terminal, and prints the prompt itself.
+Keys are the usual readline ones: arrows, Home and End; Ctrl-A, E, B, F, P, N; Backspace, Delete, Ctrl-D;
+Ctrl-U, K and W to cut; Ctrl-L to clear the screen; Tab to complete; Ctrl-R to search the history.
+Ctrl-C abandons the line, Ctrl-Z toggles the foreground-only mode, and Ctrl-D on an empty line ends the input.
+The line ends in a newline, and is only valid until the next call.
+Returns NULL at the end of input.
+*/
+char* editInputLine(struct lineEditor* editor, char* prompt, size_t* lineLength) {
+    struct termios rawTerminal;
+    int lineDone = 0;
+
+    // Commands may have changed the terminal settings, so they are read again for each line.
+    tcgetattr(STDIN_FILENO, &editor->savedTerminal);
+    rawTerminal = editor->savedTerminal;
+    rawTerminal.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+    rawTerminal.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+    rawTerminal.c_cc[VMIN] = 1;
+    rawTerminal.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &rawTerminal);
+
+    editor->prompt = prompt;
+    editor->length = 0;
+    editor->cursor = 0;
+    editor->historyPosition = 0;
+    editor->lastKeyWasTab = 0;
+    refreshEditorLine(editor);
+
+    while (lineDone == 0) {
+        int key = readEditorKey(editor);
+        int keyWasTab = 0;
+
+        if ((key == -1) || ((key == KEY_CONTROL('d')) && (editor->length == 0))) {
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &editor->savedTerminal);
+            printf("\n");
+            fflush(stdout);
+            return NULL;
+        }
+        else if ((key == '\r') || (key == '\n')) {
+            lineDone = 1;
+        }
+        else if (key == '\t') {
+            completeEditorWord(editor);
+            keyWasTab = 1;
+        }
+        else if (key == KEY_CONTROL('r')) {
+            lineDone = searchEditorHistory(editor);
+        }
+        else if (key == KEY_CONTROL('c')) {
+            printf("^C\n");
+            editor->length = 0;
+            editor->cursor = 0;
+            editor->historyPosition = 0;
+        }
+        else if (key == KEY_CONTROL('z')) {
+            toggleForegroundOnly();
+        }
+        else if (((key == 127) || (key == 8)) && (editor->cursor > 0)) {
+            deleteEditorText(editor, editor->cursor - 1, 1);
+        }
+        else if (((key == KEY_DELETE) || (key == KEY_CONTROL('d'))) && (editor->cursor < editor->length)) {
+            deleteEditorText(editor, editor->cursor, 1);
+        }
+        else if ((key == KEY_LEFT) || (key == KEY_CONTROL('b'))) {
+            editor->cursor -= (editor->cursor > 0);
+        }
+        else if ((key == KEY_RIGHT) || (key == KEY_CONTROL('f'))) {
+            editor->cursor += (editor->cursor < editor->length);
+        }
+        else if ((key == KEY_HOME) || (key == KEY_CONTROL('a'))) {
+            editor->cursor = 0;
+        }
+        else if ((key == KEY_END) || (key == KEY_CONTROL('e'))) {
+            editor->cursor = editor->length;
+        }
+        else if (key == KEY_CONTROL('u')) {
+            deleteEditorText(editor, 0, editor->cursor);
+        }
+        else if (key == KEY_CONTROL('k')) {
+            editor->length = editor->cursor;
+        }
+        else if (key == KEY_CONTROL('w')) {
+            size_t wordStart = editor->cursor;
+            while ((wordStart > 0) && (editor->buffer[wordStart - 1] == ' ')) {
+                wordStart--;
+            }
+            while ((wordStart > 0) && (editor->buffer[wordStart - 1] != ' ')) {
+                wordStart--;
+            }
+            deleteEditorText(editor, wordStart, editor->cursor - wordStart);
+        }
+        else if (key == KEY_CONTROL('l')) {
+            printf("\x1b[H\x1b[2J");
+        }
+        else if ((key == KEY_UP) || (key == KEY_CONTROL('p'))) {
+            moveEditorHistory(editor, -1);
+        }
+        else if ((key == KEY_DOWN) || (key == KEY_CONTROL('n'))) {
+            moveEditorHistory(editor, 1);
+        }
+        else if ((key >= 32) && (key < 256) && (key != 127)) {
+            char character = key;
+            insertEditorText(editor, &character, 1);
+        }
+
+        editor->lastKeyWasTab = keyWasTab;
+        // Most keys redraw the line. Typing at the end of it only needs the new character echoed.
+        if ((lineDone == 0) && (keyWasTab == 0)) {
+            if ((key >= 32) && (key < 127) && (editor->cursor == editor->length)) {
+                printf("%c", key);
+                fflush(stdout);
+            }
+            else {
+                refreshEditorLine(editor);
+            }
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &editor->savedTerminal);
+    printf("\n");
+    fflush(stdout);
+    editor->buffer[editor->length] = '\n';
+    *lineLength = editor->length + 1;
+    return editor->buffer;
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "smallsh.h"
+
+/*
+Kinds of fd watched by the shell's epoll loop.
+*/
+#define EVENT_INPUT 0
+#define EVENT_SIGNAL 1
+#define EVENT_ZYGOTE 2
+#define EVENT_TIMER 3
+
+/*
+Structure for one fd in the epoll set. epoll hands back a pointer to it with each event.
+Timers also carry the function to call when they expire, and its argument.
+*/
+struct eventSource {
+    int type;
+    int fd;
+    void (*expire)(void* data);
+    void* data;
+};
+
+/*
+Event loop globals.
+*/
+int shellEpollFd = -1;
+struct eventSource inputSource = {EVENT_INPUT, STDIN_FILENO, NULL, NULL};
+struct eventSource signalSource = {EVENT_SIGNAL, -1, NULL, NULL};
+// Follows zygoteSocket, which comes and goes with the zygote engine.
+struct eventSource zygoteSource = {EVENT_ZYGOTE, -1, NULL, NULL};
+// Timers started and not yet expired or cancelled. While there are none, waits can block in wait4 directly.
+int activeTimerCount = 0;
+
+
+
+/*
+Adds one source to the epoll set, creating the set the first time. Adding one twice does nothing.
+*/
+void watchEventSource(struct eventSource* source) {
+    struct epoll_event event = {0};
+
+    if (shellEpollFd == -1) {
+        shellEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = source;
+    epoll_ctl(shellEpollFd, EPOLL_CTL_ADD, source->fd, &event);
+}
+
+
+
+/*
+Turns the foreground-only mode on or off, and says so. Runs from the event loop when SIGTSTP is read
+from the signalfd, so it is ordinary code rather than a signal handler. A SIGTSTP that arrives while a
+foreground command runs is usually read once the command finishes, so the message comes after its output.
+While timers are set, waitForChildWithTimers runs the event loop during the command, and the mode changes
+straight away, with the message in among the command's output.
+*/
+void toggleForegroundOnly() {
+    if (backgroundProcessAllowed == 1) {
+        backgroundProcessAllowed = 0;
+        printf("\nEntering foreground-only mode (& is now ignored)\n");
+    }
+    else {
+        backgroundProcessAllowed = 1;
+        printf("\nExited foreground-only mode.\n");
+    }
+    fflush(stdout);
+}
+
+
+
+/*
+Reads every signal waiting on the signalfd.
+SIGCHLD sets childSignalled for reapChildProcesses. SIGTSTP toggles the foreground-only mode.
+SIGINT at the prompt abandons the line, like other shells; anywhere else it was meant for a foreground
+child, and is dropped.
+Returns the number of messages printed, so the caller knows to show the prompt again.
+*/
+int handleShellSignals(int atPrompt) {
+    struct signalfd_siginfo signalInfo;
+    int messagesPrinted = 0;
+
+    while (read(shellSignalFd, &signalInfo, sizeof(signalInfo)) == sizeof(signalInfo)) {
+        if (signalInfo.ssi_signo == SIGCHLD) {
+            childSignalled = 1;
+        }
+        else if (signalInfo.ssi_signo == SIGTSTP) {
+            toggleForegroundOnly();
+            messagesPrinted++;
+        }
+        else if ((signalInfo.ssi_signo == SIGINT) && (atPrompt == 1)) {
+            printf("\n");
+            fflush(stdout);
+            messagesPrinted++;
+        }
+    }
+    return messagesPrinted;
+}
+
+
+
+/*
+Starts a one-shot timer on the event loop. After delayNanoseconds, expire is called with data from
+processShellEvents, and the timer is freed.
+Returns the timer, for cancelShellTimer, or NULL if no timerfd could be created.
+*/
+struct eventSource* startShellTimer(long long delayNanoseconds, void (*expire)(void* data), void* data) {
+    struct itimerspec timerValue = {0};
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (timerFd == -1) {
+        return NULL;
+    }
+    // A zero it_value would disarm the timer, so the shortest delay is 1 ns.
+    if (delayNanoseconds < 1) {
+        delayNanoseconds = 1;
+    }
+    timerValue.it_value.tv_sec = delayNanoseconds / 1000000000LL;
+    timerValue.it_value.tv_nsec = delayNanoseconds % 1000000000LL;
+    timerfd_settime(timerFd, 0, &timerValue, NULL);
+
+    struct eventSource* timer = malloc(sizeof(struct eventSource));
+    timer->type = EVENT_TIMER;
+    timer->fd = timerFd;
+    timer->expire = expire;
+    timer->data = data;
+    watchEventSource(timer);
+    activeTimerCount++;
+    return timer;
+}
+
+
+
+/*
+Stops a timer that has not expired yet, and frees it.
+*/
+void cancelShellTimer(struct eventSource* timer) {
+    epoll_ctl(shellEpollFd, EPOLL_CTL_DEL, timer->fd, NULL);
+    close(timer->fd);
+    free(timer);
+    activeTimerCount--;
+}
+
+
+
+/*
+Waits up to timeoutMilliseconds (-1 for no limit) for stdin, signals, zygote messages or timers, and handles
+whatever is ready: signals are read, zygote messages queued, and timers run. Children are not reaped here.
+stdin is only watched if atPrompt is 1, and inputReady is set to 1 if it has input.
+Returns the number of messages printed.
+*/
+int waitForShellEvents(int timeoutMilliseconds, int atPrompt, int* inputReady) {
+    struct epoll_event events[16];
+    int messagesPrinted = 0;
+    int i = 0;
+
+    *inputReady = 0;
+    if (signalSource.fd != shellSignalFd) {
+        signalSource.fd = shellSignalFd;
+        watchEventSource(&signalSource);
+    }
+    // stdin is only watched at the prompt. Elsewhere a typed-ahead line would wake the loop over and over.
+    if (atPrompt == 1) {
+        inputSource.fd = STDIN_FILENO;
+        watchEventSource(&inputSource);
+    }
+    // The zygote's socket is closed when it exits, which takes it out of the set. A new zygote can get
+    // the same fd number, so it is added every time, and epoll turns down the ones already there.
+    if (zygoteSocket != -1) {
+        zygoteSource.fd = zygoteSocket;
+        watchEventSource(&zygoteSource);
+    }
+
+    int eventCount = epoll_wait(shellEpollFd, events, 16, timeoutMilliseconds);
+    if (atPrompt == 1) {
+        epoll_ctl(shellEpollFd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+    }
+    for (i; i < eventCount; i++) {
+        struct eventSource* source = events[i].data.ptr;
+
+        if (source->type == EVENT_INPUT) {
+            *inputReady = 1;
+        }
+        else if (source->type == EVENT_SIGNAL) {
+            messagesPrinted += handleShellSignals(atPrompt);
+        }
+        else if (source->type == EVENT_ZYGOTE) {
+            drainZygoteMessages();
+        }
+        else if (source->type == EVENT_TIMER) {
+            unsigned long long expirations;
+            read(source->fd, &expirations, sizeof(expirations));
+            source->expire(source->data);
+            cancelShellTimer(source);
+        }
+    }
+    return messagesPrinted;
+}
+
+
+
+/*
+Waits up to timeoutMilliseconds (-1 for no limit) for stdin, signals, zygote messages or timers, and
+handles whatever is ready. Finished background children are reported right away.
+If atPrompt is 1, stdin is watched too, and the ': ' prompt is printed again after any message.
+Returns 1 if stdin has input, 0 otherwise.
+*/
+int processShellEvents(int timeoutMilliseconds, int atPrompt) {
+    int inputReady;
+    int messagesPrinted = waitForShellEvents(timeoutMilliseconds, atPrompt, &inputReady);
+
+    messagesPrinted += reapChildProcesses(atPrompt);
+    if ((atPrompt == 1) && (messagesPrinted > 0) && (inputReady == 0)) {
+        printf(": ");
+        fflush(stdout);
+    }
+    return inputReady;
+}
+
+
+
+/*
+Waits for a child like waitForChild, but keeps timers running while it waits, so timeouts still fire during
+foreground commands, 'wait' and 'fg'. With no timers set it is just waitForChild.
+Otherwise the child is checked with WNOHANG each time the event loop wakes, which SIGCHLD, a zygote message
+or a timer all do. Other children are left for reapChildProcesses at the next prompt.
+*/
+pid_t waitForChildWithTimers(pid_t processID, int* childExit, int options, struct rusage* usage) {
+    int inputReady;
+
+    while (activeTimerCount > 0) {
+        pid_t waitResult = waitForChild(processID, childExit, options | WNOHANG, usage);
+        if ((waitResult != 0) || ((options & WNOHANG) != 0)) {
+            return waitResult;
+        }
+        waitForShellEvents(-1, 0, &inputReady);
+    }
+    return waitForChild(processID, childExit, options, usage);
+}
@@ -6,86 +6,104 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <time.h>
+#include <errno.h>
+#include "smallsh.h"
+
 
-/*
-Global Variables
-*/
-// Keep track of child's last exit status.
-int lastExitStatus = 0;
-// Toggle flag for foreground-only mode.
-int backgroundProcessAllowed = 1;
-// Array to keep track of child processes.
-int childProcesses[128];
-// Counter for child processes array.
-int indexCounter = 0;
 
 /*
-Structure for parsing and saving data associated with command input.
+Reaps every child that has changed state since the last call, without scanning for them.
+Only does work after SIGCHLD has been read from the signalfd, or the zygote has sent a child event.
+Then waitForChild(-1, WNOHANG) is called until no more changed children are left, and each one is looked up in the job table with its rusage.
+Finished processes get the usual background message, finished jobs are removed, and stopped jobs are reported.
+Foreground children are not seen here, since otherCommand waits for them before returning.
+If promptShown is 1, a newline is printed before the first message so it does not follow the ': ' prompt.
+Returns the number of messages printed.
 */
-struct commandStructure {
-    char* command;
-    char* bashCommand;
-    char* arguments[512];
-    int argumentCounter;
-    char* inputFileName;
-    char* outputFileName;
-    int outputRedirect;
-    int inputRedirect;
-    int backgroundProcess;
-};
+int reapChildProcesses(int promptShown) {
+    struct rusage usage;
+    int childExit;
+    int processID;
+    int messagesPrinted = 0;
+
+    // Children of the zygote are reported on its socket rather than by SIGCHLD.
+    drainZygoteMessages();
+    if ((childSignalled == 0) && (zygoteEventCount == 0)) {
+        return 0;
+    }
+    childSignalled = 0;
+
+    while ((processID = waitForChild(-1, &childExit, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        struct jobEntry* job = findJobByProcess(processID);
+        if (job == NULL) {
+            continue;
+        }
+
+        int newlyStopped = (WIFSTOPPED(childExit) && (job->state != JOB_STOPPED));
+        int printsMessage = (WIFEXITED(childExit) || WIFSIGNALED(childExit) || newlyStopped);
+        if ((promptShown == 1) && (messagesPrinted == 0) && printsMessage) {
+            printf("\n");
+        }
+
+        if (updateJobProcess(job, processID, childExit, &usage) == 1) {
+            removeJob(job);
+        }
+        else if (newlyStopped) {
+            printf("[%d] Stopped\t%s\n", job->jobId, job->commandText);
+        }
+
+        if (printsMessage) {
+            messagesPrinted++;
+        }
+    }
+
+    fflush(stdout);
+    return messagesPrinted;
+}
 
 
 
 /*
-Initializes childProcesses global array to point to all point to NULL.
+Prepares a forked copy of the shell that goes on running commands, for a command substitution or a server worker.
+The epoll set is shared with the parent across fork, so the copy makes its own, and a new signalfd for it.
+The parent's jobs and zygote stay the parent's: the copy forgets the jobs, and spawns with posix_spawn.
 */
-void initializeChildArray() {
-    int z = 0;
-    for (z ; z < 129; z++) {
-        childProcesses[z] = NULL;
+void detachForkedShell() {
+    close(shellEpollFd);
+    shellEpollFd = -1;
+    signalSource.fd = -1;
+    close(shellSignalFd);
+    setSignals();
+
+    if (zygoteSocket != -1) {
+        close(zygoteSocket);
+        zygoteSocket = -1;
+        zygoteChildCount = 0;
+        zygoteEventCount = 0;
+        spawnEngine = SPAWN_ENGINE_POSIX;
     }
+    forgetAllJobs();
 }
 
 
 
 /*
-Iterates through childProcesses global array.
+Clears the signal mask in a new child. The shell blocks SIGINT, SIGTSTP and SIGCHLD for its signalfd,
+and a blocked mask would otherwise survive exec.
 */
-void checkChildProcesses() {
-    int childExit;
-    int y = 0;
-    int processID;
-    
-    for (y; y < 129; y++) {
-        // If a pid value is found in array, calls waitpid.
-        if (childProcesses[y] != NULL) {
-            processID = waitpid(childProcesses[y], &childExit, WNOHANG);
-
-            //Checks process ID is returned, check if it has exited and print appropriate message.
-            if (processID > 0) {
-                if (WIFEXITED(childExit) != 0) {
-                    printf("Background child process %d finished. Status value: %d.\n"\
-                            , processID, childExit);
-                    fflush(stdout);
-                    childProcesses[y] = NULL;
-                }
-
-                else if (WIFSIGNALED(childExit)) {
-                    printf("Background child process %d terminated due to signal %d.\n"\
-                            , processID, childExit);
-                    fflush(stdout);
-                    childProcesses[y] = NULL;                  
-                }
-            }
-        }
-    }
+void unblockShellSignals() {
+    sigset_t childMask;
+    sigemptyset(&childMask);
+    sigprocmask(SIG_SETMASK, &childMask, NULL);
 }
 
 
 
 /*
-Sets the SIGINT and SIGTSTP signal handlers for children.
+Sets the SIGINT and SIGTSTP signal handlers for foreground children, and unblocks the signals the shell blocks.
 SIGINT to SIG_DFL
 SIGSTP to SIG_IGN
 */
@@ -106,270 +124,385 @@ void setSignalsForegroundChild() {
 
     sigaction(SIGTSTP, &SIGTSTP_foregroundChildAction, NULL);
 
+    unblockShellSignals();
+}
+
+
+
+/*
+Sets the SIGINT signal handler for background children, and unblocks the signals the shell blocks.
+SIGINT to SIG_IGN, so Ctrl-C at the terminal only reaches the foreground.
+*/
+void setSignalsBackgroundChild() {
+    struct sigaction SIGINT_backgroundChildAction = {0};
+
+    SIGINT_backgroundChildAction.sa_handler = SIG_IGN;
+    sigfillset(&SIGINT_backgroundChildAction.sa_mask);
+    SIGINT_backgroundChildAction.sa_flags = 0;
+
+    sigaction(SIGINT, &SIGINT_backgroundChildAction, NULL);
+
+    unblockShellSignals();
 }
 
 
 
 /*
 Processes a command that is to be run by bash.
-Input: commandStructure
+Every stage of the command is started right away through spawnCommand, and connected to the next stage
+with a pipe, so all stages run at once. A command without '|' is a pipeline of one stage.
+Foreground commands wait on every stage with waitForChild, and lastExitStatus is taken from the last stage.
+A 'timeout' prefix starts a timer for the command, and a command that runs past it has exit status 124.
+Each stage's rusage and wall time from launch to reap is added to 'stats' and to foregroundUsage.
+Background commands become one job in the job table, and read and write /dev/null where not redirected.
+Each stage's fds come from openRedirects, which handles files, pipe ends and /dev/null for every kind of stage.
+Input: commandStructure (head of the pipeline)
 */
 void otherCommand(struct commandStructure* command) {
-    int outputFile;
-    int inputFile;
-    int outputFileBack;
-    int inputFileBack;
     // Background Process condition.
     // backgroundProcess in commandStructure array is set to 1 for the command.
     // backgroundProcessAllowed global variable is set to 1.
-    if ((backgroundProcessAllowed == 1) && command->backgroundProcess == 1) {
-        int inputDirect;
-        int outputDirect;
-
-        // Start background child process.
-        pid_t childProcessBack = -100;
-        int childExitBack = -100;
-        int backgroundProgram = 0;
-        childProcessBack = fork();
-
-        switch(childProcessBack) {
-            // Errors
-            case -1:
-                printf("Error spawning child. Please try again.");
+    int background = ((backgroundProcessAllowed == 1) && (command->backgroundProcess == 1));
+    pid_t* stagePIDs = arenaAllocate(&commandArena, command->pipelineStages * sizeof(pid_t));
+    char** stageNames = arenaAllocate(&commandArena, command->pipelineStages * sizeof(char*));
+    struct timespec startTime;
+    int lastStageStarted = 0;
+    int previousRead = -1;
+    int stageNumber = 0;
+    struct commandStructure* stage = command;
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    while (stage != NULL) {
+        int pipeEnds[2] = {-1, -1};
+        struct redirectFds redirects;
+
+        // Every stage but the last writes into a new pipe.
+        if (stage->nextStage != NULL) {
+            if (pipe2(pipeEnds, O_CLOEXEC) == -1) {
+                printf("Error creating pipe. Please try again.\n");
                 fflush(stdout);
-                return;
+                break;
+            }
 
-            // Success
-            case 0:
-
-                //Check Input and Output Redirection and close their files if Redirection applies.
-                if ((command->inputRedirect == 1) || (command->outputRedirect == 1)) {
-                    if (command->outputRedirect == 1) {
-                        outputFileBack = open(command->outputFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                        if (outputFileBack == -1) {
-                            printf("Invalid output file '%s'. Please try again.\n", command->outputFileName);
-                            fflush(stdout);
-                            exit(1);
-                        }
-                        int outputRedirection = dup2(outputFileBack, 1);
-                        if (outputRedirection == -1) {
-                            printf("Invalid redirection output. Please try again.\n");
-                            fflush(stdout);
-                            exit(1);
-                        }
-
-                        // close(outputFileBack);
-                    }
-
-                    if (command->inputRedirect == 1) {
-                        inputFileBack = open(command->inputFileName, O_RDONLY);
-                        if (inputFileBack == -1) {
-                            printf("Invalid input file '%s'. Please try again.\n", command->inputFileName);
-                            fflush(stdout);
-                            exit(1);
-                        }
-                        int inputRedirection = dup2(inputFileBack, 0);
-                        if (inputRedirection == -1) {
-                            printf("Invalid redirection input. Please try again.\n");
-                            fflush(stdout);
-                            exit(1);
-                        }
-
-                        // close(inputFileBack);
-                    }
-                }
-
-                // Input and Output to /dev/null if needed.
-                if (command->inputRedirect == 0) {
-                    inputDirect = open("/dev/null/", O_RDONLY);
-                    dup2(inputDirect, 0);
-                }
-
-                if (command->outputRedirect == 0) {
-                    outputDirect = open("dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    dup2(outputDirect, 1);
-                }
-
-                // Run program in background child process.
-                backgroundProgram = execvp(command->command, command->arguments);
-                
-                // Error message and exit if background program is invalid.
-                if (backgroundProgram == -1) {
-                    printf("Invalid background program. Please try again.\n");
-                    fflush(stdout);
-                    exit(1);
-                }
-
-                // Successful end of child background process.
-                close(outputFileBack);
-                close(inputFileBack);
-                exit(0);
+            // Grow the pipe for high-throughput stages if a size was requested with 'pipesize'.
+            if ((pipeBufferSize > 0) && (fcntl(pipeEnds[1], F_SETPIPE_SZ, pipeBufferSize) == -1)) {
+                printf("Could not set pipe size to %d bytes.\n", pipeBufferSize);
+                fflush(stdout);
+            }
         }
 
-        // After the child process is started, whether it succeeds or fails, print out its PID.
-        // Add the child process PID to the global childProcesses array.
-        printf("Background PID: %d\n", childProcessBack);
-        fflush(stdout);
-        childProcesses[indexCounter] = childProcessBack;
-        indexCounter++;
-
-        // Reset indexCounter to go back to 0, looping back to the beginning of the array once 128 is reached.
-        if (indexCounter > 128) {
-            indexCounter = 0;
+        stagePIDs[stageNumber] = -1;
+        stageNames[stageNumber] = stage->command;
+        if (openRedirects(stage, previousRead, pipeEnds[1], background, &redirects) == 0) {
+            stagePIDs[stageNumber] = spawnCommand(stage, redirects.fds, background);
+            closeRedirects(&redirects);
         }
-    }
-    
-    // Foreground Process condition.
-    // backgroundProcess in commandStructure array is set to 0 for the command
-    else {
-        //Start foreground child process.
-        pid_t childProcess = -100;
-        int childExit = -100;
-        int foregroundProgram = 0;
-        childProcess = fork();
-
-        //Wait for child process to finish.
-        waitpid(childProcess, &childExit, 0);
-
-        //Set signal handling for child process foreground.
-        setSignalsForegroundChild();
-
-        switch(childProcess) {
-            // Errors
-            case -1:
-                printf("Error spawning child. Please try again.");
-                fflush(stdout);
-                return;
 
-            // Success
-            case 0:
-
-                //Input and Output Redirection
-                if ((command->inputRedirect == 1) || (command->outputRedirect == 1)) {
-                    if (command->outputRedirect == 1) {
-                        outputFile = open(command->outputFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                        if (outputFile == -1) {
-                            printf("Invalid output file '%s'. Please try again.\n", command->outputFileName);
-                            fflush(stdout);
-                            exit(1);
-                        }
-                        int outputRedirection = dup2(outputFile, 1);
-                        if (outputRedirection == -1) {
-                            printf("Invalid redirection output. Please try again.\n");
-                            fflush(stdout);
-                            exit(1);
-                        }
-
-                        // close(outputFile);
-                    }
-
-                    if (command->inputRedirect == 1) {
-                        inputFile = open(command->inputFileName, O_RDONLY);
-                        if (inputFile == -1) {
-                            printf("Invalid input file '%s'. Please try again.\n", command->inputFileName);
-                            fflush(stdout);
-                            exit(1);
-                        }
-                        int inputRedirection = dup2(inputFile, 0);
-                        if (inputRedirection == -1) {
-                            printf("Invalid redirection input. Please try again.\n");
-                            fflush(stdout);
-                            exit(1);
-                        }
-
-                        // close(inputFile);
-                    }
-                }
-
-                //Run program in foreground child process.
-                foregroundProgram = execvp(command->command, command->arguments);
-                
-                // Error message and exit if background program is invalid.
-                if (foregroundProgram == -1) {
-                    printf("Invalid command. Please try again.\n");
-                    fflush(stdout);
-                    exit(1);
-                }
-
-                // Successful end of child foreground process.
-                close(outputFile);
-                close(inputFile);
-                exit(0);
+        // Shell keeps only the read end of the new pipe, for the next stage.
+        // A stage that failed to start still closes its ends, so its neighbours see end of file.
+        if (previousRead != -1) {
+            close(previousRead);
         }
-
-        // If childExit was unchanged this loop, return.
-        if (childExit == -100) {
-            return;
+        if (pipeEnds[1] != -1) {
+            close(pipeEnds[1]);
         }
+        previousRead = pipeEnds[0];
 
-        // Otherwise, update lastExitStatus.
-        if (WIFEXITED(childExit) != 0) {
-            lastExitStatus = WEXITSTATUS(childExit);
+        if (stage->nextStage == NULL) {
+            lastStageStarted = (stagePIDs[stageNumber] != -1);
         }
+        stageNumber++;
+        stage = stage->nextStage;
+    }
+
+    if (previousRead != -1) {
+        close(previousRead);
+    }
 
-        // Update lastExitStatus with termination signal if one was received.
-        else if (WIFSIGNALED(childExit) != 0) {
-            lastExitStatus = WTERMSIG(childExit);
-            printf(" Terminated, signal %d\n", lastExitStatus);
+    // Background command. Add the stages that started to the job table as one job, and print the last stage's PID.
+    if (background == 1) {
+        int startedStages = 0;
+        int i = 0;
+        for (i; i < stageNumber; i++) {
+            if (stagePIDs[i] != -1) {
+                stagePIDs[startedStages] = stagePIDs[i];
+                stageNames[startedStages] = stageNames[i];
+                startedStages++;
+            }
+        }
+        if (startedStages > 0) {
+            struct jobEntry* job = addJob(command->bashCommand, stagePIDs, stageNames, startedStages);
+            if (pendingTimeoutNanoseconds > 0) {
+                setJobTimeout(job, pendingTimeoutNanoseconds, pendingGraceNanoseconds);
+            }
+            else if (backgroundTimeoutNanoseconds > 0) {
+                setJobTimeout(job, backgroundTimeoutNanoseconds, defaultGraceNanoseconds);
+            }
+        }
+        if (lastStageStarted == 1) {
+            printf("Background PID: %d\n", stagePIDs[stageNumber - 1]);
             fflush(stdout);
         }
-        
-        else {
-            exit(1);
+        return;
+    }
+
+    // Foreground command. Start its timer if it has a timeout, which sets stages it has reaped to -1.
+    struct commandTimeout timeout;
+    if (pendingTimeoutNanoseconds > 0) {
+        startCommandTimeout(&timeout, stagePIDs, stageNumber, NULL, pendingTimeoutNanoseconds, pendingGraceNanoseconds);
+    }
+
+    // Wait for every stage, and keep the last stage's exit.
+    struct rusage stageUsage;
+    int childExit = -100;
+    int stageExit;
+    int i = 0;
+    for (i; i < stageNumber; i++) {
+        if (stagePIDs[i] != -1) {
+            pid_t waitResult;
+            while (((waitResult = waitForChildWithTimers(stagePIDs[i], &stageExit, 0, &stageUsage)) == -1) && (errno == EINTR)) {
+            }
+            if (waitResult != -1) {
+                TRACE_INSTANT(TRACE_EXIT, stagePIDs[i], stageExit, stageNames[i]);
+                recordProcessUsage(stageNames[i], nanosecondsSince(&startTime), &stageUsage);
+                addUsage(&foregroundUsage, &stageUsage);
+            }
+            childExit = stageExit;
+            stagePIDs[i] = -1;
         }
     }
+    if (pendingTimeoutNanoseconds > 0) {
+        stopCommandTimeout(&timeout);
+    }
 
+    // If the last stage never started, report it the same way as a child whose exec failed.
+    if (lastStageStarted == 0) {
+        lastExitStatus = 1;
+    }
+
+    // A command that timed out has exit status 124, however it ended.
+    else if ((pendingTimeoutNanoseconds > 0) && (timeout.timedOut == 1)) {
+        lastExitStatus = 124;
+        printf(" Timed out, signal %d\n", WIFSIGNALED(childExit) ? WTERMSIG(childExit) : SIGTERM);
+        fflush(stdout);
+    }
+
+    // Otherwise, update lastExitStatus.
+    else if (WIFEXITED(childExit) != 0) {
+        lastExitStatus = WEXITSTATUS(childExit);
+    }
+
+    // Update lastExitStatus with termination signal if one was received.
+    else if (WIFSIGNALED(childExit) != 0) {
+        lastExitStatus = WTERMSIG(childExit);
+        foregroundInterrupted = (lastExitStatus == SIGINT);
+        printf(" Terminated, signal %d\n", lastExitStatus);
+        fflush(stdout);
+    }
+
+    // With 'set -e', a failed foreground command ends the shell.
+    if ((exitOnFailure == 1) && (lastExitStatus != 0)) {
+        exitShell(lastExitStatus);
+    }
 }
 
 
 
 /*
-Check if command is to be run by smallshell, and run it if so.
-Otherwise, pass of the command to otherCommand().
-input: commandStructure
+Exits the shell, killing off all children found in the job table first.
 */
-int shellCommand(struct commandStructure* command) {
+void exitShell(int exitStatus) {
+    killAllJobs();
+    exit(exitStatus);
+}
+
+
+
+/*
+Returns 1 if a command name is one of the builtins run by the shell itself, see runShellBuiltin.
+*/
+int isShellBuiltin(char* commandName) {
+    char* builtinNames[] = {"history", "bgtimeout", "bgpolicy", "exit", "set", "jobs", "wait", "fg", "bg", "status", \
+            "pipesize", "parallel", "stats", "trace", "arenastats", "hash", "export", "unset", "spawnengine", "cd", NULL};
+    int i = 0;
+
+    for (i; builtinNames[i] != NULL; i++) {
+        if (strcmp(commandName, builtinNames[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Runs one of the builtins isShellBuiltin knows, with whatever stdin, stdout and stderr the shell has at the time.
+Input: commandStructure
+*/
+void runShellBuiltin(struct commandStructure* command) {
     char directory[2048];
     int directoryErr;
 
-    // Print out the commandStructure data. 
-    // **FOR DEBUGGING PURPOSES ONLY. Left in for reuse if this program is to be revisisted in the future.**
-    // printf("This Command is: %s\n", command->command);
-    // printf("Bash Command is: %s\n", command->bashCommand);
-    // printf("Argument 0 is: %s\n", command->arguments[0]);
-    // printf("Argument 1 is: %s\n", command->arguments[1]);
-    // printf("Argument 2 is: %s\n", command->arguments[2]);
-    // printf("Argument counter is: %d\n", command->argumentCounter);
-    // printf("Input File Name is: %s\n", command->inputFileName);
-    // printf("Output File Name is: %s\n", command->outputFileName);
-    // printf("OutputRedirect is: %d\n", command->outputRedirect);
-    // printf("inputRedirect is: %d\n", command->inputRedirect);
-    // printf("Background is: %d\n", command->backgroundProcess);
+    //history command. Shows the last entries of the history, or searches it.
+    if (strcmp(command->command, "history") == 0) {
+        historyCommand(command);
+        return;
+    }
+
+    //bgtimeout command. Shows or sets the timeout every background command gets.
+    if (strcmp(command->command, "bgtimeout") == 0) {
+        backgroundTimeoutCommand(command);
+        return;
+    }
+
+    //bgpolicy command. Shows or sets the run policy every background command gets.
+    if (strcmp(command->command, "bgpolicy") == 0) {
+        backgroundPolicyCommand(command);
+        return;
+    }
 
     //exit command.
     if (strcmp(command->command, "exit") == 0) {
-        //Kill off all children found in the childProcesses global array.
-        int i = 0;
-        for (i; i < 129; i++) {
-            if (childProcesses[i] != NULL) {
-                kill(childProcesses[i], 15);
-                childProcesses[i] = NULL;
-            }
+        exitShell(0);
+    }
+
+    //set command. 'set -e' exits the shell when a foreground command fails, 'set +e' turns that off.
+    if (strcmp(command->command, "set") == 0) {
+        lastExitStatus = 0;
+        if ((command->argumentCounter == 2) && (strcmp(command->arguments[1], "-e") == 0)) {
+            exitOnFailure = 1;
+        }
+        else if ((command->argumentCounter == 2) && (strcmp(command->arguments[1], "+e") == 0)) {
+            exitOnFailure = 0;
+        }
+        else {
+            printf("Invalid set option. Use set -e or set +e.\n");
+            fflush(stdout);
+            lastExitStatus = 1;
         }
-        exit(0);
+        return;
+    }
+
+    //jobs command.
+    if (strcmp(command->command, "jobs") == 0) {
+        jobsCommand(command);
+        return;
+    }
+
+    //wait command.
+    if (strcmp(command->command, "wait") == 0) {
+        waitCommand(command);
+        return;
+    }
+
+    //fg command.
+    if (strcmp(command->command, "fg") == 0) {
+        fgCommand(command);
+        return;
+    }
+
+    //bg command.
+    if (strcmp(command->command, "bg") == 0) {
+        bgCommand(command);
+        return;
     }
 
     //status command.
     if (strcmp(command->command, "status") == 0) {
         printf("Status exit value: %d\n", lastExitStatus);
-        return(0);
+        return;
+    }
+
+    //pipesize command. Shows or sets the pipe buffer size used between pipeline stages.
+    if (strcmp(command->command, "pipesize") == 0) {
+        lastExitStatus = 0;
+        if (command->argumentCounter == 1) {
+            printf("Pipe buffer size: %d\n", pipeBufferSize);
+            fflush(stdout);
+            return;
+        }
+        int newSize = atoi(command->arguments[1]);
+        if ((command->argumentCounter > 2) || (newSize < 0)) {
+            printf("Invalid pipe size. Please try again.\n");
+            fflush(stdout);
+            lastExitStatus = 1;
+            return;
+        }
+        pipeBufferSize = newSize;
+        return;
+    }
+
+    //parallel command. Runs a command once per argument, at most N at a time.
+    if (strcmp(command->command, "parallel") == 0) {
+        parallelCommand(command);
+        return;
+    }
+
+    //stats command. Shows per-command totals and latency histograms for every finished child.
+    if (strcmp(command->command, "stats") == 0) {
+        statsCommand(command);
+        return;
+    }
+
+    //trace command. Turns event tracing on or off, and writes out the recorded events.
+    if (strcmp(command->command, "trace") == 0) {
+        traceCommand(command);
+        return;
+    }
+
+    //arenastats command. Shows the command arena's high-water mark and bytes recycled.
+    if (strcmp(command->command, "arenastats") == 0) {
+        lastExitStatus = 0;
+        printArenaStats();
+        return;
+    }
+
+    //hash command. Shows, fills or empties the command path cache.
+    if (strcmp(command->command, "hash") == 0) {
+        hashCommand(command);
+        return;
+    }
+
+    //export command. Exports shell variables, or lists the exported ones.
+    if (strcmp(command->command, "export") == 0) {
+        exportCommand(command);
+        return;
+    }
+
+    //unset command. Removes shell variables.
+    if (strcmp(command->command, "unset") == 0) {
+        unsetCommand(command);
+        return;
+    }
+
+    //spawnengine command. Shows spawn latency per engine, or selects the engine used for new children.
+    if (strcmp(command->command, "spawnengine") == 0) {
+        lastExitStatus = 0;
+        if (command->argumentCounter == 1) {
+            printSpawnEngine();
+            return;
+        }
+        if ((command->argumentCounter > 2) || (setSpawnEngine(command->arguments[1]) == -1)) {
+            printf("Invalid spawn engine. Use posix_spawn, fork or zygote.\n");
+            fflush(stdout);
+            lastExitStatus = 1;
+        }
+        return;
     }
 
     //cd command.
     if (strcmp(command->command, "cd") == 0) {
+        lastExitStatus = 0;
         if (command->argumentCounter == 1) {
             // Get home directory and change to it.
-            chdir(getenv("HOME"));
+            char* homeDirectory = getVariable("HOME");
+            if ((homeDirectory == NULL) || (chdir(homeDirectory) != 0)) {
+                printf("Invalid directory change. Please try again.\n");
+                fflush(stdout);
+                lastExitStatus = 1;
+                return;
+            }
             getcwd(directory, sizeof(directory));
         }
 
@@ -380,7 +513,8 @@ int shellCommand(struct commandStructure* command) {
                 //Invalid directory, print error.
                 printf("Invalid directory change. Please try again.\n");
                 fflush(stdout);
-                return(0);
+                lastExitStatus = 1;
+                return;
             }
             getcwd(directory, sizeof(directory));
         }
@@ -389,12 +523,78 @@ int shellCommand(struct commandStructure* command) {
         if (command->argumentCounter > 2) {
             printf("Invalid directory change. Please try again.\n");
             fflush(stdout);
-            return(0);
+            lastExitStatus = 1;
+            return;
         }
+    }
+}
+
+
+
+/*
+Check if command is to be run by smallshell, and run it if so.
+Otherwise, pass of the command to otherCommand().
+input: commandStructure
+*/
+int shellCommand(struct commandStructure* command) {
+    // Print out the commandStructure data. 
+    // **FOR DEBUGGING PURPOSES ONLY. Left in for reuse if this program is to be revisisted in the future.**
+    // printf("This Command is: %s\n", command->command);
+    // printf("Bash Command is: %s\n", command->bashCommand);
+    // printf("Argument 0 is: %s\n", command->arguments[0]);
+    // printf("Argument 1 is: %s\n", command->arguments[1]);
+    // printf("Argument 2 is: %s\n", command->arguments[2]);
+    // printf("Argument counter is: %d\n", command->argumentCounter);
+    // printf("Input File Name is: %s\n", command->inputFileName);
+    // printf("Output File Name is: %s\n", command->outputFileName);
+    // printf("OutputRedirect is: %d\n", command->outputRedirect);
+    // printf("inputRedirect is: %d\n", command->inputRedirect);
+    // printf("Background is: %d\n", command->backgroundProcess);
 
+    //time prefix. Runs the rest of the line, then prints its wall time and the summed rusage of its processes.
+    if ((strcmp(command->command, "time") == 0) && (command->argumentCounter > 1)) {
+        struct timespec startTime;
+        command->arguments++;
+        command->argumentCounter--;
+        command->argumentCapacity--;
+        command->command = command->arguments[0];
+        memset(&foregroundUsage, 0, sizeof(foregroundUsage));
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        shellCommand(command);
+        printCommandTime(nanosecondsSince(&startTime), &foregroundUsage);
+        return(0);
+    }
+
+    //timeout prefix. Runs the rest of the line, and stops it if it runs for too long.
+    if (strcmp(command->command, "timeout") == 0) {
+        timeoutCommand(command);
+        return(0);
+    }
+
+    //run prefix. Runs the rest of the line with a CPU affinity, nice value, I/O priority or limits.
+    if (strcmp(command->command, "run") == 0) {
+        runCommand(command);
+        return(0);
+    }
+
+    //Builtins run by the shell itself. Their redirections are put over the shell's own fds while they run.
+    //A builtin in a pipeline is started by otherCommand like the other stages, in a forked copy of the shell.
+    if ((isShellBuiltin(command->command) == 1) && (command->pipelineStages == 1)) {
+        struct redirectFds redirects;
+        int savedFds[3];
+        if (openRedirects(command, -1, -1, 0, &redirects) == -1) {
+            lastExitStatus = 1;
+            return(0);
+        }
+        applyRedirects(&redirects, savedFds);
+        runShellBuiltin(command);
+        restoreRedirects(savedFds);
+        closeRedirects(&redirects);
+        return(0);
     }
 
-    else {
+    // echo, printf, pwd, true, false, test and cat run inside the shell when they can.
+    if (runFastBuiltin(command) == 0) {
         otherCommand(command);
     }
 
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "smallsh.h"
+
+/*
+Structure for one entry of the command path cache.
+Entries in the same bucket are chained through nextEntry.
+*/
+struct pathCacheEntry {
+    char* commandName;
+    char* commandPath;
+    int hits;
+    struct pathCacheEntry* nextEntry;
+};
+
+/*
+Command path cache globals.
+*/
+// Hash table of command name to absolute path. Bucket count is always a power of 2.
+struct pathCacheEntry** pathCacheBuckets = NULL;
+int pathCacheBucketCount = 0;
+int pathCacheEntryCount = 0;
+// Copy of PATH when the cache was filled. A different PATH empties the cache.
+char* pathCachePATH = NULL;
+
+
+
+/*
+FNV-1a hash of a command name.
+*/
+unsigned int hashCommandName(char* commandName) {
+    unsigned int hash = 2166136261u;
+    while (*commandName != '\0') {
+        hash ^= (unsigned char)*commandName;
+        hash *= 16777619u;
+        commandName++;
+    }
+    return hash;
+}
+
+
+
+/*
+Removes every entry from the command path cache.
+*/
+void clearPathCache() {
+    int i = 0;
+    for (i; i < pathCacheBucketCount; i++) {
+        struct pathCacheEntry* entry = pathCacheBuckets[i];
+        while (entry != NULL) {
+            struct pathCacheEntry* nextEntry = entry->nextEntry;
+            free(entry->commandName);
+            free(entry->commandPath);
+            free(entry);
+            entry = nextEntry;
+        }
+        pathCacheBuckets[i] = NULL;
+    }
+    pathCacheEntryCount = 0;
+}
+
+
+
+/*
+Doubles the bucket count of the command path cache and rehashes every entry.
+*/
+void growPathCache() {
+    int newBucketCount = (pathCacheBucketCount == 0) ? 64 : pathCacheBucketCount * 2;
+    struct pathCacheEntry** newBuckets = calloc(newBucketCount, sizeof(struct pathCacheEntry*));
+    int i = 0;
+
+    for (i; i < pathCacheBucketCount; i++) {
+        struct pathCacheEntry* entry = pathCacheBuckets[i];
+        while (entry != NULL) {
+            struct pathCacheEntry* nextEntry = entry->nextEntry;
+            unsigned int bucket = hashCommandName(entry->commandName) & (newBucketCount - 1);
+            entry->nextEntry = newBuckets[bucket];
+            newBuckets[bucket] = entry;
+            entry = nextEntry;
+        }
+    }
+
+    free(pathCacheBuckets);
+    pathCacheBuckets = newBuckets;
+    pathCacheBucketCount = newBucketCount;
+}
+
+
+
+/*
+Removes one command from the command path cache, if present.
+*/
+void removePathCacheEntry(char* commandName) {
+    if (pathCacheBucketCount == 0) {
+        return;
+    }
+
+    unsigned int bucket = hashCommandName(commandName) & (pathCacheBucketCount - 1);
+    struct pathCacheEntry** link = &pathCacheBuckets[bucket];
+    while (*link != NULL) {
+        if (strcmp((*link)->commandName, commandName) == 0) {
+            struct pathCacheEntry* entry = *link;
+            *link = entry->nextEntry;
+            free(entry->commandName);
+            free(entry->commandPath);
+            free(entry);
+            pathCacheEntryCount--;
+            return;
+        }
+        link = &(*link)->nextEntry;
+    }
+}
+
+
+
+/*
+Walks the directories of PATH for an executable regular file with the given name, like execvp does.
+An empty PATH directory means the current directory.
+Returns a newly allocated path, or NULL if no directory has the command.
+*/
+char* searchPath(char* commandName, char* searchPATH) {
+    size_t nameLength = strlen(commandName);
+    char* directory = searchPATH;
+    struct stat fileInfo;
+
+    while (1) {
+        char* directoryEnd = strchr(directory, ':');
+        size_t directoryLength = (directoryEnd == NULL) ? strlen(directory) : (size_t)(directoryEnd - directory);
+        char* candidate;
+
+        if (directoryLength == 0) {
+            candidate = calloc(nameLength + 3, sizeof(char));
+            sprintf(candidate, "./%s", commandName);
+        }
+        else {
+            candidate = calloc(directoryLength + nameLength + 2, sizeof(char));
+            memcpy(candidate, directory, directoryLength);
+            candidate[directoryLength] = '/';
+            strcpy(&candidate[directoryLength + 1], commandName);
+        }
+
+        if ((stat(candidate, &fileInfo) == 0) && S_ISREG(fileInfo.st_mode) && (access(candidate, X_OK) == 0)) {
+            return candidate;
+        }
+        free(candidate);
+
+        if (directoryEnd == NULL) {
+            return NULL;
+        }
+        directory = directoryEnd + 1;
+    }
+}
+
+
+
+/*
+Finds the program path for a command, using the cache instead of walking PATH when possible.
+Names with a '/' are used as they are. The cache is emptied when PATH has changed since it was filled,
+and an entry is dropped and looked up again when its program is no longer executable.
+Only absolute results are cached, since a path found through an empty PATH directory depends on the cwd.
+Takes input of a command name.
+Returns a path owned by the cache (or the name itself), or NULL if the command was not found.
+*/
+char* lookupCommandPath(char* commandName) {
+    char* currentPATH = getVariable("PATH");
+    if (currentPATH == NULL) {
+        currentPATH = "/bin:/usr/bin";
+    }
+
+    if (strchr(commandName, '/') != NULL) {
+        return commandName;
+    }
+
+    if ((pathCachePATH == NULL) || (strcmp(pathCachePATH, currentPATH) != 0)) {
+        clearPathCache();
+        free(pathCachePATH);
+        pathCachePATH = strdup(currentPATH);
+    }
+
+    if (pathCacheBucketCount > 0) {
+        unsigned int bucket = hashCommandName(commandName) & (pathCacheBucketCount - 1);
+        struct pathCacheEntry* entry = pathCacheBuckets[bucket];
+        while (entry != NULL) {
+            if (strcmp(entry->commandName, commandName) == 0) {
+                if (access(entry->commandPath, X_OK) == 0) {
+                    entry->hits++;
+                    return entry->commandPath;
+                }
+                removePathCacheEntry(commandName);
+                break;
+            }
+            entry = entry->nextEntry;
+        }
+    }
+
+    char* commandPath = searchPath(commandName, currentPATH);
+    if (commandPath == NULL) {
+        return NULL;
+    }
+
+    // Relative results are not cached. Keep them in the spare entry so the caller does not have to free it.
+    if (commandPath[0] != '/') {
+        static char* relativePath = NULL;
+        free(relativePath);
+        relativePath = commandPath;
+        return relativePath;
+    }
+
+    if ((pathCacheEntryCount + 1) * 4 > pathCacheBucketCount * 3) {
+        growPathCache();
+    }
+
+    struct pathCacheEntry* newEntry = malloc(sizeof(struct pathCacheEntry));
+    unsigned int bucket = hashCommandName(commandName) & (pathCacheBucketCount - 1);
+    newEntry->commandName = strdup(commandName);
+    newEntry->commandPath = commandPath;
+    newEntry->hits = 1;
+    newEntry->nextEntry = pathCacheBuckets[bucket];
+    pathCacheBuckets[bucket] = newEntry;
+    pathCacheEntryCount++;
+
+    return commandPath;
+}
+
+
+
+/*
+Runs the 'hash' command.
+hash           prints every cached command with its hit count and path.
+hash -r        empties the cache.
+hash name ...  looks up each name and adds it to the cache.
+Input: commandStructure
+*/
+void hashCommand(struct commandStructure* command) {
+    int i = 1;
+
+    lastExitStatus = 0;
+    if (command->argumentCounter == 1) {
+        if (pathCacheEntryCount == 0) {
+            printf("hash: hash table empty\n");
+        }
+        else {
+            printf("hits\tcommand\n");
+            int bucket = 0;
+            for (bucket; bucket < pathCacheBucketCount; bucket++) {
+                struct pathCacheEntry* entry = pathCacheBuckets[bucket];
+                while (entry != NULL) {
+                    printf("%4d\t%s\n", entry->hits, entry->commandPath);
+                    entry = entry->nextEntry;
+                }
+            }
+        }
+        fflush(stdout);
+        return;
+    }
+
+    if ((command->argumentCounter == 2) && (strcmp(command->arguments[1], "-r") == 0)) {
+        clearPathCache();
+        return;
+    }
+
+    for (i; i < command->argumentCounter; i++) {
+        if (lookupCommandPath(command->arguments[i]) == NULL) {
+            printf("hash: %s: not found\n", command->arguments[i]);
+            fflush(stdout);
+            lastExitStatus = 1;
+        }
+    }
+}
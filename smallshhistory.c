@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "smallsh.h"
+
+// Entries shown by 'history' when no count is given.
+#define HISTORY_DEFAULT_SHOWN 20
+// Gram keys. A trigram is its 3 bytes under HISTORY_TRIGRAM_KEY. A prefix of 1 to 3 bytes has its length
+// in the top byte as well, so the first bytes of an entry are their own keys, and no key is ever 0.
+#define HISTORY_TRIGRAM_KEY 0x01000000u
+#define HISTORY_PREFIX_KEY(length) ((unsigned int)((length) + 1) << 24)
+
+/*
+Structure for one gram of the history index, with the numbers of the entries that contain it, oldest first.
+*/
+struct historyGram {
+    unsigned int key;
+    unsigned int entryCount;
+    unsigned int entryCapacity;
+    unsigned int* entries;
+};
+
+/*
+History globals.
+The file is one entry per line, and is only ever appended to, by every shell using it. Nothing is read at startup.
+The first lookup maps the file and splits it into entries, and the first search builds the gram index.
+Both are brought up to date from where they stopped, so lines added since cost only their own length.
+*/
+char* historyFileName = NULL;
+int historyFileChecked = 0;
+int historyAppendFd = -1;
+int historyReadFd = -1;
+char* historyMap = NULL;
+size_t historyMapSize = 0;
+// Start of each entry in the file. Entry n, counting from 1, starts at historyOffsets[n - 1].
+size_t* historyOffsets = NULL;
+unsigned int historyEntryCount = 0;
+unsigned int historyOffsetCapacity = 0;
+// Bytes of the file split into entries so far, which always ends after a newline.
+size_t historyIndexedBytes = 0;
+// Open addressing table of grams. Capacity is always a power of 2.
+struct historyGram* historyGrams = NULL;
+unsigned int historyGramCapacity = 0;
+unsigned int historyGramCount = 0;
+// Entries added to the gram index so far.
+unsigned int historyGramEntries = 0;
+
+
+
+/*
+Returns the history file name: SMALLSH_HISTFILE, or ~/.smallsh_history. An empty SMALLSH_HISTFILE turns
+history off, and NULL is returned.
+*/
+char* historyPath() {
+    if (historyFileChecked == 0) {
+        char* fileName = getenv("SMALLSH_HISTFILE");
+        historyFileChecked = 1;
+        if (fileName != NULL) {
+            historyFileName = (fileName[0] != '\0') ? strdup(fileName) : NULL;
+        }
+        else if (getenv("HOME") != NULL) {
+            historyFileName = malloc(strlen(getenv("HOME")) + 17);
+            sprintf(historyFileName, "%s/.smallsh_history", getenv("HOME"));
+        }
+    }
+    return historyFileName;
+}
+
+
+
+/*
+Appends a command line to the history file. Blank lines and comments are left out.
+The entry is written with one write to an O_APPEND fd, so shells sharing the file never split each other's lines.
+Takes input of the line, which may end in a newline.
+*/
+void recordHistory(char* line, size_t lineLength) {
+    size_t start = 0;
+
+    while ((lineLength > 0) && ((line[lineLength - 1] == '\n') || (line[lineLength - 1] == '\r'))) {
+        lineLength--;
+    }
+    while ((start < lineLength) && isspace((unsigned char)line[start])) {
+        start++;
+    }
+    if ((start == lineLength) || (line[start] == '#') || (historyPath() == NULL)) {
+        return;
+    }
+
+    if (historyAppendFd == -1) {
+        historyAppendFd = open(historyFileName, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (historyAppendFd == -1) {
+            return;
+        }
+    }
+    char* entry = malloc(lineLength + 1);
+    memcpy(entry, line, lineLength);
+    entry[lineLength] = '\n';
+    write(historyAppendFd, entry, lineLength + 1);
+    free(entry);
+}
+
+
+
+/*
+Forgets the map and both indexes, for a history file that has been replaced or cut short.
+*/
+void resetHistoryIndex() {
+    unsigned int i = 0;
+
+    if (historyMap != NULL) {
+        munmap(historyMap, historyMapSize);
+    }
+    historyMap = NULL;
+    historyMapSize = 0;
+    historyEntryCount = 0;
+    historyIndexedBytes = 0;
+    for (i; i < historyGramCapacity; i++) {
+        free(historyGrams[i].entries);
+    }
+    free(historyGrams);
+    historyGrams = NULL;
+    historyGramCapacity = 0;
+    historyGramCount = 0;
+    historyGramEntries = 0;
+}
+
+
+
+/*
+Maps whatever has been appended to the history file since the last call, by this shell or another one,
+and adds its complete lines to the entry index.
+Returns the number of entries, or -1 if there is no history file.
+*/
+int syncHistory() {
+    struct stat fileStatus;
+
+    if (historyPath() == NULL) {
+        return -1;
+    }
+    if (historyReadFd == -1) {
+        historyReadFd = open(historyFileName, O_RDONLY | O_CLOEXEC);
+        if (historyReadFd == -1) {
+            return -1;
+        }
+    }
+    if (fstat(historyReadFd, &fileStatus) == -1) {
+        return -1;
+    }
+    if ((size_t)fileStatus.st_size < historyIndexedBytes) {
+        resetHistoryIndex();
+    }
+    if ((size_t)fileStatus.st_size == historyMapSize) {
+        return historyEntryCount;
+    }
+
+    char* newMap;
+    if (historyMap == NULL) {
+        newMap = mmap(NULL, fileStatus.st_size, PROT_READ, MAP_SHARED, historyReadFd, 0);
+    }
+    else {
+        newMap = mremap(historyMap, historyMapSize, fileStatus.st_size, MREMAP_MAYMOVE);
+    }
+    if (newMap == MAP_FAILED) {
+        return historyEntryCount;
+    }
+    historyMap = newMap;
+    historyMapSize = fileStatus.st_size;
+
+    // A line still being written has no newline yet, and waits for the next call.
+    char* lineEnd;
+    while ((lineEnd = memchr(&historyMap[historyIndexedBytes], '\n', historyMapSize - historyIndexedBytes)) != NULL) {
+        if (historyEntryCount == historyOffsetCapacity) {
+            historyOffsetCapacity = (historyOffsetCapacity == 0) ? 1024 : historyOffsetCapacity * 2;
+            historyOffsets = realloc(historyOffsets, historyOffsetCapacity * sizeof(size_t));
+        }
+        historyOffsets[historyEntryCount] = historyIndexedBytes;
+        historyEntryCount++;
+        historyIndexedBytes = lineEnd - historyMap + 1;
+    }
+    return historyEntryCount;
+}
+
+
+
+/*
+Returns entry number entryNumber, counting from 1, and sets entryLength to its length without the newline.
+The entry points into the map, and is only valid until the next syncHistory.
+*/
+char* historyEntry(unsigned int entryNumber, size_t* entryLength) {
+    size_t entryStart = historyOffsets[entryNumber - 1];
+    size_t entryEnd = (entryNumber < historyEntryCount) ? historyOffsets[entryNumber] : historyIndexedBytes;
+
+    *entryLength = entryEnd - entryStart - 1;
+    return &historyMap[entryStart];
+}
+
+
+
+/*
+Returns the gram for key, or the empty slot where it would go.
+*/
+struct historyGram* findHistoryGram(unsigned int key) {
+    unsigned int slot = key * 2654435761u;
+
+    // The low bits of the product only depend on the low bits of the key, so the high bits are folded in.
+    slot = (slot ^ (slot >> 16)) & (historyGramCapacity - 1);
+
+    while ((historyGrams[slot].key != 0) && (historyGrams[slot].key != key)) {
+        slot = (slot + 1) & (historyGramCapacity - 1);
+    }
+    return &historyGrams[slot];
+}
+
+
+
+/*
+Adds an entry to the list of one gram. An entry containing the same gram twice is only listed once.
+*/
+void addHistoryGram(unsigned int key, unsigned int entryNumber) {
+    // Keep the table at most half full, so probes stay short.
+    if (historyGramCount * 2 >= historyGramCapacity) {
+        struct historyGram* oldGrams = historyGrams;
+        unsigned int oldCapacity = historyGramCapacity;
+        unsigned int i = 0;
+
+        historyGramCapacity = (oldCapacity == 0) ? 4096 : oldCapacity * 2;
+        historyGrams = calloc(historyGramCapacity, sizeof(struct historyGram));
+        for (i; i < oldCapacity; i++) {
+            if (oldGrams[i].key != 0) {
+                *findHistoryGram(oldGrams[i].key) = oldGrams[i];
+            }
+        }
+        free(oldGrams);
+    }
+
+    struct historyGram* gram = findHistoryGram(key);
+    if (gram->key == 0) {
+        gram->key = key;
+        historyGramCount++;
+    }
+    if ((gram->entryCount > 0) && (gram->entries[gram->entryCount - 1] == entryNumber)) {
+        return;
+    }
+    if (gram->entryCount == gram->entryCapacity) {
+        gram->entryCapacity = (gram->entryCapacity == 0) ? 4 : gram->entryCapacity * 2;
+        gram->entries = realloc(gram->entries, gram->entryCapacity * sizeof(unsigned int));
+    }
+    gram->entries[gram->entryCount] = entryNumber;
+    gram->entryCount++;
+}
+
+
+
+/*
+Adds every entry not yet in the gram index: its first 1, 2 and 3 bytes as prefix keys, and each of its trigrams.
+*/
+void indexHistoryGrams() {
+    while (historyGramEntries < historyEntryCount) {
+        size_t entryLength;
+        unsigned int entryNumber = historyGramEntries + 1;
+        unsigned char* entry = (unsigned char*)historyEntry(entryNumber, &entryLength);
+        unsigned int prefix = 0;
+        size_t i = 0;
+
+        for (i; (i < entryLength) && (i < 3); i++) {
+            prefix = (prefix << 8) | entry[i];
+            addHistoryGram(HISTORY_PREFIX_KEY(i + 1) | prefix, entryNumber);
+        }
+        for (i = 0; i + 2 < entryLength; i++) {
+            addHistoryGram(HISTORY_TRIGRAM_KEY | (entry[i] << 16) | (entry[i + 1] << 8) | entry[i + 2], entryNumber);
+        }
+        historyGramEntries++;
+    }
+}
+
+
+
+/*
+Checks one entry against the text being looked for.
+Returns 1 if it starts with text (prefixOnly 1) or contains it (prefixOnly 0), 0 otherwise.
+*/
+int historyEntryMatches(unsigned int entryNumber, char* text, size_t textLength, int prefixOnly) {
+    size_t entryLength;
+    char* entry = historyEntry(entryNumber, &entryLength);
+
+    if (prefixOnly == 1) {
+        return ((entryLength >= textLength) && (memcmp(entry, text, textLength) == 0));
+    }
+    return (memmem(entry, entryLength, text, textLength) != NULL);
+}
+
+
+
+/*
+Finds the newest entry before entry number 'before' that starts with text (prefixOnly 1) or contains it
+(prefixOnly 0). Pass 0 for before to search from the newest entry, and the last match to find the one before it.
+Candidates come from the gram index: the entries with the rarest of text's trigrams, or its prefix key if rarer.
+Only text shorter than a trigram is found by reading the entries one by one, newest first.
+Returns the entry number, or 0 if there is none.
+*/
+unsigned int searchHistory(char* text, size_t textLength, unsigned int before, int prefixOnly) {
+    if (syncHistory() <= 0) {
+        return 0;
+    }
+    if ((before == 0) || (before > historyEntryCount + 1)) {
+        before = historyEntryCount + 1;
+    }
+    if (textLength == 0) {
+        return before - 1;
+    }
+
+    if ((prefixOnly == 0) && (textLength < 3)) {
+        unsigned int entryNumber = before - 1;
+        for (entryNumber; entryNumber > 0; entryNumber--) {
+            if (historyEntryMatches(entryNumber, text, textLength, 0) == 1) {
+                return entryNumber;
+            }
+        }
+        return 0;
+    }
+
+    indexHistoryGrams();
+    if (historyGramCapacity == 0) {
+        return 0;
+    }
+    unsigned char* bytes = (unsigned char*)text;
+    struct historyGram* candidates = NULL;
+    size_t i = 0;
+    if (prefixOnly == 1) {
+        size_t keyLength = (textLength < 3) ? textLength : 3;
+        unsigned int prefix = 0;
+        for (i; i < keyLength; i++) {
+            prefix = (prefix << 8) | bytes[i];
+        }
+        candidates = findHistoryGram(HISTORY_PREFIX_KEY(keyLength) | prefix);
+    }
+    // Any trigram of the text can stand in for the prefix key, when fewer entries have it.
+    for (i = 0; i + 2 < textLength; i++) {
+        struct historyGram* gram = findHistoryGram(HISTORY_TRIGRAM_KEY | (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2]);
+        if ((candidates == NULL) || (gram->entryCount < candidates->entryCount)) {
+            candidates = gram;
+        }
+    }
+
+    // Find the first candidate at or after 'before', then check the ones older than it, newest first.
+    unsigned int low = 0;
+    unsigned int high = candidates->entryCount;
+    while (low < high) {
+        unsigned int middle = low + (high - low) / 2;
+        if (candidates->entries[middle] < before) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    while (low > 0) {
+        low--;
+        if (historyEntryMatches(candidates->entries[low], text, textLength, prefixOnly) == 1) {
+            return candidates->entries[low];
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Expands a history reference at the start of a line, like bash:
+!!          the last entry
+!n          entry n
+!-n         the nth entry back
+!prefix     the newest entry starting with prefix
+The reference is replaced by the entry, and the rest of the line is kept after it. The new line is echoed.
+Lines that do not start with '!' are returned as they are.
+Takes input of the line, which ends in a newline.
+Returns the line to run, in commandArena, or NULL if the entry does not exist (message printed).
+*/
+char* expandHistory(char* inputCommand) {
+    char* reference = inputCommand;
+    unsigned int entryNumber = 0;
+
+    while ((*reference == ' ') || (*reference == '\t')) {
+        reference++;
+    }
+    if ((reference[0] != '!') || isspace((unsigned char)reference[1]) || (reference[1] == '=') || (reference[1] == '\0')) {
+        return inputCommand;
+    }
+
+    char* referenceEnd = reference + 1;
+    while ((*referenceEnd != '\0') && !isspace((unsigned char)*referenceEnd)) {
+        referenceEnd++;
+    }
+    int entryCount = syncHistory();
+    if (entryCount > 0) {
+        char* numberEnd;
+        long number = strtol(reference + 1, &numberEnd, 10);
+        if ((reference[1] == '!') && (referenceEnd == reference + 2)) {
+            entryNumber = entryCount;
+        }
+        else if ((numberEnd == referenceEnd) && (number < 0) && (-number <= entryCount)) {
+            entryNumber = entryCount + 1 + number;
+        }
+        else if ((numberEnd == referenceEnd) && (number > 0) && (number <= entryCount)) {
+            entryNumber = number;
+        }
+        else if ((numberEnd != referenceEnd) && (isdigit((unsigned char)reference[1]) == 0) && (reference[1] != '-')) {
+            entryNumber = searchHistory(reference + 1, referenceEnd - reference - 1, 0, 1);
+        }
+    }
+    if (entryNumber == 0) {
+        printf("smallsh: %.*s: event not found\n", (int)(referenceEnd - reference), reference);
+        fflush(stdout);
+        return NULL;
+    }
+
+    size_t entryLength;
+    char* entry = historyEntry(entryNumber, &entryLength);
+    size_t restLength = strlen(referenceEnd);
+    char* expandedCommand = arenaAllocate(&commandArena, entryLength + restLength + 1);
+    memcpy(expandedCommand, entry, entryLength);
+    memcpy(&expandedCommand[entryLength], referenceEnd, restLength + 1);
+    printf("%s", expandedCommand);
+    fflush(stdout);
+    return expandedCommand;
+}
+
+
+
+/*
+Prints one entry with its number.
+*/
+void printHistoryEntry(unsigned int entryNumber) {
+    size_t entryLength;
+    char* entry = historyEntry(entryNumber, &entryLength);
+
+    printf("%6u  %.*s\n", entryNumber, (int)entryLength, entry);
+}
+
+
+
+/*
+Runs the 'history' command.
+history              shows the last 20 entries.
+history n            shows the last n entries.
+history -s text [n]  shows the last n entries (default 20) containing text, oldest first.
+Entries are numbered from the start of the file, for '!n'.
+Input: commandStructure
+*/
+void historyCommand(struct commandStructure* command) {
+    unsigned int shown = HISTORY_DEFAULT_SHOWN;
+    int searching = ((command->argumentCounter > 2) && (strcmp(command->arguments[1], "-s") == 0));
+    int countIndex = (searching == 1) ? 3 : 1;
+
+    lastExitStatus = 0;
+    if (command->argumentCounter > countIndex + 1) {
+        printf("Invalid history command. Use history [n], or history -s text [n]\n");
+        fflush(stdout);
+        lastExitStatus = 1;
+        return;
+    }
+    if (command->argumentCounter == countIndex + 1) {
+        char* numberEnd;
+        long number = strtol(command->arguments[countIndex], &numberEnd, 10);
+        if ((numberEnd == command->arguments[countIndex]) || (*numberEnd != '\0') || (number < 1)) {
+            printf("Invalid history count '%s'. Please try again.\n", command->arguments[countIndex]);
+            fflush(stdout);
+            lastExitStatus = 1;
+            return;
+        }
+        shown = (number > 0x7fffffffL) ? 0x7fffffffu : (unsigned int)number;
+    }
+
+    int entryCount = syncHistory();
+    if (entryCount <= 0) {
+        fflush(stdout);
+        return;
+    }
+    unsigned int availableCount = (unsigned int)entryCount;
+    if (shown > availableCount) {
+        shown = availableCount;
+    }
+
+    if (searching == 0) {
+        unsigned int entryNumber = availableCount - shown + 1;
+        for (entryNumber; entryNumber <= availableCount; entryNumber++) {
+            printHistoryEntry(entryNumber);
+        }
+    }
+    else {
+        // Matches are found newest first, and printed the other way round.
+        char* text = command->arguments[2];
+        unsigned int* matches = malloc(shown * sizeof(unsigned int));
+        unsigned int matchCount = 0;
+        unsigned int entryNumber = 0;
+        while ((matchCount < shown) && ((entryNumber = searchHistory(text, strlen(text), entryNumber, 0)) != 0)) {
+            matches[matchCount] = entryNumber;
+            matchCount++;
+        }
+        while (matchCount > 0) {
+            matchCount--;
+            printHistoryEntry(matches[matchCount]);
+        }
+        free(matches);
+    }
+    fflush(stdout);
+}
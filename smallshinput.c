@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "smallsh.h"
+
+// Size of each read() from the input, and the starting size of the line buffer.
+#define INPUT_BLOCK_SIZE 65536
+
+/*
+Structure for reading command lines from a file descriptor in large blocks.
+buffer holds bytes start..end that have been read but not yet returned as lines.
+A reader made from a string (smallsh -c) has fd -1 and all of its input already in the buffer.
+*/
+struct inputReader {
+    int fd;
+    char* buffer;
+    size_t bufferSize;
+    size_t start;
+    size_t end;
+    int endOfInput;
+    // Totals for the throughput report.
+    long long linesRead;
+    long long bytesRead;
+};
+
+
+
+/*
+Sets up a reader for a file descriptor.
+*/
+void initializeInputReader(struct inputReader* reader, int fd) {
+    reader->fd = fd;
+    reader->bufferSize = INPUT_BLOCK_SIZE;
+    reader->buffer = malloc(reader->bufferSize);
+    reader->start = 0;
+    reader->end = 0;
+    reader->endOfInput = 0;
+    reader->linesRead = 0;
+    reader->bytesRead = 0;
+}
+
+
+
+/*
+Sets up a reader for a string of commands, one per line.
+*/
+void initializeStringReader(struct inputReader* reader, char* commands) {
+    size_t commandsLength = strlen(commands);
+
+    reader->fd = -1;
+    reader->bufferSize = commandsLength + 1;
+    reader->buffer = malloc(reader->bufferSize);
+    memcpy(reader->buffer, commands, commandsLength);
+    reader->start = 0;
+    reader->end = commandsLength;
+    reader->endOfInput = 1;
+    reader->linesRead = 0;
+    reader->bytesRead = commandsLength;
+}
+
+
+
+/*
+Returns 1 if a whole line is already in the reader's buffer, so reading it will not block.
+*/
+int inputLineBuffered(struct inputReader* reader) {
+    if (reader->start == reader->end) {
+        return reader->endOfInput;
+    }
+    return (memchr(&reader->buffer[reader->start], '\n', reader->end - reader->start) != NULL) || reader->endOfInput;
+}
+
+
+
+/*
+Returns the next line of input, including its newline, and sets lineLength to its length.
+A last line without a newline is still returned, without one.
+Reads another block only when the buffer has no complete line left, and grows the buffer when a line
+is longer than it. The line points into the reader's buffer and is only valid until the next call.
+Returns NULL at the end of input.
+*/
+char* readInputLine(struct inputReader* reader, size_t* lineLength) {
+    size_t searchFrom = reader->start;
+
+    while (1) {
+        char* newline = memchr(&reader->buffer[searchFrom], '\n', reader->end - searchFrom);
+        if (newline != NULL) {
+            char* line = &reader->buffer[reader->start];
+            *lineLength = newline - line + 1;
+            reader->start += *lineLength;
+            reader->linesRead++;
+            return line;
+        }
+
+        if (reader->endOfInput == 1) {
+            if (reader->start == reader->end) {
+                return NULL;
+            }
+            char* line = &reader->buffer[reader->start];
+            *lineLength = reader->end - reader->start;
+            reader->start = reader->end;
+            reader->linesRead++;
+            return line;
+        }
+
+        // Move the partial line to the front, and make room for another block.
+        searchFrom = reader->end - reader->start;
+        memmove(reader->buffer, &reader->buffer[reader->start], searchFrom);
+        reader->end = searchFrom;
+        reader->start = 0;
+        if (reader->bufferSize - reader->end < INPUT_BLOCK_SIZE) {
+            reader->bufferSize *= 2;
+            reader->buffer = realloc(reader->buffer, reader->bufferSize);
+        }
+
+        ssize_t bytesRead = read(reader->fd, &reader->buffer[reader->end], reader->bufferSize - reader->end);
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            reader->endOfInput = 1;
+            continue;
+        }
+        if (bytesRead == 0) {
+            reader->endOfInput = 1;
+            continue;
+        }
+        reader->end += bytesRead;
+        reader->bytesRead += bytesRead;
+    }
+}
@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "smallsh.h"
+
+/*
+Job states.
+*/
+#define JOB_RUNNING 0
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+
+/*
+Structure for one background job: every process started for one command line.
+*/
+struct jobEntry {
+    int jobId;
+    pid_t* processIDs;
+    // Command name of each process, for 'stats'.
+    char** processNames;
+    int processCount;
+    int runningCount;
+    // PID of the last stage. Its exit is the job's exit.
+    pid_t lastProcessID;
+    int lastProcessExit;
+    char* commandText;
+    struct timespec startTime;
+    int state;
+    // Timeout from 'timeout' or 'bgtimeout', or NULL.
+    struct commandTimeout* timeout;
+};
+
+/*
+Job table globals.
+*/
+// Jobs by job ID. Slot 0 is unused. Grows by doubling.
+struct jobEntry** jobSlots = NULL;
+int jobSlotCount = 0;
+// Highest job ID in use. New jobs get the next one, and it drops back as the highest jobs finish.
+int highestJobId = 0;
+int jobCount = 0;
+// Open-addressed hash table of PID to job, for every process still running or stopped.
+// Capacity is always a power of 2, and kept at most half full.
+pid_t* processTableKeys = NULL;
+struct jobEntry** processTableJobs = NULL;
+int processTableCapacity = 0;
+int processTableCount = 0;
+
+
+
+/*
+Returns the home slot of a PID in the process table.
+*/
+int processTableSlot(pid_t processID) {
+    return (int)(((unsigned int)processID * 2654435761u) & (processTableCapacity - 1));
+}
+
+
+
+/*
+Puts a PID into the process table, without growing it.
+*/
+void insertProcessSlot(pid_t processID, struct jobEntry* job) {
+    int slot = processTableSlot(processID);
+    while (processTableKeys[slot] != 0) {
+        slot = (slot + 1) & (processTableCapacity - 1);
+    }
+    processTableKeys[slot] = processID;
+    processTableJobs[slot] = job;
+}
+
+
+
+/*
+Adds a PID to the process table, doubling the table first if it would become more than half full.
+*/
+void addProcessToTable(pid_t processID, struct jobEntry* job) {
+    if ((processTableCount + 1) * 2 > processTableCapacity) {
+        pid_t* oldKeys = processTableKeys;
+        struct jobEntry** oldJobs = processTableJobs;
+        int oldCapacity = processTableCapacity;
+        int i = 0;
+
+        processTableCapacity = (oldCapacity == 0) ? 256 : oldCapacity * 2;
+        processTableKeys = calloc(processTableCapacity, sizeof(pid_t));
+        processTableJobs = calloc(processTableCapacity, sizeof(struct jobEntry*));
+        for (i; i < oldCapacity; i++) {
+            if (oldKeys[i] != 0) {
+                insertProcessSlot(oldKeys[i], oldJobs[i]);
+            }
+        }
+        free(oldKeys);
+        free(oldJobs);
+    }
+
+    insertProcessSlot(processID, job);
+    processTableCount++;
+}
+
+
+
+/*
+Finds the job a PID belongs to.
+Returns the job, or NULL if the PID is not a tracked background process.
+*/
+struct jobEntry* findJobByProcess(pid_t processID) {
+    if (processTableCapacity == 0) {
+        return NULL;
+    }
+
+    int slot = processTableSlot(processID);
+    while (processTableKeys[slot] != 0) {
+        if (processTableKeys[slot] == processID) {
+            return processTableJobs[slot];
+        }
+        slot = (slot + 1) & (processTableCapacity - 1);
+    }
+    return NULL;
+}
+
+
+
+/*
+Takes a PID out of the process table.
+Later entries of the same probe run are shifted back into the gap, so no tombstones are needed.
+*/
+void removeProcessFromTable(pid_t processID) {
+    if (processTableCapacity == 0) {
+        return;
+    }
+
+    int slot = processTableSlot(processID);
+    while (processTableKeys[slot] != processID) {
+        if (processTableKeys[slot] == 0) {
+            return;
+        }
+        slot = (slot + 1) & (processTableCapacity - 1);
+    }
+
+    int gap = slot;
+    processTableKeys[gap] = 0;
+    processTableCount--;
+
+    slot = (gap + 1) & (processTableCapacity - 1);
+    while (processTableKeys[slot] != 0) {
+        int home = processTableSlot(processTableKeys[slot]);
+        // Move the entry into the gap if its home slot is not between the gap and where it is now.
+        if (((slot > gap) && ((home <= gap) || (home > slot))) || ((slot < gap) && ((home <= gap) && (home > slot)))) {
+            processTableKeys[gap] = processTableKeys[slot];
+            processTableJobs[gap] = processTableJobs[slot];
+            processTableKeys[slot] = 0;
+            gap = slot;
+        }
+        slot = (slot + 1) & (processTableCapacity - 1);
+    }
+}
+
+
+
+/*
+Adds a background job for the processes started for one command line.
+Takes input of the command line text, and the PIDs and command names of the stages that were started.
+Returns the new job.
+*/
+struct jobEntry* addJob(char* commandText, pid_t* processIDs, char** processNames, int processCount) {
+    struct jobEntry* job = malloc(sizeof(struct jobEntry));
+    int i = 0;
+
+    job->processIDs = malloc(processCount * sizeof(pid_t));
+    memcpy(job->processIDs, processIDs, processCount * sizeof(pid_t));
+    job->processNames = malloc(processCount * sizeof(char*));
+    for (i; i < processCount; i++) {
+        job->processNames[i] = strdup(processNames[i]);
+    }
+    job->processCount = processCount;
+    job->runningCount = processCount;
+    job->lastProcessID = processIDs[processCount - 1];
+    job->lastProcessExit = 0;
+    job->state = JOB_RUNNING;
+    job->timeout = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &job->startTime);
+
+    // Keep the command line without its trailing newline or spaces.
+    job->commandText = strdup(commandText);
+    size_t textLength = strlen(job->commandText);
+    while ((textLength > 0) && ((job->commandText[textLength - 1] == '\n') || (job->commandText[textLength - 1] == ' '))) {
+        textLength--;
+    }
+    job->commandText[textLength] = '\0';
+
+    highestJobId++;
+    job->jobId = highestJobId;
+    if (highestJobId >= jobSlotCount) {
+        int newSlotCount = (jobSlotCount == 0) ? 64 : jobSlotCount * 2;
+        jobSlots = realloc(jobSlots, newSlotCount * sizeof(struct jobEntry*));
+        memset(&jobSlots[jobSlotCount], 0, (newSlotCount - jobSlotCount) * sizeof(struct jobEntry*));
+        jobSlotCount = newSlotCount;
+    }
+    jobSlots[job->jobId] = job;
+    jobCount++;
+
+    for (i = 0; i < processCount; i++) {
+        addProcessToTable(processIDs[i], job);
+    }
+
+    return job;
+}
+
+
+
+/*
+Finds a job by its job ID.
+Returns the job, or NULL if no job has that ID.
+*/
+struct jobEntry* findJobById(int jobId) {
+    if ((jobId < 1) || (jobId > highestJobId)) {
+        return NULL;
+    }
+    return jobSlots[jobId];
+}
+
+
+
+/*
+Gives a job a timeout, from a 'timeout' prefix or the 'bgtimeout' default.
+*/
+void setJobTimeout(struct jobEntry* job, long long timeoutNanoseconds, long long graceNanoseconds) {
+    job->timeout = malloc(sizeof(struct commandTimeout));
+    startCommandTimeout(job->timeout, job->processIDs, job->processCount, job, timeoutNanoseconds, graceNanoseconds);
+}
+
+
+
+/*
+Removes a job from the table and frees it. Any of its PIDs still in the process table are taken out,
+and its timeout is stopped.
+*/
+void removeJob(struct jobEntry* job) {
+    int i = 0;
+
+    if (job->timeout != NULL) {
+        stopCommandTimeout(job->timeout);
+        free(job->timeout);
+    }
+    for (i; i < job->processCount; i++) {
+        if (findJobByProcess(job->processIDs[i]) == job) {
+            removeProcessFromTable(job->processIDs[i]);
+        }
+    }
+
+    jobSlots[job->jobId] = NULL;
+    jobCount--;
+    while ((highestJobId > 0) && (jobSlots[highestJobId] == NULL)) {
+        highestJobId--;
+    }
+
+    for (i = 0; i < job->processCount; i++) {
+        free(job->processNames[i]);
+    }
+    free(job->processNames);
+    free(job->processIDs);
+    free(job->commandText);
+    free(job);
+}
+
+
+
+/*
+Records a wait status and rusage from waitForChild for one process of a job.
+Stopped and continued processes change the job's state. An exited process is taken out of the process table,
+its usage is added to 'stats' under its command name, a reap event is traced, and the shell's usual background message is printed for it.
+Returns 1 if every process of the job has now exited, so the caller can read lastProcessExit and remove it.
+A job that timed out says so when its last process exits.
+*/
+int updateJobProcess(struct jobEntry* job, pid_t processID, int childExit, struct rusage* usage) {
+    int i = 0;
+
+
+    if (WIFSTOPPED(childExit)) {
+        job->state = JOB_STOPPED;
+        return 0;
+    }
+
+    if (WIFCONTINUED(childExit)) {
+        job->state = JOB_RUNNING;
+        return 0;
+    }
+
+    if (WIFEXITED(childExit) != 0) {
+        printf("Background child process %d finished. Status value: %d.\n"\
+                , processID, childExit);
+    }
+
+    else if (WIFSIGNALED(childExit)) {
+        printf("Background child process %d terminated due to signal %d.\n"\
+                , processID, childExit);
+    }
+    fflush(stdout);
+
+    for (i; i < job->processCount; i++) {
+        if (job->processIDs[i] == processID) {
+            TRACE_INSTANT(TRACE_REAP, processID, childExit, job->processNames[i]);
+            recordProcessUsage(job->processNames[i], nanosecondsSince(&job->startTime), usage);
+            break;
+        }
+    }
+
+    removeProcessFromTable(processID);
+    if (processID == job->lastProcessID) {
+        job->lastProcessExit = childExit;
+    }
+    job->runningCount--;
+    if (job->runningCount == 0) {
+        job->state = JOB_DONE;
+        if ((job->timeout != NULL) && (job->timeout->timedOut == 1)) {
+            printf("[%d] Timed out\t%s\n", job->jobId, job->commandText);
+            fflush(stdout);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+
+
+/*
+Sets lastExitStatus from a finished job, the same way a foreground command does: from the wait status
+of its last process, or 124 if it timed out.
+*/
+void setExitStatusFromJob(struct jobEntry* job) {
+    if ((job->timeout != NULL) && (job->timeout->timedOut == 1)) {
+        lastExitStatus = 124;
+    }
+    else if (WIFEXITED(job->lastProcessExit) != 0) {
+        lastExitStatus = WEXITSTATUS(job->lastProcessExit);
+    }
+    else if (WIFSIGNALED(job->lastProcessExit) != 0) {
+        lastExitStatus = WTERMSIG(job->lastProcessExit);
+    }
+}
+
+
+
+/*
+Waits in the foreground until every process of a job has exited, or one of them stops.
+Used by 'wait' and 'fg'. A job that finishes is removed, and its exit sets lastExitStatus.
+Usage of the processes waited for is added to foregroundUsage, so 'time fg' reports it.
+Returns 1 if the job finished, 0 if it stopped.
+*/
+int waitForJob(struct jobEntry* job) {
+    struct rusage usage;
+    int childExit;
+    int i = 0;
+
+    for (i; i < job->processCount; i++) {
+        pid_t processID = job->processIDs[i];
+        if (findJobByProcess(processID) != job) {
+            continue;
+        }
+
+        while (1) {
+            pid_t waitResult = waitForChildWithTimers(processID, &childExit, WUNTRACED, &usage);
+            if ((waitResult == -1) && (errno == EINTR)) {
+                continue;
+            }
+            if (waitResult == -1) {
+                // Reaped without going through the job table, so its status is lost. Record it as failed
+                // rather than leaving the job with a stale status.
+                childExit = LOST_CHILD_EXIT;
+                memset(&usage, 0, sizeof(usage));
+            }
+            else if (!WIFSTOPPED(childExit)) {
+                addUsage(&foregroundUsage, &usage);
+            }
+            if (updateJobProcess(job, processID, childExit, &usage) == 1) {
+                setExitStatusFromJob(job);
+                removeJob(job);
+                return 1;
+            }
+            if (job->state == JOB_STOPPED) {
+                printf("[%d] Stopped\t%s\n", job->jobId, job->commandText);
+                fflush(stdout);
+                return 0;
+            }
+            break;
+        }
+    }
+
+    if (job->runningCount <= 0) {
+        setExitStatusFromJob(job);
+        removeJob(job);
+        return 1;
+    }
+    return 0;
+}
+
+
+
+/*
+Finds the job named by a 'wait', 'fg' or 'bg' argument, "%n" or "n".
+With no argument, the most recent job is used.
+Prints a message and returns NULL if there is no such job.
+*/
+struct jobEntry* jobFromArgument(char* commandName, char* argument) {
+    struct jobEntry* job;
+
+    if (argument == NULL) {
+        job = findJobById(highestJobId);
+        if (job == NULL) {
+            printf("%s: no current job\n", commandName);
+            fflush(stdout);
+        }
+        return job;
+    }
+
+    if (argument[0] == '%') {
+        argument++;
+    }
+    job = findJobById(atoi(argument));
+    if (job == NULL) {
+        printf("%s: %s: no such job\n", commandName, argument);
+        fflush(stdout);
+    }
+    return job;
+}
+
+
+
+/*
+Runs the 'jobs' command. Prints every job with its state, running time and command line.
+'jobs -l' also lists the PIDs of each job.
+Input: commandStructure
+*/
+void jobsCommand(struct commandStructure* command) {
+    char* stateNames[3] = {"Running", "Stopped", "Done"};
+    int longFormat = ((command->argumentCounter > 1) && (strcmp(command->arguments[1], "-l") == 0));
+    struct timespec now;
+    int jobId = 1;
+
+    lastExitStatus = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (jobId; jobId <= highestJobId; jobId++) {
+        struct jobEntry* job = jobSlots[jobId];
+        if (job == NULL) {
+            continue;
+        }
+
+        double runningSeconds = (now.tv_sec - job->startTime.tv_sec) + (now.tv_nsec - job->startTime.tv_nsec) / 1e9;
+        printf("[%d] %-8s %8.1fs  %s\n", job->jobId, stateNames[job->state], runningSeconds, job->commandText);
+        if (longFormat == 1) {
+            int i = 0;
+            printf("     PIDs:");
+            for (i; i < job->processCount; i++) {
+                printf(" %d", job->processIDs[i]);
+            }
+            printf("\n");
+        }
+    }
+    fflush(stdout);
+}
+
+
+
+/*
+Runs the 'wait' command.
+wait      waits for every running job to finish.
+wait id   waits for one job to finish, and sets the exit status from it.
+Input: commandStructure
+*/
+void waitCommand(struct commandStructure* command) {
+    struct rusage usage;
+    int childExit;
+
+    if (command->argumentCounter > 1) {
+        struct jobEntry* job = jobFromArgument("wait", command->arguments[1]);
+        if (job == NULL) {
+            lastExitStatus = 1;
+            return;
+        }
+        waitForJob(job);
+        return;
+    }
+
+    // Wait for any child until no job has a running process left. Stopped jobs are not waited for.
+    while (1) {
+        int runningJobs = 0;
+        int jobId = 1;
+        for (jobId; jobId <= highestJobId; jobId++) {
+            if ((jobSlots[jobId] != NULL) && (jobSlots[jobId]->state == JOB_RUNNING)) {
+                runningJobs++;
+            }
+        }
+        if (runningJobs == 0) {
+            lastExitStatus = 0;
+            return;
+        }
+
+        pid_t processID = waitForChildWithTimers(-1, &childExit, WUNTRACED, &usage);
+        if (processID == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        struct jobEntry* job = findJobByProcess(processID);
+        if (!WIFSTOPPED(childExit)) {
+            addUsage(&foregroundUsage, &usage);
+        }
+        if ((job != NULL) && (updateJobProcess(job, processID, childExit, &usage) == 1)) {
+            setExitStatusFromJob(job);
+            removeJob(job);
+        }
+    }
+}
+
+
+
+/*
+Runs the 'fg' command. Continues a job if it is stopped, and waits for it in the foreground.
+The job keeps the stdin and signal settings it was started with in the background.
+Input: commandStructure
+*/
+void fgCommand(struct commandStructure* command) {
+    struct jobEntry* job = jobFromArgument("fg", (command->argumentCounter > 1) ? command->arguments[1] : NULL);
+    int i = 0;
+
+    if (job == NULL) {
+        lastExitStatus = 1;
+        return;
+    }
+
+    printf("%s\n", job->commandText);
+    fflush(stdout);
+    if (job->state == JOB_STOPPED) {
+        for (i; i < job->processCount; i++) {
+            kill(job->processIDs[i], SIGCONT);
+        }
+        job->state = JOB_RUNNING;
+    }
+    waitForJob(job);
+}
+
+
+
+/*
+Runs the 'bg' command. Continues a stopped job in the background.
+Input: commandStructure
+*/
+void bgCommand(struct commandStructure* command) {
+    struct jobEntry* job = jobFromArgument("bg", (command->argumentCounter > 1) ? command->arguments[1] : NULL);
+    int i = 0;
+
+    if (job == NULL) {
+        lastExitStatus = 1;
+        return;
+    }
+    lastExitStatus = 0;
+
+    if (job->state != JOB_STOPPED) {
+        printf("bg: job %d already in background\n", job->jobId);
+        fflush(stdout);
+        return;
+    }
+
+    for (i; i < job->processCount; i++) {
+        kill(job->processIDs[i], SIGCONT);
+    }
+    job->state = JOB_RUNNING;
+    printf("[%d] %s &\n", job->jobId, job->commandText);
+    fflush(stdout);
+}
+
+
+
+/*
+Sends SIGTERM to every process of every job, and continues stopped ones so they can act on it.
+Used by 'exit'.
+*/
+void killAllJobs() {
+    int jobId = 1;
+    for (jobId; jobId <= highestJobId; jobId++) {
+        struct jobEntry* job = jobSlots[jobId];
+        int i = 0;
+        if (job == NULL) {
+            continue;
+        }
+        for (i; i < job->processCount; i++) {
+            if (findJobByProcess(job->processIDs[i]) == job) {
+                kill(job->processIDs[i], 15);
+                if (job->state == JOB_STOPPED) {
+                    kill(job->processIDs[i], SIGCONT);
+                }
+            }
+        }
+    }
+}
+
+
+
+/*
+Empties the job table without touching the processes in it. Used by a forked copy of the shell,
+whose parent still owns those jobs, so that its 'exit' does not kill them.
+*/
+void forgetAllJobs() {
+    highestJobId = 0;
+    jobCount = 0;
+    if (processTableCapacity > 0) {
+        memset(processTableKeys, 0, processTableCapacity * sizeof(pid_t));
+    }
+    processTableCount = 0;
+}
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smallsh.h"
+
+/*
+Token types returned by nextToken.
+*/
+#define TOKEN_END 0
+#define TOKEN_WORD 1
+#define TOKEN_PIPE 2
+#define TOKEN_INPUT 3
+#define TOKEN_OUTPUT 4
+#define TOKEN_AMPERSAND 5
+#define TOKEN_ERROR 6
+// '>>'
+#define TOKEN_APPEND 7
+// '2>' and '2>>'
+#define TOKEN_STDERR 8
+#define TOKEN_STDERR_APPEND 9
+// '2>&1' and '>&2'
+#define TOKEN_STDERR_TO_STDOUT 10
+#define TOKEN_STDOUT_TO_STDERR 11
+// '&>' and '&>>', stdout and stderr to one file
+#define TOKEN_BOTH 12
+#define TOKEN_BOTH_APPEND 13
+
+/*
+Quoting states inside a word.
+*/
+#define LEX_PLAIN 0
+#define LEX_SINGLE_QUOTE 1
+#define LEX_DOUBLE_QUOTE 2
+
+/*
+Structure for splitting one command line into tokens.
+Words are unquoted in place: the text written for a word never gets ahead of the text read,
+so each word ends up as a NUL-terminated string inside the line itself and nothing is copied.
+*/
+struct lexerState {
+    char* input;
+    size_t position;
+    // Operator that ended the last word. It is returned by the next call, since its first character was overwritten.
+    int pendingToken;
+    // How much of the last word came before its first quote or backslash. Only a NAME= inside it makes an assignment.
+    size_t literalLength;
+};
+
+
+
+/*
+Starts a lexer at the beginning of a command line. The line is changed as it is read.
+*/
+void initializeLexer(struct lexerState* lexer, char* inputCommand) {
+    lexer->input = inputCommand;
+    lexer->position = 0;
+    lexer->pendingToken = TOKEN_END;
+    lexer->literalLength = 0;
+}
+
+
+
+/*
+Returns the token type for the operator starting at text, and sets operatorLength to its length.
+Returns TOKEN_END if text does not start an operator.
+'2>', '2>>' and '2>&1' only count as operators at the start of a token, where wordStart is 1.
+Elsewhere the '2' is part of a word.
+*/
+int operatorToken(char* text, size_t* operatorLength, int wordStart) {
+    *operatorLength = 1;
+    switch(text[0]) {
+        case '|':
+            return TOKEN_PIPE;
+        case '<':
+            return TOKEN_INPUT;
+        case '>':
+            if (text[1] == '>') {
+                *operatorLength = 2;
+                return TOKEN_APPEND;
+            }
+            if ((text[1] == '&') && (text[2] == '2')) {
+                *operatorLength = 3;
+                return TOKEN_STDOUT_TO_STDERR;
+            }
+            return TOKEN_OUTPUT;
+        case '&':
+            if ((text[1] == '>') && (text[2] == '>')) {
+                *operatorLength = 3;
+                return TOKEN_BOTH_APPEND;
+            }
+            if (text[1] == '>') {
+                *operatorLength = 2;
+                return TOKEN_BOTH;
+            }
+            return TOKEN_AMPERSAND;
+        case '2':
+            if ((wordStart == 0) || (text[1] != '>')) {
+                break;
+            }
+            if ((text[2] == '&') && (text[3] == '1')) {
+                *operatorLength = 4;
+                return TOKEN_STDERR_TO_STDOUT;
+            }
+            if (text[2] == '>') {
+                *operatorLength = 3;
+                return TOKEN_STDERR_APPEND;
+            }
+            *operatorLength = 2;
+            return TOKEN_STDERR;
+    }
+    return TOKEN_END;
+}
+
+
+
+/*
+Reads the next token of the line in a single pass.
+Blanks separate words. '|', '<', '>', '>>', '>&2', '&', '&>' and '&>>' are operators wherever they appear
+outside quotes, and '2>', '2>>' and '2>&1' are operators at the start of a token.
+Inside a word, '...' keeps everything literally, "..." keeps everything except \" \\ \$ and \`,
+and a backslash outside quotes keeps the next character literally. A '#' at the start of a word
+begins a comment that runs to the end of the line.
+For TOKEN_WORD, word is set to the unquoted word, and literalLength to how much of it was read before
+any quote or backslash.
+Returns TOKEN_END at the end of the line, and TOKEN_ERROR for an unterminated quote.
+*/
+int nextToken(struct lexerState* lexer, char** word) {
+    char* text = lexer->input;
+    size_t readIndex = lexer->position;
+    size_t operatorLength;
+    int token;
+
+    if (lexer->pendingToken != TOKEN_END) {
+        token = lexer->pendingToken;
+        lexer->pendingToken = TOKEN_END;
+        return token;
+    }
+
+    while ((text[readIndex] == ' ') || (text[readIndex] == '\t')) {
+        readIndex++;
+    }
+
+    if ((text[readIndex] == '\0') || (text[readIndex] == '\n') || (text[readIndex] == '#')) {
+        lexer->position = readIndex;
+        text[readIndex] = '\0';
+        return TOKEN_END;
+    }
+
+    token = operatorToken(&text[readIndex], &operatorLength, 1);
+    if (token != TOKEN_END) {
+        lexer->position = readIndex + operatorLength;
+        return token;
+    }
+
+    size_t writeIndex = readIndex;
+    size_t wordStart = writeIndex;
+    int quoteState = LEX_PLAIN;
+    int quoted = 0;
+
+    while (1) {
+        char character = text[readIndex];
+
+        if (quoteState == LEX_SINGLE_QUOTE) {
+            if (character == '\0') {
+                return TOKEN_ERROR;
+            }
+            if (character == '\'') {
+                quoteState = LEX_PLAIN;
+            }
+            else {
+                text[writeIndex++] = character;
+            }
+            readIndex++;
+            continue;
+        }
+
+        if (quoteState == LEX_DOUBLE_QUOTE) {
+            if (character == '\0') {
+                return TOKEN_ERROR;
+            }
+            if (character == '"') {
+                quoteState = LEX_PLAIN;
+                readIndex++;
+            }
+            else if ((character == '\\') && (text[readIndex + 1] != '\0') && (strchr("\"\\$`", text[readIndex + 1]) != NULL)) {
+                text[writeIndex++] = text[readIndex + 1];
+                readIndex += 2;
+            }
+            else {
+                text[writeIndex++] = character;
+                readIndex++;
+            }
+            continue;
+        }
+
+        // Unquoted. Blanks and operators end the word.
+        if ((character == '\0') || (character == '\n') || (character == ' ') || (character == '\t')) {
+            lexer->position = (character == '\0') ? readIndex : readIndex + 1;
+            break;
+        }
+        token = operatorToken(&text[readIndex], &operatorLength, 0);
+        if (token != TOKEN_END) {
+            lexer->pendingToken = token;
+            lexer->position = readIndex + operatorLength;
+            break;
+        }
+
+        if ((quoted == 0) && ((character == '\'') || (character == '"') || (character == '\\'))) {
+            quoted = 1;
+            lexer->literalLength = writeIndex - wordStart;
+        }
+        if (character == '\'') {
+            quoteState = LEX_SINGLE_QUOTE;
+            readIndex++;
+        }
+        else if (character == '"') {
+            quoteState = LEX_DOUBLE_QUOTE;
+            readIndex++;
+        }
+        else if (character == '\\') {
+            // A backslash at the end of the line is dropped.
+            if ((text[readIndex + 1] == '\0') || (text[readIndex + 1] == '\n')) {
+                readIndex++;
+            }
+            else {
+                text[writeIndex++] = text[readIndex + 1];
+                readIndex += 2;
+            }
+        }
+        else {
+            text[writeIndex++] = character;
+            readIndex++;
+        }
+    }
+
+    if (quoted == 0) {
+        lexer->literalLength = writeIndex - wordStart;
+    }
+    text[writeIndex] = '\0';
+    *word = &text[wordStart];
+    return TOKEN_WORD;
+}
+
+
+
+/*
+Finds the ')' that closes a '$(' command substitution, reading quotes inside it the way nextToken does,
+and counting nested parentheses, so a ')' inside quotes or an inner '$(...)' does not end it.
+Takes input of the text and the position of the '('.
+Returns the position of the closing ')', or 0 if the substitution is not closed.
+*/
+size_t findSubstitutionEnd(char* text, size_t openPosition) {
+    int quoteState = LEX_PLAIN;
+    int depth = 1;
+    size_t i = openPosition + 1;
+
+    for (i; text[i] != '\0'; i++) {
+        char character = text[i];
+        if (quoteState == LEX_SINGLE_QUOTE) {
+            quoteState = (character == '\'') ? LEX_PLAIN : quoteState;
+            continue;
+        }
+        if ((character == '\\') && (text[i + 1] != '\0')) {
+            i++;
+            continue;
+        }
+        if ((character == '$') && (text[i + 1] == '(')) {
+            i = findSubstitutionEnd(text, i + 1);
+            if (i == 0) {
+                return 0;
+            }
+            continue;
+        }
+        if (quoteState == LEX_DOUBLE_QUOTE) {
+            quoteState = (character == '"') ? LEX_PLAIN : quoteState;
+            continue;
+        }
+
+        if (character == '\'') {
+            quoteState = LEX_SINGLE_QUOTE;
+        }
+        else if (character == '"') {
+            quoteState = LEX_DOUBLE_QUOTE;
+        }
+        else if (character == '(') {
+            depth++;
+        }
+        else if ((character == ')') && (--depth == 0)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Appends an argument to a stage, growing its arguments array in the command arena as needed.
+The array is always kept NULL-terminated for exec.
+*/
+void addArgument(struct commandStructure* stage, char* argument) {
+    if (stage->argumentCounter + 1 >= stage->argumentCapacity) {
+        int newCapacity = (stage->argumentCapacity == 0) ? 16 : stage->argumentCapacity * 2;
+        char** newArguments = arenaAllocate(&commandArena, newCapacity * sizeof(char*));
+        if (stage->argumentCounter > 0) {
+            memcpy(newArguments, stage->arguments, stage->argumentCounter * sizeof(char*));
+        }
+        stage->arguments = newArguments;
+        stage->argumentCapacity = newCapacity;
+    }
+
+    stage->arguments[stage->argumentCounter] = argument;
+    stage->argumentCounter++;
+    stage->arguments[stage->argumentCounter] = NULL;
+}
+
+
+
+/*
+Appends a NAME=value word to a stage's assignments, growing the array in the command arena as needed.
+*/
+void addAssignment(struct commandStructure* stage, char* word) {
+    if (stage->assignmentCount == stage->assignmentCapacity) {
+        int newCapacity = (stage->assignmentCapacity == 0) ? 4 : stage->assignmentCapacity * 2;
+        char** newAssignments = arenaAllocate(&commandArena, newCapacity * sizeof(char*));
+        if (stage->assignmentCount > 0) {
+            memcpy(newAssignments, stage->assignments, stage->assignmentCount * sizeof(char*));
+        }
+        stage->assignments = newAssignments;
+        stage->assignmentCapacity = newCapacity;
+    }
+
+    stage->assignments[stage->assignmentCount] = word;
+    stage->assignmentCount++;
+}
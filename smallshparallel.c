@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "smallsh.h"
+
+// The reader the shell takes its commands from, defined in smallsh.c.
+extern struct inputReader shellInput;
+
+/*
+Structure for one command started by 'parallel'.
+With -k, the command writes into its own memory file, which is copied to the real output in job order.
+*/
+struct parallelJob {
+    pid_t processID;
+    int outputFd;
+    int finished;
+    int childExit;
+};
+
+
+
+/*
+Returns a copy of a template argument with every "{}" replaced by the job's argument.
+The copy lives in the command arena.
+*/
+char* substituteParallelArgument(char* templateArgument, char* jobArgument) {
+    size_t jobArgumentLength = strlen(jobArgument);
+    size_t resultLength = 0;
+    char* marker = templateArgument;
+
+    while ((marker = strstr(marker, "{}")) != NULL) {
+        resultLength += jobArgumentLength;
+        marker += 2;
+    }
+    resultLength += strlen(templateArgument);
+
+    char* result = arenaAllocate(&commandArena, resultLength + 1);
+    char* writePosition = result;
+    char* readPosition = templateArgument;
+    while ((marker = strstr(readPosition, "{}")) != NULL) {
+        memcpy(writePosition, readPosition, marker - readPosition);
+        writePosition += marker - readPosition;
+        memcpy(writePosition, jobArgument, jobArgumentLength);
+        writePosition += jobArgumentLength;
+        readPosition = marker + 2;
+    }
+    strcpy(writePosition, readPosition);
+    return result;
+}
+
+
+
+/*
+Builds the stage for one job from the command template: arguments with {} replaced, or the job's
+argument appended when the template has no {} at all.
+*/
+struct commandStructure* buildParallelStage(char** templateArguments, int templateCount, char* jobArgument) {
+    struct commandStructure* stage = arenaAllocate(&commandArena, sizeof(struct commandStructure));
+    int placeholderFound = 0;
+    int i = 0;
+
+    for (i; i < templateCount; i++) {
+        if (strstr(templateArguments[i], "{}") != NULL) {
+            placeholderFound = 1;
+            addArgument(stage, substituteParallelArgument(templateArguments[i], jobArgument));
+        }
+        else {
+            addArgument(stage, templateArguments[i]);
+        }
+    }
+    if (placeholderFound == 0) {
+        addArgument(stage, jobArgument);
+    }
+
+    stage->command = stage->arguments[0];
+    stage->bashCommand = stage->command;
+    stage->pipelineStages = 1;
+    return stage;
+}
+
+
+
+/*
+Copies everything written to a -k job's memory file to the output, then closes it.
+A job that never got a memory file has nothing to copy.
+*/
+void flushParallelOutput(struct parallelJob* job, int outputFd) {
+    char copyBuffer[65536];
+    ssize_t bytesRead;
+
+    if (job->outputFd == -1) {
+        return;
+    }
+
+    lseek(job->outputFd, 0, SEEK_SET);
+    while ((bytesRead = read(job->outputFd, copyBuffer, sizeof(copyBuffer))) > 0) {
+        ssize_t bytesWritten = 0;
+        while (bytesWritten < bytesRead) {
+            ssize_t writeResult = write(outputFd, &copyBuffer[bytesWritten], bytesRead - bytesWritten);
+            if ((writeResult == -1) && (errno == EINTR)) {
+                continue;
+            }
+            if (writeResult == -1) {
+                break;
+            }
+            bytesWritten += writeResult;
+        }
+    }
+    close(job->outputFd);
+    job->outputFd = -1;
+}
+
+
+
+/*
+Reads one argument per line for 'parallel' when no ':::' is given, from the '<' file or else the shell's stdin.
+Empty lines are skipped. The arguments are copied into the command arena.
+When the shell reads its own commands from stdin, the arguments are read through the same reader, so lines it
+has already buffered are not lost. On a terminal they end at Ctrl-D, and the shell goes on reading commands.
+In batch mode stdin is the rest of the script, so it is not read at all.
+Returns the number of arguments, or -1 if there is nothing to read them from (message printed).
+*/
+int readParallelArguments(struct commandStructure* command, char*** jobArguments) {
+    struct inputReader fileReader;
+    struct inputReader* reader = &fileReader;
+    int inputFd = 0;
+    int argumentCapacity = 64;
+    int argumentCount = 0;
+    size_t lineLength;
+    char* line;
+
+    if (command->inputRedirect == 1) {
+        inputFd = open(command->inputFileName, O_RDONLY | O_CLOEXEC);
+        if (inputFd == -1) {
+            printf("Invalid input file '%s'. Please try again.\n", command->inputFileName);
+            fflush(stdout);
+            return -1;
+        }
+    }
+
+    else if ((shellInput.fd == STDIN_FILENO) && (isatty(STDIN_FILENO) == 0)) {
+        printf("parallel: stdin holds the commands being run. Give the arguments with ':::' or '<'.\n");
+        fflush(stdout);
+        return -1;
+    }
+    else if (shellInput.fd == STDIN_FILENO) {
+        reader = &shellInput;
+    }
+
+    *jobArguments = arenaAllocate(&commandArena, argumentCapacity * sizeof(char*));
+    if (reader == &fileReader) {
+        initializeInputReader(&fileReader, inputFd);
+    }
+    while ((line = readInputLine(reader, &lineLength)) != NULL) {
+        if ((lineLength > 0) && (line[lineLength - 1] == '\n')) {
+            lineLength--;
+        }
+        if (lineLength == 0) {
+            continue;
+        }
+        if (argumentCount == argumentCapacity) {
+            char** newArguments = arenaAllocate(&commandArena, argumentCapacity * 2 * sizeof(char*));
+            memcpy(newArguments, *jobArguments, argumentCapacity * sizeof(char*));
+            *jobArguments = newArguments;
+            argumentCapacity *= 2;
+        }
+        char* argument = arenaAllocate(&commandArena, lineLength + 1);
+        memcpy(argument, line, lineLength);
+        (*jobArguments)[argumentCount++] = argument;
+    }
+
+    if (reader == &shellInput) {
+        shellInput.endOfInput = 0;
+        return argumentCount;
+    }
+    free(fileReader.buffer);
+    if (inputFd != 0) {
+        close(inputFd);
+    }
+    return argumentCount;
+}
+
+
+
+/*
+Runs the 'parallel' command.
+parallel [-j N] [-k] command args... [::: arg...]
+Runs the command once per argument, with {} in its arguments replaced by the argument (or the argument
+added at the end if there is no {}). Arguments come after ':::', or one per line from '<' or stdin.
+At most N commands run at once (default: online CPUs), and a new one starts as each finishes.
+Commands are started through spawnCommand like any foreground stage, with stdin from /dev/null.
+'>', '>>', '2>', '2>&1' and '&>' apply to every command.
+With -k, each command's output is held in a memory file and written out in argument order.
+The shell waits for every command. lastExitStatus is the number of commands that failed, capped at 101.
+Input: commandStructure
+*/
+void parallelCommand(struct commandStructure* command) {
+    long jobLimit = sysconf(_SC_NPROCESSORS_ONLN);
+    int keepOrder = 0;
+    int templateStart = 1;
+    int templateCount = 0;
+    char** jobArguments = NULL;
+    int jobArgumentCount = 0;
+    int i = 0;
+
+    // Options come before the command.
+    while (templateStart < command->argumentCounter) {
+        char* option = command->arguments[templateStart];
+        if ((strcmp(option, "-j") == 0) && (templateStart + 1 < command->argumentCounter)) {
+            jobLimit = atoi(command->arguments[templateStart + 1]);
+            templateStart += 2;
+        }
+        else if ((strncmp(option, "-j", 2) == 0) && (option[2] != '\0')) {
+            jobLimit = atoi(&option[2]);
+            templateStart++;
+        }
+        else if (strcmp(option, "-k") == 0) {
+            keepOrder = 1;
+            templateStart++;
+        }
+        else {
+            break;
+        }
+    }
+
+    for (i = templateStart; i < command->argumentCounter; i++) {
+        if (strcmp(command->arguments[i], ":::") == 0) {
+            jobArguments = &command->arguments[i + 1];
+            jobArgumentCount = command->argumentCounter - i - 1;
+            break;
+        }
+        templateCount++;
+    }
+
+    if ((templateCount == 0) || (jobLimit < 1)) {
+        printf("Invalid parallel command. Use parallel [-j N] [-k] command args... [::: arg...]\n");
+        fflush(stdout);
+        return;
+    }
+
+    if (jobArguments == NULL) {
+        jobArgumentCount = readParallelArguments(command, &jobArguments);
+        if (jobArgumentCount == -1) {
+            lastExitStatus = 1;
+            return;
+        }
+    }
+
+    // Output redirections apply to every command. '<' was the argument list, so commands read /dev/null instead.
+    struct commandStructure outputOnly = *command;
+    struct redirectFds redirects;
+    outputOnly.inputRedirect = 0;
+    if (openRedirects(&outputOnly, openDevNull(), -1, 0, &redirects) == -1) {
+        lastExitStatus = 1;
+        return;
+    }
+    int outputFd = (redirects.fds[1] != -1) ? redirects.fds[1] : 1;
+
+    struct parallelJob* jobs = arenaAllocate(&commandArena, (jobArgumentCount + 1) * sizeof(struct parallelJob));
+    struct timespec* startTimes = arenaAllocate(&commandArena, (jobArgumentCount + 1) * sizeof(struct timespec));
+    struct commandStructure** stages = arenaAllocate(&commandArena, (jobArgumentCount + 1) * sizeof(struct commandStructure*));
+    int nextToStart = 0;
+    int nextToFlush = 0;
+    int runningCount = 0;
+    int failedCount = 0;
+
+    while ((nextToStart < jobArgumentCount) || (runningCount > 0)) {
+        // Start commands until the limit is reached.
+        while ((nextToStart < jobArgumentCount) && (runningCount < jobLimit)) {
+            struct parallelJob* job = &jobs[nextToStart];
+            int jobFds[3] = {redirects.fds[0], redirects.fds[1], redirects.fds[2]};
+
+            stages[nextToStart] = buildParallelStage(&command->arguments[templateStart], templateCount, jobArguments[nextToStart]);
+            job->outputFd = -1;
+            if (keepOrder == 1) {
+                job->outputFd = memfd_create("smallsh-parallel", MFD_CLOEXEC);
+                if (job->outputFd == -1) {
+                    printf("parallel: cannot hold the output of '%s': %s\n", jobArguments[nextToStart], strerror(errno));
+                    fflush(stdout);
+                    job->finished = 1;
+                    job->childExit = -1;
+                    failedCount++;
+                    nextToStart++;
+                    continue;
+                }
+                jobFds[1] = job->outputFd;
+                if (command->errorToOutput == 1) {
+                    jobFds[2] = job->outputFd;
+                }
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &startTimes[nextToStart]);
+            job->processID = spawnCommand(stages[nextToStart], jobFds, 0);
+            if (job->processID == -1) {
+                job->finished = 1;
+                job->childExit = -1;
+                failedCount++;
+            }
+            else {
+                runningCount++;
+            }
+            nextToStart++;
+        }
+
+        // Write out finished -k output that is next in order.
+        while ((keepOrder == 1) && (nextToFlush < nextToStart) && (jobs[nextToFlush].finished == 1)) {
+            flushParallelOutput(&jobs[nextToFlush], outputFd);
+            nextToFlush++;
+        }
+
+        if (runningCount == 0) {
+            continue;
+        }
+
+        // Wait for any child. Ones that belong to background jobs are handed to the job table.
+        struct rusage usage;
+        int childExit;
+        pid_t processID = waitForChildWithTimers(-1, &childExit, 0, &usage);
+        if (processID == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        int jobIndex = -1;
+        for (i = nextToFlush; i < nextToStart; i++) {
+            if ((jobs[i].finished == 0) && (jobs[i].processID == processID)) {
+                jobIndex = i;
+                break;
+            }
+        }
+        if (jobIndex == -1) {
+            struct jobEntry* backgroundJob = findJobByProcess(processID);
+            if ((backgroundJob != NULL) && (updateJobProcess(backgroundJob, processID, childExit, &usage) == 1)) {
+                removeJob(backgroundJob);
+            }
+            continue;
+        }
+
+        jobs[jobIndex].finished = 1;
+        jobs[jobIndex].childExit = childExit;
+        runningCount--;
+        TRACE_INSTANT(TRACE_EXIT, processID, childExit, stages[jobIndex]->command);
+        recordProcessUsage(stages[jobIndex]->command, nanosecondsSince(&startTimes[jobIndex]), &usage);
+        addUsage(&foregroundUsage, &usage);
+
+        if (WIFSIGNALED(childExit)) {
+            printf("parallel: '%s' terminated, signal %d\n", jobArguments[jobIndex], WTERMSIG(childExit));
+            fflush(stdout);
+            failedCount++;
+        }
+        else if (WEXITSTATUS(childExit) != 0) {
+            failedCount++;
+        }
+    }
+
+    // Anything left unflushed after an error is still written out.
+    while ((keepOrder == 1) && (nextToFlush < nextToStart)) {
+        if (jobs[nextToFlush].outputFd != -1) {
+            flushParallelOutput(&jobs[nextToFlush], outputFd);
+        }
+        nextToFlush++;
+    }
+
+    closeRedirects(&redirects);
+
+    if (failedCount > 0) {
+        printf("parallel: %d of %d jobs failed.\n", failedCount, jobArgumentCount);
+        fflush(stdout);
+    }
+    lastExitStatus = (failedCount > 101) ? 101 : failedCount;
+
+    // With 'set -e', a failed parallel run ends the shell like a failed foreground command.
+    if ((exitOnFailure == 1) && (lastExitStatus != 0)) {
+        exitShell(lastExitStatus);
+    }
+}
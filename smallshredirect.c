@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "smallsh.h"
+
+/*
+Redirection globals.
+*/
+// /dev/null, opened once and kept open. Background stages read and write it where nothing else is given.
+int devNullFd = -1;
+
+
+
+/*
+Returns the shell's /dev/null fd, opening it the first time. 'main' calls this at startup.
+The fd is close-on-exec, so only the copies dup'ed into children reach them.
+*/
+int openDevNull() {
+    if (devNullFd == -1) {
+        devNullFd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    }
+    return devNullFd;
+}
+
+
+
+/*
+Opens one redirection file close-on-exec, and prints the usual message if it cannot be opened.
+Returns the fd, or -1.
+*/
+int openRedirectFile(char* fileName, int openFlags, char* streamName) {
+    int fileFd = open(fileName, openFlags | O_CLOEXEC, 0644);
+
+    if (fileFd == -1) {
+        printf("Invalid %s file '%s'. Please try again.\n", streamName, fileName);
+        fflush(stdout);
+    }
+    return fileFd;
+}
+
+
+
+/*
+Works out stdin, stdout and stderr for one stage, the same way for foreground and background stages,
+pipeline stages and builtins run inside the shell.
+Files take priority over pipe ends: '<' over pipeInput, and '>', '>>', '&>' over pipeOutput.
+Background stages fall back to the cached /dev/null for stdin and stdout. stderr is left alone unless redirected.
+'2>&1' then points stderr at wherever stdout ended up, and '>&2' points stdout at stderr.
+Fills in redirects->fds with the fd for each of 0, 1 and 2, or -1 to keep the shell's own.
+Files opened here are recorded in redirects->opened, for closeRedirects.
+Returns 0, or -1 if a file could not be opened (message printed, nothing left open).
+Input: commandStructure
+*/
+int openRedirects(struct commandStructure* stage, int pipeInput, int pipeOutput, int background, struct redirectFds* redirects) {
+    int i = 0;
+
+    for (i; i < 3; i++) {
+        redirects->fds[i] = -1;
+        redirects->opened[i] = -1;
+    }
+
+    if (stage->outputRedirect == 1) {
+        int outputFlags = O_WRONLY | O_CREAT | ((stage->outputAppend == 1) ? O_APPEND : O_TRUNC);
+        redirects->opened[1] = openRedirectFile(stage->outputFileName, outputFlags, "output");
+        if (redirects->opened[1] == -1) {
+            return -1;
+        }
+    }
+
+    if (stage->errorRedirect == 1) {
+        int errorFlags = O_WRONLY | O_CREAT | ((stage->errorAppend == 1) ? O_APPEND : O_TRUNC);
+        redirects->opened[2] = openRedirectFile(stage->errorFileName, errorFlags, "error");
+        if (redirects->opened[2] == -1) {
+            closeRedirects(redirects);
+            return -1;
+        }
+    }
+
+    if (stage->inputRedirect == 1) {
+        redirects->opened[0] = openRedirectFile(stage->inputFileName, O_RDONLY, "input");
+        if (redirects->opened[0] == -1) {
+            closeRedirects(redirects);
+            return -1;
+        }
+    }
+
+    redirects->fds[0] = (redirects->opened[0] != -1) ? redirects->opened[0] : pipeInput;
+    redirects->fds[1] = (redirects->opened[1] != -1) ? redirects->opened[1] : pipeOutput;
+    redirects->fds[2] = redirects->opened[2];
+    if (background == 1) {
+        for (i = 0; i < 2; i++) {
+            if (redirects->fds[i] == -1) {
+                redirects->fds[i] = openDevNull();
+            }
+        }
+    }
+
+    // A stream that follows the other uses the other's fd, or the shell's own one if that is not redirected.
+    if (stage->errorToOutput == 1) {
+        redirects->fds[2] = (redirects->fds[1] != -1) ? redirects->fds[1] : 1;
+    }
+    else if (stage->outputToError == 1) {
+        redirects->fds[1] = (redirects->fds[2] != -1) ? redirects->fds[2] : 2;
+    }
+    return 0;
+}
+
+
+
+/*
+Closes the files opened by openRedirects. Pipe ends and /dev/null belong to the caller and are left open.
+*/
+void closeRedirects(struct redirectFds* redirects) {
+    int i = 0;
+    for (i; i < 3; i++) {
+        if (redirects->opened[i] != -1) {
+            close(redirects->opened[i]);
+            redirects->opened[i] = -1;
+        }
+    }
+}
+
+
+
+/*
+Puts a stage's fds over the shell's own stdin, stdout and stderr, for a builtin run inside the shell.
+The shell's fds are saved in savedFds (close-on-exec, above 10) for restoreRedirects, -1 where unchanged.
+*/
+void applyRedirects(struct redirectFds* redirects, int savedFds[3]) {
+    int i = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i; i < 3; i++) {
+        savedFds[i] = -1;
+        if ((redirects->fds[i] != -1) && (redirects->fds[i] != i)) {
+            savedFds[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+            dup2(redirects->fds[i], i);
+        }
+    }
+}
+
+
+
+/*
+Puts back the shell's stdin, stdout and stderr saved by applyRedirects.
+Output still buffered by stdio is flushed first, so it lands in the redirected files.
+*/
+void restoreRedirects(int savedFds[3]) {
+    int i = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i; i < 3; i++) {
+        if (savedFds[i] != -1) {
+            dup2(savedFds[i], i);
+            close(savedFds[i]);
+        }
+    }
+}
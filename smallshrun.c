@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "smallsh.h"
+
+// ioprio_set has no glibc wrapper. These match linux/ioprio.h.
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+/*
+Run policy globals.
+*/
+// Policy given by the 'run' prefix, for the command it is running. NULL otherwise.
+struct runPolicy* pendingRunPolicy = NULL;
+// Default policy for every background command, set with 'bgpolicy'.
+struct runPolicy backgroundPolicy = {0};
+
+// Resource for each of limits[], in RUN_LIMIT order.
+int runLimitResources[] = {RLIMIT_CPU, RLIMIT_AS, RLIMIT_NOFILE};
+
+
+
+/*
+Reads a CPU list such as "0-3,6" into a CPU set.
+Returns 0, or -1 if the list is not valid.
+*/
+int parseCpuList(char* cpuList, cpu_set_t* cpuSet) {
+    char* position = cpuList;
+
+    CPU_ZERO(cpuSet);
+    while (*position != '\0') {
+        char* numberEnd;
+        long first = strtol(position, &numberEnd, 10);
+        long last = first;
+        if ((numberEnd == position) || (first < 0)) {
+            return -1;
+        }
+        position = numberEnd;
+        if (*position == '-') {
+            last = strtol(position + 1, &numberEnd, 10);
+            if ((numberEnd == position + 1) || (last < first)) {
+                return -1;
+            }
+            position = numberEnd;
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (first; first <= last; first++) {
+            CPU_SET(first, cpuSet);
+        }
+        if (*position == ',') {
+            position++;
+        }
+        else if (*position != '\0') {
+            return -1;
+        }
+    }
+    return (CPU_COUNT(cpuSet) > 0) ? 0 : -1;
+}
+
+
+
+/*
+Reads an I/O priority like ionice takes it: a class (idle, be, rt, or 1 to 3) and an optional ':level' from 0 to 7.
+Returns the ioprio_set value, or -1 if it is not valid.
+*/
+int parseIoPriority(char* priorityText) {
+    int ioClass = -1;
+    int ioLevel = 4;
+    char* levelText = strchr(priorityText, ':');
+    size_t classLength = (levelText != NULL) ? (size_t)(levelText - priorityText) : strlen(priorityText);
+
+    if ((strncmp(priorityText, "rt", classLength) == 0) || (strncmp(priorityText, "1", classLength) == 0)) {
+        ioClass = 1;
+    }
+    else if ((strncmp(priorityText, "be", classLength) == 0) || (strncmp(priorityText, "2", classLength) == 0)) {
+        ioClass = 2;
+    }
+    else if ((strncmp(priorityText, "idle", classLength) == 0) || (strncmp(priorityText, "3", classLength) == 0)) {
+        ioClass = 3;
+        ioLevel = 0;
+    }
+    if ((ioClass == -1) || (classLength == 0)) {
+        return -1;
+    }
+
+    if (levelText != NULL) {
+        char* numberEnd;
+        ioLevel = strtol(levelText + 1, &numberEnd, 10);
+        if ((numberEnd == levelText + 1) || (*numberEnd != '\0') || (ioLevel < 0) || (ioLevel > 7)) {
+            return -1;
+        }
+    }
+    return (ioClass << IOPRIO_CLASS_SHIFT) | ioLevel;
+}
+
+
+
+/*
+Reads a whole number option value. Returns 0, or -1 if it is not a number or is out of range.
+*/
+int parseRunNumber(char* numberText, long minimum, long maximum, long* value) {
+    char* numberEnd;
+
+    errno = 0;
+    *value = strtol(numberText, &numberEnd, 10);
+    if ((numberEnd == numberText) || (*numberEnd != '\0') || (errno != 0) || (*value < minimum) || (*value > maximum)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+
+/*
+Reads run policy options from the start of an argument list, up to the first argument that does not start with '-'.
+-a cpus          CPU affinity, as a list like 0-3,6
+-n nice          nice value, -20 to 19
+-i class[:level] I/O priority: idle, be or rt, with a level from 0 to 7
+-t seconds       CPU time limit (RLIMIT_CPU)
+-m megabytes     address space limit (RLIMIT_AS)
+-f files         open file limit (RLIMIT_NOFILE)
+Options that are set are added to policy, leaving the rest of it alone.
+Returns the number of arguments used, or -1 if an option is not valid (message printed).
+*/
+int parseRunOptions(char** arguments, int argumentCount, struct runPolicy* policy) {
+    int used = 0;
+    long value;
+
+    while ((used + 1 < argumentCount) && (arguments[used][0] == '-')) {
+        char option = (strlen(arguments[used]) == 2) ? arguments[used][1] : '?';
+        char* optionValue = arguments[used + 1];
+        int valid = 1;
+
+        if (option == 'a') {
+            valid = (parseCpuList(optionValue, &policy->affinity) == 0);
+            policy->affinitySet = valid;
+        }
+        else if (option == 'n') {
+            valid = (parseRunNumber(optionValue, -20, 19, &value) == 0);
+            policy->niceSet = valid;
+            policy->niceValue = value;
+        }
+        else if (option == 'i') {
+            int ioPriority = parseIoPriority(optionValue);
+            valid = (ioPriority != -1);
+            policy->ioPriority = valid ? ioPriority : 0;
+        }
+        else if ((option == 't') || (option == 'm') || (option == 'f')) {
+            int limit = (option == 't') ? RUN_LIMIT_CPU : (option == 'm') ? RUN_LIMIT_AS : RUN_LIMIT_NOFILE;
+            valid = (parseRunNumber(optionValue, 1, (option == 'm') ? (long)(RLIM_INFINITY >> 21) : 0x7fffffffL, &value) == 0);
+            policy->limitSet[limit] = valid;
+            policy->limits[limit] = (option == 'm') ? (rlim_t)value << 20 : (rlim_t)value;
+        }
+        else {
+            valid = 0;
+        }
+
+        if (valid == 0) {
+            printf("Invalid run option %s %s. Please try again.\n", arguments[used], optionValue);
+            fflush(stdout);
+            return -1;
+        }
+        policy->active = 1;
+        used += 2;
+    }
+    return used;
+}
+
+
+
+/*
+Fills in policy with the settings that apply to a new child: the background default for background
+stages, with anything from a 'run' prefix on top.
+Returns 1 if there is anything to apply, 0 if the child can be started as usual.
+*/
+int effectiveRunPolicy(int background, struct runPolicy* policy) {
+    int i = 0;
+
+    memset(policy, 0, sizeof(struct runPolicy));
+    if ((background == 1) && (backgroundPolicy.active == 1)) {
+        *policy = backgroundPolicy;
+    }
+    if (pendingRunPolicy == NULL) {
+        return policy->active;
+    }
+
+    if (pendingRunPolicy->affinitySet == 1) {
+        policy->affinitySet = 1;
+        policy->affinity = pendingRunPolicy->affinity;
+    }
+    if (pendingRunPolicy->niceSet == 1) {
+        policy->niceSet = 1;
+        policy->niceValue = pendingRunPolicy->niceValue;
+    }
+    if (pendingRunPolicy->ioPriority != 0) {
+        policy->ioPriority = pendingRunPolicy->ioPriority;
+    }
+    for (i; i < RUN_LIMIT_COUNT; i++) {
+        if (pendingRunPolicy->limitSet[i] == 1) {
+            policy->limitSet[i] = 1;
+            policy->limits[i] = pendingRunPolicy->limits[i];
+        }
+    }
+    policy->active |= pendingRunPolicy->active;
+    return policy->active;
+}
+
+
+
+/*
+Applies a run policy to the calling process. Called in a new child between fork and exec,
+so it only makes system calls. Limits set both the soft and hard value, like 'ulimit'.
+Returns 0, or the errno of the first setting that failed.
+*/
+int applyRunPolicy(struct runPolicy* policy) {
+    int i = 0;
+
+    if ((policy->affinitySet == 1) && (sched_setaffinity(0, sizeof(cpu_set_t), &policy->affinity) == -1)) {
+        return errno;
+    }
+    if ((policy->niceSet == 1) && (setpriority(PRIO_PROCESS, 0, policy->niceValue) == -1)) {
+        return errno;
+    }
+    if ((policy->ioPriority != 0) && (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, policy->ioPriority) == -1)) {
+        return errno;
+    }
+    for (i; i < RUN_LIMIT_COUNT; i++) {
+        if (policy->limitSet[i] == 1) {
+            struct rlimit limit = {policy->limits[i], policy->limits[i]};
+            if (setrlimit(runLimitResources[i], &limit) == -1) {
+                return errno;
+            }
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Prints a run policy as the options that would set it.
+*/
+void printRunPolicy(struct runPolicy* policy) {
+    int i = 0;
+
+    if (policy->active == 0) {
+        printf("none\n");
+        return;
+    }
+    if (policy->affinitySet == 1) {
+        int cpu = 0;
+        char* separator = "";
+        printf("-a ");
+        for (cpu; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &policy->affinity)) {
+                int last = cpu;
+                while ((last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, &policy->affinity)) {
+                    last++;
+                }
+                if (last > cpu) {
+                    printf("%s%d-%d", separator, cpu, last);
+                }
+                else {
+                    printf("%s%d", separator, cpu);
+                }
+                separator = ",";
+                cpu = last;
+            }
+        }
+        printf(" ");
+    }
+    if (policy->niceSet == 1) {
+        printf("-n %d ", policy->niceValue);
+    }
+    if (policy->ioPriority != 0) {
+        char* ioClassNames[] = {"none", "rt", "be", "idle"};
+        printf("-i %s:%d ", ioClassNames[(policy->ioPriority >> IOPRIO_CLASS_SHIFT) & 3], policy->ioPriority & 7);
+    }
+    for (i; i < RUN_LIMIT_COUNT; i++) {
+        if (policy->limitSet[i] == 1) {
+            printf("-%c %llu ", "tmf"[i], (unsigned long long)((i == RUN_LIMIT_AS) ? policy->limits[i] >> 20 : policy->limits[i]));
+        }
+    }
+    printf("\n");
+}
+
+
+
+/*
+Runs the 'run' prefix.
+run [-a cpus] [-n nice] [-i class[:level]] [-t seconds] [-m megabytes] [-f files] command args...
+Runs the rest of the line with the given CPU affinity, nice value, I/O priority and limits applied in every
+process it starts, on top of the background default if it runs in the background. Builtins run inside the
+shell and are not affected.
+Input: commandStructure
+*/
+void runCommand(struct commandStructure* command) {
+    struct runPolicy policy = {0};
+    int used = parseRunOptions(&command->arguments[1], command->argumentCounter - 1, &policy);
+    if (used == -1) {
+        lastExitStatus = 1;
+        return;
+    }
+    if (used + 1 >= command->argumentCounter) {
+        printf("Invalid run command. Use run [-a cpus] [-n nice] [-i class[:level]] [-t seconds] [-m megabytes] [-f files] command\n");
+        fflush(stdout);
+        lastExitStatus = 1;
+        return;
+    }
+
+    command->arguments += used + 1;
+    command->argumentCounter -= used + 1;
+    command->argumentCapacity -= used + 1;
+    command->command = command->arguments[0];
+
+    struct runPolicy* savedPolicy = pendingRunPolicy;
+    pendingRunPolicy = &policy;
+    shellCommand(command);
+    pendingRunPolicy = savedPolicy;
+}
+
+
+
+/*
+Runs the 'bgpolicy' command, which sets the default run policy for background commands.
+bgpolicy             shows the current default.
+bgpolicy off         clears it.
+bgpolicy options...  replaces it, with the same options as 'run'.
+Input: commandStructure
+*/
+void backgroundPolicyCommand(struct commandStructure* command) {
+    lastExitStatus = 0;
+    if (command->argumentCounter == 1) {
+        printf("Background policy: ");
+        printRunPolicy(&backgroundPolicy);
+    }
+    else if ((command->argumentCounter == 2) && (strcmp(command->arguments[1], "off") == 0)) {
+        memset(&backgroundPolicy, 0, sizeof(backgroundPolicy));
+    }
+    else {
+        struct runPolicy policy = {0};
+        int used = parseRunOptions(&command->arguments[1], command->argumentCounter - 1, &policy);
+        if (used + 1 == command->argumentCounter) {
+            backgroundPolicy = policy;
+        }
+        else {
+            if (used != -1) {
+                printf("Invalid bgpolicy option %s. Use the options of run, or off.\n", command->arguments[used + 1]);
+            }
+            lastExitStatus = 1;
+        }
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,808 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "smallsh.h"
+
+/*
+Server protocol, for 'smallsh --serve socket'.
+Every message either way is a frame: a type byte, the length of the payload as a 4-byte big-endian number,
+then the payload.
+A client sends SERVER_FRAME_COMMAND frames, each holding one or more lines, which run like a script.
+For each one, the server sends SERVER_FRAME_OUTPUT and SERVER_FRAME_ERROR frames as the commands write to
+stdout and stderr, then a SERVER_FRAME_EXIT frame holding the exit status as a 4-byte big-endian number.
+A client's commands run one at a time, in the order sent, so the next can be sent before the last finishes.
+*/
+#define SERVER_FRAME_COMMAND 'C'
+#define SERVER_FRAME_OUTPUT 'O'
+#define SERVER_FRAME_ERROR 'E'
+#define SERVER_FRAME_EXIT 'X'
+#define SERVER_FRAME_HEADER 5
+// Largest command frame accepted. A client that sends a bigger one is disconnected.
+#define SERVER_REQUEST_LIMIT (1024 * 1024)
+// Output waiting for a slow client, past which its worker's pipes are not read, so the worker blocks.
+#define SERVER_OUTPUT_LIMIT (256 * 1024)
+
+/*
+Kinds of fd in the server's epoll set. Each is a struct eventSource, whose data points at its client or worker.
+*/
+#define SERVER_LISTEN 0
+#define SERVER_SIGNAL 1
+#define SERVER_CLIENT 2
+#define SERVER_WORKER_OUTPUT 3
+#define SERVER_WORKER_ERROR 4
+#define SERVER_WORKER_STATUS 5
+
+/*
+Structure for one command being run for a client, by a forked copy of the server.
+The worker writes its stdout and stderr to two pipes, and its working directory to a third when it finishes.
+The request is over once all three pipes are closed and the worker has been reaped.
+*/
+struct serverWorker {
+    pid_t processID;
+    struct eventSource outputSource;
+    struct eventSource errorSource;
+    struct eventSource statusSource;
+    int openPipes;
+    int reaped;
+    int exitStatus;
+    char directory[4096];
+    size_t directoryLength;
+    struct serverClient* client;
+};
+
+/*
+Structure for one connected client.
+Bytes read from the client wait in input until they make a whole frame. Frames to send wait in output,
+from outputStart to outputEnd. Each client has its own working directory, which 'cd' in its commands changes.
+*/
+struct serverClient {
+    struct eventSource source;
+    char* directory;
+    char* input;
+    size_t inputLength;
+    size_t inputCapacity;
+    char* output;
+    size_t outputStart;
+    size_t outputEnd;
+    size_t outputCapacity;
+    // The client has shut down its side for writing. Its commands still run, and it is closed when idle.
+    int inputClosed;
+    struct serverWorker* worker;
+    // Set while the client has a command waiting for a free worker, in the queue through nextWaiting.
+    int waiting;
+    struct serverClient* nextWaiting;
+};
+
+/*
+Server globals.
+*/
+int serverEpollFd = -1;
+char* serverSocketPath = NULL;
+struct eventSource serverListenSource = {SERVER_LISTEN, -1, NULL, NULL};
+struct eventSource serverSignalSource = {SERVER_SIGNAL, -1, NULL, NULL};
+struct serverClient** serverClients = NULL;
+int serverClientCount = 0;
+int serverClientCapacity = 0;
+// Most commands run at once. Commands past it wait in a queue, first come first served.
+int serverWorkerLimit = 1;
+int serverWorkerCount = 0;
+struct serverClient* firstWaitingClient = NULL;
+struct serverClient* lastWaitingClient = NULL;
+// Clients closed during one batch of events, freed after it, since a later event in the batch may name them.
+struct serverClient* closedClients = NULL;
+
+
+
+int queueClientRequest(struct serverClient* client);
+
+
+
+/*
+Adds an fd to the server's epoll set, or changes the events watched if it is there already.
+*/
+void watchServerSource(struct eventSource* source, unsigned int events, int operation) {
+    struct epoll_event event = {0};
+
+    event.events = events;
+    event.data.ptr = source;
+    epoll_ctl(serverEpollFd, operation, source->fd, &event);
+}
+
+
+
+/*
+Watches a client for input while it can take another frame, and for writing while it has output waiting.
+*/
+void updateClientEvents(struct serverClient* client) {
+    unsigned int events = 0;
+
+    if ((client->inputClosed == 0) && (client->inputLength < SERVER_REQUEST_LIMIT + SERVER_FRAME_HEADER)) {
+        events |= EPOLLIN;
+    }
+    if (client->outputEnd > client->outputStart) {
+        events |= EPOLLOUT;
+    }
+    watchServerSource(&client->source, events, EPOLL_CTL_MOD);
+}
+
+
+
+/*
+Reads a worker's output pipes only while its client is keeping up, so a slow client slows its worker down
+instead of growing the server.
+*/
+void updateWorkerEvents(struct serverWorker* worker) {
+    struct serverClient* client = worker->client;
+    unsigned int events = ((client->outputEnd - client->outputStart) < SERVER_OUTPUT_LIMIT) ? EPOLLIN : 0;
+
+    if (worker->outputSource.fd != -1) {
+        watchServerSource(&worker->outputSource, events, EPOLL_CTL_MOD);
+    }
+    if (worker->errorSource.fd != -1) {
+        watchServerSource(&worker->errorSource, events, EPOLL_CTL_MOD);
+    }
+}
+
+
+
+/*
+Adds one frame to a client's output.
+*/
+void appendServerFrame(struct serverClient* client, int frameType, char* payload, size_t payloadLength) {
+    uint32_t networkLength = htonl((uint32_t)payloadLength);
+
+    // Move what is still unsent to the front before growing, so the buffer stays the size of the backlog.
+    if (client->outputStart > 0) {
+        memmove(client->output, &client->output[client->outputStart], client->outputEnd - client->outputStart);
+        client->outputEnd -= client->outputStart;
+        client->outputStart = 0;
+    }
+    if (client->outputEnd + SERVER_FRAME_HEADER + payloadLength > client->outputCapacity) {
+        client->outputCapacity = client->outputEnd + SERVER_FRAME_HEADER + payloadLength + 65536;
+        client->output = realloc(client->output, client->outputCapacity);
+    }
+    client->output[client->outputEnd] = (char)frameType;
+    memcpy(&client->output[client->outputEnd + 1], &networkLength, 4);
+    memcpy(&client->output[client->outputEnd + SERVER_FRAME_HEADER], payload, payloadLength);
+    client->outputEnd += SERVER_FRAME_HEADER + payloadLength;
+}
+
+
+
+/*
+Takes a client out of the list and the epoll set, and closes it. It is freed after the current batch of events.
+*/
+void closeServerClient(struct serverClient* client) {
+    int i = 0;
+
+    for (i; i < serverClientCount; i++) {
+        if (serverClients[i] == client) {
+            serverClients[i] = serverClients[serverClientCount - 1];
+            serverClientCount--;
+            break;
+        }
+    }
+    if (client->source.fd != -1) {
+        epoll_ctl(serverEpollFd, EPOLL_CTL_DEL, client->source.fd, NULL);
+        close(client->source.fd);
+        client->source.fd = -1;
+    }
+    client->nextWaiting = closedClients;
+    closedClients = client;
+}
+
+
+
+/*
+Frees the clients closed during the last batch of events.
+*/
+void freeClosedClients() {
+    while (closedClients != NULL) {
+        struct serverClient* client = closedClients;
+        closedClients = client->nextWaiting;
+        free(client->directory);
+        free(client->input);
+        free(client->output);
+        free(client);
+    }
+}
+
+
+
+/*
+Drops a client that has gone away, or broken the protocol. A command it is running is sent SIGTERM, along
+with everything it started, and the client is freed once the worker has finished. A waiting command is dropped.
+*/
+void disconnectServerClient(struct serverClient* client) {
+    if (client->waiting == 1) {
+        struct serverClient** link = &firstWaitingClient;
+        lastWaitingClient = NULL;
+        while (*link != NULL) {
+            if (*link == client) {
+                *link = client->nextWaiting;
+                continue;
+            }
+            lastWaitingClient = *link;
+            link = &(*link)->nextWaiting;
+        }
+        client->waiting = 0;
+    }
+
+    if (client->worker == NULL) {
+        closeServerClient(client);
+        return;
+    }
+    kill(-client->worker->processID, SIGTERM);
+    epoll_ctl(serverEpollFd, EPOLL_CTL_DEL, client->source.fd, NULL);
+    close(client->source.fd);
+    client->source.fd = -1;
+    client->inputClosed = 1;
+    client->outputStart = client->outputEnd;
+    updateWorkerEvents(client->worker);
+}
+
+
+
+/*
+Sends as much of a client's output as the socket takes without blocking.
+Returns 0, or -1 if the client has gone away and was disconnected.
+*/
+int flushServerClient(struct serverClient* client) {
+    // A client closed earlier in the same event, like by a failed worker start, has nothing left to send to.
+    if (client->source.fd == -1) {
+        return -1;
+    }
+    while (client->outputEnd > client->outputStart) {
+        ssize_t bytesSent = send(client->source.fd, &client->output[client->outputStart], \
+                client->outputEnd - client->outputStart, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if ((bytesSent == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if ((bytesSent == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        }
+        if (bytesSent == -1) {
+            disconnectServerClient(client);
+            return -1;
+        }
+        client->outputStart += bytesSent;
+    }
+
+    // A client that has stopped sending is closed once its last command has finished and been sent.
+    if ((client->inputClosed == 1) && (client->worker == NULL) && (client->waiting == 0) \
+            && (client->outputEnd == client->outputStart)) {
+        closeServerClient(client);
+        return -1;
+    }
+    updateClientEvents(client);
+    if (client->worker != NULL) {
+        updateWorkerEvents(client->worker);
+    }
+    return 0;
+}
+
+
+
+/*
+Runs one command for a client, in the forked worker. Never returns.
+The worker gets its own process group, so a disconnect can stop everything it started, and a Ctrl-C meant
+for the server does not reach it. It drops the server's fds, runs the command in the client's directory
+with stdout and stderr on the pipes, and writes the directory it ended in to the status pipe.
+*/
+void runServerRequest(struct serverClient* client, char* commandText, size_t commandLength, \
+        int outputFd, int errorFd, int statusFd) {
+    sigset_t terminateSignal;
+    int i = 0;
+
+    setpgid(0, 0);
+    sigemptyset(&terminateSignal);
+    sigaddset(&terminateSignal, SIGTERM);
+    sigprocmask(SIG_UNBLOCK, &terminateSignal, NULL);
+
+    close(serverEpollFd);
+    close(serverListenSource.fd);
+    for (i; i < serverClientCount; i++) {
+        struct serverWorker* worker = serverClients[i]->worker;
+        if (serverClients[i]->source.fd != -1) {
+            close(serverClients[i]->source.fd);
+        }
+        if (worker != NULL) {
+            close(worker->outputSource.fd);
+            close(worker->errorSource.fd);
+            close(worker->statusSource.fd);
+        }
+    }
+    detachForkedShell();
+
+    dup2(openDevNull(), STDIN_FILENO);
+    dup2(outputFd, STDOUT_FILENO);
+    dup2(errorFd, STDERR_FILENO);
+    close(outputFd);
+    close(errorFd);
+
+    resetArena(&commandArena);
+    if (chdir(client->directory) == -1) {
+        printf("smallsh: cannot change to directory '%s'.\n", client->directory);
+        fflush(stdout);
+        lastExitStatus = 1;
+    }
+    else {
+        char* inputCommand = arenaAllocate(&commandArena, commandLength + 2);
+        struct controlNode* program;
+        memcpy(inputCommand, commandText, commandLength);
+        inputCommand[commandLength] = '\n';
+        inputCommand[commandLength + 1] = '\0';
+
+        int compileResult = compileControl(inputCommand, &program);
+        if (compileResult == CONTROL_INCOMPLETE) {
+            printf("Unexpected end of input. Please try again.\n");
+            fflush(stdout);
+        }
+        if (compileResult != CONTROL_COMPLETE) {
+            lastExitStatus = 2;
+        }
+        else if (program != NULL) {
+            foregroundInterrupted = 0;
+            runControl(program);
+        }
+    }
+    fflush(stdout);
+
+    char directory[4096];
+    if (getcwd(directory, sizeof(directory)) != NULL) {
+        write(statusFd, directory, strlen(directory));
+    }
+    close(statusFd);
+    exitShell(lastExitStatus);
+}
+
+
+
+/*
+Starts a worker for the command frame at the front of a client's input, and removes the frame.
+If no worker can be forked, the client gets an error message and exit status 1 instead.
+*/
+void startServerWorker(struct serverClient* client) {
+    uint32_t networkLength;
+    int outputPipe[2];
+    int errorPipe[2];
+    int statusPipe[2];
+
+    memcpy(&networkLength, &client->input[1], 4);
+    size_t frameLength = SERVER_FRAME_HEADER + ntohl(networkLength);
+
+    pid_t processID = -1;
+    if (pipe2(outputPipe, O_CLOEXEC) == 0) {
+        if (pipe2(errorPipe, O_CLOEXEC) == 0) {
+            if (pipe2(statusPipe, O_CLOEXEC) == 0) {
+                processID = fork();
+                if (processID == 0) {
+                    close(outputPipe[0]);
+                    close(errorPipe[0]);
+                    close(statusPipe[0]);
+                    runServerRequest(client, &client->input[SERVER_FRAME_HEADER], frameLength - SERVER_FRAME_HEADER, \
+                            outputPipe[1], errorPipe[1], statusPipe[1]);
+                }
+                // Set here too, so the group exists for kill(-processID) even before the worker has run.
+                if (processID > 0) {
+                    setpgid(processID, processID);
+                }
+                close(statusPipe[1]);
+                if (processID == -1) {
+                    close(statusPipe[0]);
+                }
+            }
+            close(errorPipe[1]);
+            if (processID == -1) {
+                close(errorPipe[0]);
+            }
+        }
+        close(outputPipe[1]);
+        if (processID == -1) {
+            close(outputPipe[0]);
+        }
+    }
+
+    client->inputLength -= frameLength;
+    memmove(client->input, &client->input[frameLength], client->inputLength);
+
+    if (processID == -1) {
+        char message[] = "smallsh: cannot start a worker for the command.\n";
+        uint32_t networkStatus = htonl(1);
+        appendServerFrame(client, SERVER_FRAME_ERROR, message, strlen(message));
+        appendServerFrame(client, SERVER_FRAME_EXIT, (char*)&networkStatus, 4);
+        if (queueClientRequest(client) == 0) {
+            flushServerClient(client);
+        }
+        return;
+    }
+
+    struct serverWorker* worker = calloc(1, sizeof(struct serverWorker));
+    worker->processID = processID;
+    worker->client = client;
+    worker->openPipes = 3;
+    worker->outputSource = (struct eventSource){SERVER_WORKER_OUTPUT, outputPipe[0], NULL, worker};
+    worker->errorSource = (struct eventSource){SERVER_WORKER_ERROR, errorPipe[0], NULL, worker};
+    worker->statusSource = (struct eventSource){SERVER_WORKER_STATUS, statusPipe[0], NULL, worker};
+    fcntl(outputPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(errorPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(statusPipe[0], F_SETFL, O_NONBLOCK);
+    watchServerSource(&worker->outputSource, EPOLLIN, EPOLL_CTL_ADD);
+    watchServerSource(&worker->errorSource, EPOLLIN, EPOLL_CTL_ADD);
+    watchServerSource(&worker->statusSource, EPOLLIN, EPOLL_CTL_ADD);
+    client->worker = worker;
+    serverWorkerCount++;
+}
+
+
+
+/*
+Starts commands from the front of the queue while there are free workers.
+A command whose worker cannot be started queues the client's next one, which this loop then picks up
+instead of starting it from inside.
+*/
+void startWaitingRequests() {
+    static int startingRequests = 0;
+
+    if (startingRequests == 1) {
+        return;
+    }
+    startingRequests = 1;
+    while ((serverWorkerCount < serverWorkerLimit) && (firstWaitingClient != NULL)) {
+        struct serverClient* client = firstWaitingClient;
+        firstWaitingClient = client->nextWaiting;
+        if (firstWaitingClient == NULL) {
+            lastWaitingClient = NULL;
+        }
+        client->waiting = 0;
+        startServerWorker(client);
+        if (client->source.fd != -1) {
+            updateClientEvents(client);
+        }
+    }
+    startingRequests = 0;
+}
+
+
+
+/*
+Looks for the next whole command frame from a client that is not running or waiting for one, and queues it.
+A frame that is too big, or is not a command, disconnects the client.
+Returns 0, or -1 if the client was disconnected.
+*/
+int queueClientRequest(struct serverClient* client) {
+    uint32_t networkLength;
+
+    if ((client->worker != NULL) || (client->waiting == 1) || (client->inputLength < SERVER_FRAME_HEADER)) {
+        return 0;
+    }
+    memcpy(&networkLength, &client->input[1], 4);
+    if ((client->input[0] != SERVER_FRAME_COMMAND) || (ntohl(networkLength) > SERVER_REQUEST_LIMIT)) {
+        disconnectServerClient(client);
+        return -1;
+    }
+    if (client->inputLength < SERVER_FRAME_HEADER + ntohl(networkLength)) {
+        return 0;
+    }
+
+    client->waiting = 1;
+    client->nextWaiting = NULL;
+    if (lastWaitingClient != NULL) {
+        lastWaitingClient->nextWaiting = client;
+    }
+    else {
+        firstWaitingClient = client;
+    }
+    lastWaitingClient = client;
+    startWaitingRequests();
+    return 0;
+}
+
+
+
+/*
+Ends a request once the worker has been reaped and its pipes are all closed: the exit status is sent,
+the client takes on the directory the worker ended in, and its next command is queued.
+*/
+void finishServerWorker(struct serverWorker* worker) {
+    struct serverClient* client = worker->client;
+
+    if ((worker->openPipes > 0) || (worker->reaped == 0)) {
+        return;
+    }
+    client->worker = NULL;
+    serverWorkerCount--;
+
+    if (client->source.fd == -1) {
+        closeServerClient(client);
+    }
+    else {
+        uint32_t networkStatus = htonl((uint32_t)worker->exitStatus);
+        appendServerFrame(client, SERVER_FRAME_EXIT, (char*)&networkStatus, 4);
+        // A worker that left through 'exit' reports no directory, and the client keeps the one it had.
+        if (worker->directoryLength > 0) {
+            free(client->directory);
+            client->directory = strndup(worker->directory, worker->directoryLength);
+        }
+        if (queueClientRequest(client) == 0) {
+            flushServerClient(client);
+        }
+    }
+    free(worker);
+    startWaitingRequests();
+}
+
+
+
+/*
+Reads what a worker has written to one of its pipes. Output is passed on to the client as frames, and the
+status pipe collects the worker's directory. A closed pipe is taken out of the epoll set.
+*/
+void readWorkerPipe(struct eventSource* source) {
+    struct serverWorker* worker = source->data;
+    char readBuffer[65536];
+    ssize_t bytesRead;
+
+    while (1) {
+        if (source->type == SERVER_WORKER_STATUS) {
+            bytesRead = read(source->fd, &worker->directory[worker->directoryLength], \
+                    sizeof(worker->directory) - 1 - worker->directoryLength);
+        }
+        else {
+            bytesRead = read(source->fd, readBuffer, sizeof(readBuffer));
+        }
+        if ((bytesRead == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if ((bytesRead == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            return;
+        }
+        if (bytesRead <= 0) {
+            break;
+        }
+
+        if (source->type == SERVER_WORKER_STATUS) {
+            worker->directoryLength += bytesRead;
+        }
+        else if (worker->client->source.fd != -1) {
+            appendServerFrame(worker->client, (source->type == SERVER_WORKER_OUTPUT) ? SERVER_FRAME_OUTPUT : SERVER_FRAME_ERROR, \
+                    readBuffer, bytesRead);
+            if (flushServerClient(worker->client) == -1) {
+                return;
+            }
+            if ((worker->client->outputEnd - worker->client->outputStart) >= SERVER_OUTPUT_LIMIT) {
+                return;
+            }
+        }
+    }
+
+    epoll_ctl(serverEpollFd, EPOLL_CTL_DEL, source->fd, NULL);
+    close(source->fd);
+    source->fd = -1;
+    worker->openPipes--;
+    finishServerWorker(worker);
+}
+
+
+
+/*
+Reads what a client has sent, and queues its next command once a whole frame has arrived.
+*/
+void readServerClient(struct serverClient* client) {
+    while (client->inputLength < SERVER_REQUEST_LIMIT + SERVER_FRAME_HEADER) {
+        if (client->inputLength == client->inputCapacity) {
+            client->inputCapacity = (client->inputCapacity == 0) ? 4096 : client->inputCapacity * 2;
+            client->input = realloc(client->input, client->inputCapacity);
+        }
+        ssize_t bytesRead = read(client->source.fd, &client->input[client->inputLength], client->inputCapacity - client->inputLength);
+        if ((bytesRead == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if ((bytesRead == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        }
+        if (bytesRead == -1) {
+            disconnectServerClient(client);
+            return;
+        }
+        if (bytesRead == 0) {
+            client->inputClosed = 1;
+            break;
+        }
+        client->inputLength += bytesRead;
+    }
+
+    if (queueClientRequest(client) == 0) {
+        flushServerClient(client);
+    }
+}
+
+
+
+/*
+Accepts every waiting connection. A new client starts in the directory the server was started in.
+*/
+void acceptServerClients(char* startDirectory) {
+    int clientFd;
+
+    while ((clientFd = accept4(serverListenSource.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        struct serverClient* client = calloc(1, sizeof(struct serverClient));
+        client->source = (struct eventSource){SERVER_CLIENT, clientFd, NULL, client};
+        client->directory = strdup(startDirectory);
+        if (serverClientCount == serverClientCapacity) {
+            serverClientCapacity = (serverClientCapacity == 0) ? 64 : serverClientCapacity * 2;
+            serverClients = realloc(serverClients, serverClientCapacity * sizeof(struct serverClient*));
+        }
+        serverClients[serverClientCount] = client;
+        serverClientCount++;
+        watchServerSource(&client->source, EPOLLIN, EPOLL_CTL_ADD);
+    }
+}
+
+
+
+/*
+Reads the server's signals. SIGCHLD reaps finished workers. SIGINT or SIGTERM stops the server: every
+running command is sent SIGTERM, and the socket is removed. SIGTSTP is ignored.
+*/
+void handleServerSignals() {
+    struct signalfd_siginfo signalInfo;
+    int i = 0;
+
+    while (read(shellSignalFd, &signalInfo, sizeof(signalInfo)) == sizeof(signalInfo)) {
+        if ((signalInfo.ssi_signo == SIGINT) || (signalInfo.ssi_signo == SIGTERM)) {
+            for (i = 0; i < serverClientCount; i++) {
+                if (serverClients[i]->worker != NULL) {
+                    kill(-serverClients[i]->worker->processID, SIGTERM);
+                }
+            }
+            unlink(serverSocketPath);
+            exit(0);
+        }
+    }
+
+    pid_t processID;
+    int childExit;
+    while ((processID = waitpid(-1, &childExit, WNOHANG)) > 0) {
+        for (i = 0; i < serverClientCount; i++) {
+            struct serverWorker* worker = serverClients[i]->worker;
+            if ((worker != NULL) && (worker->processID == processID)) {
+                worker->reaped = 1;
+                worker->exitStatus = WIFEXITED(childExit) ? WEXITSTATUS(childExit) : 128 + WTERMSIG(childExit);
+                finishServerWorker(worker);
+                break;
+            }
+        }
+    }
+}
+
+
+
+/*
+Opens the listening socket. A socket file left by a server that is no longer running is replaced.
+The socket file is made with mode 0600, since whoever can connect can run commands as this user.
+Returns the fd, or -1 with a message printed.
+*/
+int openServerSocket(char* socketPath) {
+    struct sockaddr_un address = {0};
+
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "smallsh: socket path '%s' is too long.\n", socketPath);
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        fprintf(stderr, "smallsh: cannot open a socket for '%s': %s\n", socketPath, strerror(errno));
+        return -1;
+    }
+
+    mode_t oldMask = umask(077);
+    int bindResult = bind(listenFd, (struct sockaddr*)&address, sizeof(address));
+    if ((bindResult == -1) && (errno == EADDRINUSE)) {
+        int probeFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int inUse = (connect(probeFd, (struct sockaddr*)&address, sizeof(address)) == 0);
+        close(probeFd);
+        if (inUse == 1) {
+            umask(oldMask);
+            close(listenFd);
+            fprintf(stderr, "smallsh: socket '%s' is already being served.\n", socketPath);
+            return -1;
+        }
+        unlink(socketPath);
+        bindResult = bind(listenFd, (struct sockaddr*)&address, sizeof(address));
+    }
+    umask(oldMask);
+    if ((bindResult == -1) || (listen(listenFd, 128) == -1)) {
+        fprintf(stderr, "smallsh: cannot listen on '%s': %s\n", socketPath, strerror(errno));
+        close(listenFd);
+        return -1;
+    }
+    return listenFd;
+}
+
+
+
+/*
+Runs the shell as a command server on a Unix socket, for 'smallsh --serve socket [-j workers]'. Never returns.
+Each command frame a client sends is run by a forked worker with the same control flow, builtins and spawn
+engines as the prompt, and its output is streamed back as it is written. At most workerLimit commands run at
+once. Each client has its own working directory, and everything else a command changes, like variables or
+'set -e', lasts only for that command.
+*/
+void serveCommands(char* socketPath, int workerLimit) {
+    struct epoll_event events[64];
+    char startDirectory[4096];
+    sigset_t serverSignals;
+    int i = 0;
+
+    if (getcwd(startDirectory, sizeof(startDirectory)) == NULL) {
+        strcpy(startDirectory, "/");
+    }
+    serverSocketPath = socketPath;
+    serverWorkerLimit = workerLimit;
+    serverListenSource.fd = openServerSocket(socketPath);
+    if (serverListenSource.fd == -1) {
+        exit(1);
+    }
+
+    // SIGTERM stops the server the same way SIGINT does, so it is read from the signalfd too.
+    sigemptyset(&serverSignals);
+    sigaddset(&serverSignals, SIGINT);
+    sigaddset(&serverSignals, SIGTSTP);
+    sigaddset(&serverSignals, SIGCHLD);
+    sigaddset(&serverSignals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &serverSignals, NULL);
+    signalfd(shellSignalFd, &serverSignals, 0);
+
+    serverEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    serverSignalSource.fd = shellSignalFd;
+    watchServerSource(&serverListenSource, EPOLLIN, EPOLL_CTL_ADD);
+    watchServerSource(&serverSignalSource, EPOLLIN, EPOLL_CTL_ADD);
+    fprintf(stderr, "smallsh: serving on %s with up to %d workers\n", socketPath, workerLimit);
+
+    while (1) {
+        int eventCount = epoll_wait(serverEpollFd, events, 64, -1);
+        for (i = 0; i < eventCount; i++) {
+            struct eventSource* source = events[i].data.ptr;
+
+            if (source->type == SERVER_LISTEN) {
+                acceptServerClients(startDirectory);
+            }
+            else if (source->type == SERVER_SIGNAL) {
+                handleServerSignals();
+            }
+            else if (source->fd == -1) {
+                continue;
+            }
+            else if (source->type == SERVER_CLIENT) {
+                struct serverClient* client = source->data;
+                if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0) {
+                    disconnectServerClient(client);
+                }
+                else if ((events[i].events & EPOLLIN) != 0) {
+                    readServerClient(client);
+                }
+                else if ((events[i].events & EPOLLOUT) != 0) {
+                    flushServerClient(client);
+                }
+            }
+            else {
+                readWorkerPipe(source);
+            }
+        }
+        freeClosedClients();
+    }
+}
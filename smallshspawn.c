@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "smallsh.h"
+
+/*
+Spawn engine globals.
+*/
+// posix_spawn (glibc implements it with clone(CLONE_VM|CLONE_VFORK), so no page tables are copied).
+#define SPAWN_ENGINE_POSIX 0
+// Plain fork() and execve(). Kept as a fallback and for comparison.
+#define SPAWN_ENGINE_FORK 1
+// A small helper forked at startup spawns for the shell, so spawn cost does not grow with the shell (smallshzygote.c).
+#define SPAWN_ENGINE_ZYGOTE 2
+// Engine used by spawnCommand. Set with the 'spawnengine' command or SMALLSH_SPAWN environment variable.
+int spawnEngine = SPAWN_ENGINE_POSIX;
+// Number of spawns and total time spent in them, per engine, for 'spawnengine' to report.
+long long spawnCount[3] = {0, 0, 0};
+long long spawnNanoseconds[3] = {0, 0, 0};
+
+
+
+/*
+Prints the message for a child that could not be started.
+Out of process or memory errors are spawning errors, everything else is treated as an invalid program,
+matching what the child would have printed if exec failed after fork.
+A negative errorNumber is a run policy that the child could not apply, from spawnWithRunPolicy.
+*/
+void printSpawnError(int errorNumber, int background) {
+    if (errorNumber < 0) {
+        printf("Could not apply run policy: %s. Please try again.\n", strerror(-errorNumber));
+    }
+    else if ((errorNumber == EAGAIN) || (errorNumber == ENOMEM)) {
+        printf("Error spawning child. Please try again.");
+    }
+    else if (background == 1) {
+        printf("Invalid background program. Please try again.\n");
+    }
+    else {
+        printf("Invalid command. Please try again.\n");
+    }
+    fflush(stdout);
+}
+
+
+
+/*
+Starts a child with posix_spawn, for a program path already found by lookupCommandPath, with the given environment.
+Redirections are file actions that dup the given fds over stdin, stdout and stderr.
+Signal dispositions are spawn attributes: an empty signal mask, and SIGINT back to default for the foreground.
+Foreground children must also ignore SIGTSTP, and background children SIGINT. posix_spawn cannot ask for SIG_IGN,
+but ignored signals stay ignored across exec, so the shell ignores that signal just for the length of the spawn.
+The shell keeps it blocked for its signalfd, so at most one pending copy is lost meanwhile.
+Returns the child pid, or -1 if it could not be started.
+*/
+pid_t spawnWithPosixSpawn(struct commandStructure* stage, char* programPath, char** environment, int childFds[3], \
+        int background) {
+    posix_spawn_file_actions_t fileActions;
+    posix_spawnattr_t spawnAttributes;
+    sigset_t childMask;
+    sigset_t defaultSignals;
+    pid_t childPID = -1;
+    int i = 0;
+
+    posix_spawn_file_actions_init(&fileActions);
+    for (i; i < 3; i++) {
+        if (childFds[i] != -1) {
+            posix_spawn_file_actions_adddup2(&fileActions, childFds[i], i);
+        }
+    }
+
+    posix_spawnattr_init(&spawnAttributes);
+    sigemptyset(&childMask);
+    sigemptyset(&defaultSignals);
+    if (background == 0) {
+        sigaddset(&defaultSignals, SIGINT);
+    }
+    posix_spawnattr_setsigmask(&spawnAttributes, &childMask);
+    posix_spawnattr_setsigdefault(&spawnAttributes, &defaultSignals);
+    posix_spawnattr_setflags(&spawnAttributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    struct sigaction ignoreAction = {0};
+    struct sigaction savedAction;
+    int ignoredSignal = (background == 0) ? SIGTSTP : SIGINT;
+    ignoreAction.sa_handler = SIG_IGN;
+    sigaction(ignoredSignal, &ignoreAction, &savedAction);
+
+    int spawnResult = posix_spawn(&childPID, programPath, &fileActions, &spawnAttributes, \
+            stage->arguments, environment);
+
+    sigaction(ignoredSignal, &savedAction, NULL);
+
+    posix_spawnattr_destroy(&spawnAttributes);
+    posix_spawn_file_actions_destroy(&fileActions);
+
+    if (spawnResult != 0) {
+        printSpawnError(spawnResult, background);
+        return -1;
+    }
+    return childPID;
+}
+
+
+
+/*
+Starts a child with fork() and execve(), for a program path already found by lookupCommandPath, with the given environment.
+The child sets its own signal handlers and mask, and dups the given fds over stdin, stdout and stderr before exec.
+Returns the child pid, or -1 if fork failed. Exec failures are reported by the child, which exits with 1.
+*/
+pid_t spawnWithFork(struct commandStructure* stage, char* programPath, char** environment, int childFds[3], int background) {
+    pid_t childPID = fork();
+    int i = 0;
+
+    switch(childPID) {
+        // Errors
+        case -1:
+            printSpawnError(errno, background);
+            return -1;
+
+        // Success
+        case 0:
+            if (background == 0) {
+                setSignalsForegroundChild();
+            }
+            else {
+                setSignalsBackgroundChild();
+            }
+            for (i; i < 3; i++) {
+                if (childFds[i] != -1) {
+                    dup2(childFds[i], i);
+                }
+            }
+
+            execve(programPath, stage->arguments, environment);
+
+            // Error message and exit if program is invalid.
+            printSpawnError(errno, background);
+            exit(1);
+    }
+
+    return childPID;
+}
+
+
+
+/*
+Starts a forked copy of the shell to run a builtin, like 'jobs' or 'history', as one stage of a pipeline.
+The copy lets go of the shell's event loop, zygote and jobs, takes the signals of any other child, and runs
+the builtin with the given fds over stdin, stdout and stderr. Its exit status is the builtin's.
+Returns the child pid, or -1 if fork failed.
+*/
+pid_t spawnShellBuiltin(struct commandStructure* stage, int childFds[3], int background) {
+    int i = 0;
+
+    // Anything still buffered would be written twice, once by each copy of the shell.
+    fflush(stdout);
+    pid_t childPID = fork();
+    if (childPID == -1) {
+        printSpawnError(errno, background);
+        return -1;
+    }
+    if (childPID == 0) {
+        // 'jobs' only reads the job table, so it keeps the parent's, to list them. Other builtins let go of it,
+        // so 'exit' or 'wait' in the copy cannot touch the parent's jobs.
+        if (strcmp(stage->command, "jobs") != 0) {
+            detachForkedShell();
+        }
+        if (background == 0) {
+            setSignalsForegroundChild();
+        }
+        else {
+            setSignalsBackgroundChild();
+        }
+        for (i; i < 3; i++) {
+            if (childFds[i] != -1) {
+                dup2(childFds[i], i);
+            }
+        }
+        runShellBuiltin(stage);
+        fflush(stdout);
+        _exit(lastExitStatus);
+    }
+    return childPID;
+}
+
+
+
+/*
+Starts a child with fork(), applies a run policy to it, and execs the program with the given environment. posix_spawn cannot set
+affinity, nice, I/O priority or limits, so children with a policy are started this way instead.
+The child puts the signals in defaultSignals back to default, ignores SIGTSTP in the foreground
+and SIGINT in the background, clears its signal mask and dups childFds (-1 to keep) over stdin, stdout and stderr.
+Failures in the child come back over a close-on-exec pipe, so they are reported like a posix_spawn error:
+spawnError is the errno of a failed exec, or minus the errno of a policy setting that failed.
+Used by the shell, and by the zygote for its own children.
+Returns the child PID, or -1 with the error in spawnError.
+*/
+pid_t spawnWithRunPolicy(char* programPath, char** arguments, char** environment, int childFds[3], int background, \
+        sigset_t* defaultSignals, struct runPolicy* policy, int* spawnError) {
+    int errorPipe[2];
+    int childError = 0;
+    int i = 0;
+
+    if (pipe2(errorPipe, O_CLOEXEC) == -1) {
+        *spawnError = errno;
+        return -1;
+    }
+
+    pid_t childPID = fork();
+    if (childPID == -1) {
+        *spawnError = errno;
+        close(errorPipe[0]);
+        close(errorPipe[1]);
+        return -1;
+    }
+
+    if (childPID == 0) {
+        struct sigaction signalAction = {0};
+        sigset_t childMask;
+        int signalNumber = 1;
+
+        signalAction.sa_handler = SIG_DFL;
+        for (signalNumber; signalNumber < NSIG; signalNumber++) {
+            if (sigismember(defaultSignals, signalNumber) == 1) {
+                sigaction(signalNumber, &signalAction, NULL);
+            }
+        }
+        signalAction.sa_handler = SIG_IGN;
+        sigaction((background == 0) ? SIGTSTP : SIGINT, &signalAction, NULL);
+        sigemptyset(&childMask);
+        sigprocmask(SIG_SETMASK, &childMask, NULL);
+
+        childError = -applyRunPolicy(policy);
+        if (childError == 0) {
+            for (i; i < 3; i++) {
+                if (childFds[i] != -1) {
+                    dup2(childFds[i], i);
+                }
+            }
+            execve(programPath, arguments, environment);
+            childError = errno;
+        }
+        write(errorPipe[1], &childError, sizeof(childError));
+        _exit(1);
+    }
+
+    close(errorPipe[1]);
+    while ((read(errorPipe[0], &childError, sizeof(childError)) == -1) && (errno == EINTR)) {
+    }
+    close(errorPipe[0]);
+
+    // Nothing read means exec worked. Otherwise the child has already exited, and is reaped here.
+    if (childError != 0) {
+        while ((waitpid(childPID, NULL, 0) == -1) && (errno == EINTR)) {
+        }
+        *spawnError = childError;
+        return -1;
+    }
+    *spawnError = 0;
+    return childPID;
+}
+
+
+
+/*
+Starts one command, or one stage of a pipeline, with the selected spawn engine.
+childFds are put over stdin, stdout and stderr in the child, or left alone where -1. They come from openRedirects,
+and should be close-on-exec so the child does not keep extra copies open.
+The program is found through the command path cache, so neither engine walks PATH,
+and a command that is not found is reported without starting a child.
+Every engine hands exec the cached environment from shellEnvironment, with the stage's NAME=value words on top.
+A builtin the shell runs itself is started with spawnShellBuiltin whatever the engine, and counted under fork.
+A 'run' prefix or background policy is applied in the child: through the zygote with that engine,
+and with spawnWithRunPolicy otherwise.
+Also times the spawn, for comparing engines with 'spawnengine', and traces it. A child with a run policy is
+forked whatever the engine, by the shell or inside the zygote, so its spawn is counted under fork.
+posix_spawn and the zygote only return once exec has worked, so for them the trace also gets an exec event.
+A forked child has not exec'ed yet when fork returns, so the fork engine records none.
+spawnWithRunPolicy waits for the exec, so children with a run policy get one with every engine.
+Returns the child pid, or -1 if it could not be started (message already printed).
+*/
+pid_t spawnCommand(struct commandStructure* stage, int childFds[3], int background) {
+    struct timespec spawnStart;
+    struct timespec spawnEnd;
+    struct runPolicy policy;
+    pid_t childPID;
+
+    TRACE_BEGIN(TRACE_SPAWN);
+    clock_gettime(CLOCK_MONOTONIC, &spawnStart);
+    int hasPolicy = effectiveRunPolicy(background, &policy);
+    int shellBuiltin = isShellBuiltin(stage->command);
+    char* programPath = (shellBuiltin == 1) ? NULL : lookupCommandPath(stage->command);
+    char** environment = commandEnvironment(stage);
+    if (shellBuiltin == 1) {
+        childPID = spawnShellBuiltin(stage, childFds, background);
+    }
+    else if (programPath == NULL) {
+        printSpawnError(ENOENT, background);
+        childPID = -1;
+    }
+    else if (spawnEngine == SPAWN_ENGINE_ZYGOTE) {
+        childPID = spawnWithZygote(stage, programPath, environment, childFds, background, hasPolicy ? &policy : NULL);
+    }
+    else if (hasPolicy == 1) {
+        sigset_t defaultSignals;
+        int spawnError;
+        sigemptyset(&defaultSignals);
+        if (background == 0) {
+            sigaddset(&defaultSignals, SIGINT);
+        }
+        childPID = spawnWithRunPolicy(programPath, stage->arguments, environment, childFds, background, &defaultSignals, \
+                &policy, &spawnError);
+        if (childPID == -1) {
+            printSpawnError(spawnError, background);
+        }
+    }
+    else if (spawnEngine == SPAWN_ENGINE_FORK) {
+        childPID = spawnWithFork(stage, programPath, environment, childFds, background);
+    }
+    else {
+        childPID = spawnWithPosixSpawn(stage, programPath, environment, childFds, background);
+    }
+    restoreEnvironment(stage);
+    clock_gettime(CLOCK_MONOTONIC, &spawnEnd);
+
+    int usedEngine = ((hasPolicy == 1) || (shellBuiltin == 1)) ? SPAWN_ENGINE_FORK : spawnEngine;
+    spawnCount[usedEngine]++;
+    spawnNanoseconds[usedEngine] += (spawnEnd.tv_sec - spawnStart.tv_sec) * 1000000000LL \
+            + (spawnEnd.tv_nsec - spawnStart.tv_nsec);
+
+    TRACE_END(TRACE_SPAWN, childPID, background, stage->command);
+    if ((childPID != -1) && (shellBuiltin == 0) && ((spawnEngine != SPAWN_ENGINE_FORK) || (hasPolicy == 1))) {
+        TRACE_INSTANT(TRACE_EXEC, childPID, 0, stage->command);
+    }
+    return childPID;
+}
+
+
+
+/*
+Prints the selected spawn engine, and the number of spawns and average spawn latency for each engine.
+*/
+void printSpawnEngine() {
+    char* engineNames[3] = {"posix_spawn", "fork", "zygote"};
+    int i = 0;
+
+    printf("Spawn engine: %s\n", engineNames[spawnEngine]);
+    for (i; i < 3; i++) {
+        if (spawnCount[i] > 0) {
+            printf("%s: %lld spawns, average %.1f us\n", engineNames[i], spawnCount[i], \
+                    (double)spawnNanoseconds[i] / spawnCount[i] / 1000.0);
+        }
+        else {
+            printf("%s: 0 spawns\n", engineNames[i]);
+        }
+    }
+    fflush(stdout);
+}
+
+
+
+/*
+Selects the spawn engine by name, "posix_spawn", "fork" or "zygote".
+Selecting "zygote" starts the helper process if it is not running yet.
+Returns 0 on success, -1 if the name is not an engine or the zygote could not be started.
+*/
+int setSpawnEngine(char* engineName) {
+    if (strcmp(engineName, "posix_spawn") == 0) {
+        spawnEngine = SPAWN_ENGINE_POSIX;
+        return 0;
+    }
+    if (strcmp(engineName, "fork") == 0) {
+        spawnEngine = SPAWN_ENGINE_FORK;
+        return 0;
+    }
+    if ((strcmp(engineName, "zygote") == 0) && (startZygote() == 0)) {
+        spawnEngine = SPAWN_ENGINE_ZYGOTE;
+        return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include "smallsh.h"
+
+// Latency histogram buckets. Bucket k counts runs of at least 2^k and under 2^(k+1) microseconds.
+#define LATENCY_BUCKETS 32
+
+/*
+Structure for the totals of every finished process with one command name.
+Entries in the same bucket are chained through nextEntry.
+*/
+struct commandStats {
+    char* commandName;
+    long long runs;
+    long long totalWallNanoseconds;
+    long long maxWallNanoseconds;
+    double totalUserSeconds;
+    double totalSystemSeconds;
+    long maxResidentKilobytes;
+    long long voluntarySwitches;
+    long long involuntarySwitches;
+    long long latencyHistogram[LATENCY_BUCKETS];
+    struct commandStats* nextEntry;
+};
+
+/*
+Command statistics globals.
+*/
+// Hash table of command name to totals. Bucket count is always a power of 2.
+struct commandStats** commandStatsBuckets = NULL;
+int commandStatsBucketCount = 0;
+int commandStatsCount = 0;
+
+
+
+/*
+Returns the totals for a command name, adding an empty entry if there is none yet.
+Uses the same hash as the command path cache.
+*/
+struct commandStats* findCommandStats(char* commandName) {
+    if ((commandStatsCount + 1) * 4 > commandStatsBucketCount * 3) {
+        int newBucketCount = (commandStatsBucketCount == 0) ? 64 : commandStatsBucketCount * 2;
+        struct commandStats** newBuckets = calloc(newBucketCount, sizeof(struct commandStats*));
+        int i = 0;
+        for (i; i < commandStatsBucketCount; i++) {
+            struct commandStats* entry = commandStatsBuckets[i];
+            while (entry != NULL) {
+                struct commandStats* nextEntry = entry->nextEntry;
+                unsigned int bucket = hashCommandName(entry->commandName) & (newBucketCount - 1);
+                entry->nextEntry = newBuckets[bucket];
+                newBuckets[bucket] = entry;
+                entry = nextEntry;
+            }
+        }
+        free(commandStatsBuckets);
+        commandStatsBuckets = newBuckets;
+        commandStatsBucketCount = newBucketCount;
+    }
+
+    unsigned int bucket = hashCommandName(commandName) & (commandStatsBucketCount - 1);
+    struct commandStats* entry = commandStatsBuckets[bucket];
+    while (entry != NULL) {
+        if (strcmp(entry->commandName, commandName) == 0) {
+            return entry;
+        }
+        entry = entry->nextEntry;
+    }
+
+    entry = calloc(1, sizeof(struct commandStats));
+    entry->commandName = strdup(commandName);
+    entry->nextEntry = commandStatsBuckets[bucket];
+    commandStatsBuckets[bucket] = entry;
+    commandStatsCount++;
+    return entry;
+}
+
+
+
+/*
+Returns the elapsed nanoseconds on the monotonic clock since a start time.
+*/
+long long nanosecondsSince(struct timespec* startTime) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - startTime->tv_sec) * 1000000000LL + (now.tv_nsec - startTime->tv_nsec);
+}
+
+
+
+/*
+Adds one finished process to the totals for its command name.
+Takes input of the command name, the wall time from spawn to reap, and the rusage from wait4.
+*/
+void recordProcessUsage(char* commandName, long long wallNanoseconds, struct rusage* usage) {
+    struct commandStats* entry = findCommandStats(commandName);
+    long long wallMicroseconds = wallNanoseconds / 1000;
+    int bucket = 0;
+
+    entry->runs++;
+    entry->totalWallNanoseconds += wallNanoseconds;
+    if (wallNanoseconds > entry->maxWallNanoseconds) {
+        entry->maxWallNanoseconds = wallNanoseconds;
+    }
+    entry->totalUserSeconds += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+    entry->totalSystemSeconds += usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+    if (usage->ru_maxrss > entry->maxResidentKilobytes) {
+        entry->maxResidentKilobytes = usage->ru_maxrss;
+    }
+    entry->voluntarySwitches += usage->ru_nvcsw;
+    entry->involuntarySwitches += usage->ru_nivcsw;
+
+    while ((wallMicroseconds > 1) && (bucket < LATENCY_BUCKETS - 1)) {
+        wallMicroseconds >>= 1;
+        bucket++;
+    }
+    entry->latencyHistogram[bucket]++;
+}
+
+
+
+/*
+Adds one process's rusage into a running total for a whole command. Max RSS keeps the largest.
+*/
+void addUsage(struct rusage* total, struct rusage* usage) {
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+
+
+/*
+Returns the upper edge, in milliseconds, of the histogram bucket that holds the given fraction of runs.
+The edge is capped at the slowest run, so a percentile never reads higher than max.
+*/
+double latencyPercentile(struct commandStats* entry, double fraction) {
+    long long wanted = (long long)(entry->runs * fraction);
+    long long seen = 0;
+    int bucket = 0;
+
+    for (bucket; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += entry->latencyHistogram[bucket];
+        if (seen > wanted) {
+            break;
+        }
+    }
+    double edgeMilliseconds = (double)(2LL << bucket) / 1000.0;
+    if (edgeMilliseconds > entry->maxWallNanoseconds / 1e6) {
+        edgeMilliseconds = entry->maxWallNanoseconds / 1e6;
+    }
+    return edgeMilliseconds;
+}
+
+
+
+/*
+Comparison function for sorting commands by total wall time, largest first.
+*/
+int compareCommandStats(const void* first, const void* second) {
+    long long a = (*(struct commandStats* const*)first)->totalWallNanoseconds;
+    long long b = (*(struct commandStats* const*)second)->totalWallNanoseconds;
+    return (a < b) - (a > b);
+}
+
+
+
+/*
+Prints the latency histogram for one command.
+*/
+void printLatencyHistogram(struct commandStats* entry) {
+    long long largestBucket = 0;
+    int bucket = 0;
+
+    for (bucket; bucket < LATENCY_BUCKETS; bucket++) {
+        if (entry->latencyHistogram[bucket] > largestBucket) {
+            largestBucket = entry->latencyHistogram[bucket];
+        }
+    }
+
+    printf("%s: %lld runs\n", entry->commandName, entry->runs);
+    for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        if (entry->latencyHistogram[bucket] == 0) {
+            continue;
+        }
+        int barLength = (int)(entry->latencyHistogram[bucket] * 40 / largestBucket);
+        printf("  < %10.3f ms %8lld ", (double)(2LL << bucket) / 1000.0, entry->latencyHistogram[bucket]);
+        while (barLength > 0) {
+            printf("#");
+            barLength--;
+        }
+        printf("\n");
+    }
+}
+
+
+
+/*
+Runs the 'stats' command.
+stats        prints totals for every command name, slowest total first.
+stats name   prints the latency histogram for one command name.
+stats -r     forgets all totals.
+Input: commandStructure
+*/
+void statsCommand(struct commandStructure* command) {
+    int i = 0;
+
+    lastExitStatus = 0;
+    if ((command->argumentCounter == 2) && (strcmp(command->arguments[1], "-r") == 0)) {
+        for (i; i < commandStatsBucketCount; i++) {
+            struct commandStats* entry = commandStatsBuckets[i];
+            while (entry != NULL) {
+                struct commandStats* nextEntry = entry->nextEntry;
+                free(entry->commandName);
+                free(entry);
+                entry = nextEntry;
+            }
+            commandStatsBuckets[i] = NULL;
+        }
+        commandStatsCount = 0;
+        return;
+    }
+
+    if (command->argumentCounter == 2) {
+        if (commandStatsBucketCount > 0) {
+            unsigned int bucket = hashCommandName(command->arguments[1]) & (commandStatsBucketCount - 1);
+            struct commandStats* entry = commandStatsBuckets[bucket];
+            while ((entry != NULL) && (strcmp(entry->commandName, command->arguments[1]) != 0)) {
+                entry = entry->nextEntry;
+            }
+            if (entry != NULL) {
+                printLatencyHistogram(entry);
+                fflush(stdout);
+                return;
+            }
+        }
+        printf("stats: no runs of '%s'\n", command->arguments[1]);
+        fflush(stdout);
+        lastExitStatus = 1;
+        return;
+    }
+
+    // Gather every entry so they can be sorted.
+    struct commandStats** entries = arenaAllocate(&commandArena, (commandStatsCount + 1) * sizeof(struct commandStats*));
+    int entryCount = 0;
+    for (i; i < commandStatsBucketCount; i++) {
+        struct commandStats* entry = commandStatsBuckets[i];
+        while (entry != NULL) {
+            entries[entryCount++] = entry;
+            entry = entry->nextEntry;
+        }
+    }
+    qsort(entries, entryCount, sizeof(struct commandStats*), compareCommandStats);
+
+    printf("%-16s %6s %10s %9s %9s %9s %9s %8s %8s %9s %8s %8s\n", "command", "runs", "total s", "mean ms", \
+            "p50 ms", "p99 ms", "max ms", "user s", "sys s", "maxrss KB", "vcsw", "ivcsw");
+    for (i = 0; i < entryCount; i++) {
+        struct commandStats* entry = entries[i];
+        printf("%-16s %6lld %10.3f %9.3f %9.3f %9.3f %9.3f %8.3f %8.3f %9ld %8lld %8lld\n", entry->commandName, \
+                entry->runs, entry->totalWallNanoseconds / 1e9, entry->totalWallNanoseconds / 1e6 / entry->runs, \
+                latencyPercentile(entry, 0.5), latencyPercentile(entry, 0.99), entry->maxWallNanoseconds / 1e6, \
+                entry->totalUserSeconds, entry->totalSystemSeconds, entry->maxResidentKilobytes, \
+                entry->voluntarySwitches, entry->involuntarySwitches);
+    }
+    fflush(stdout);
+}
+
+
+
+/*
+Prints the 'time' report for a foreground command to stderr: wall time, and the summed rusage of its processes.
+*/
+void printCommandTime(long long wallNanoseconds, struct rusage* usage) {
+    fprintf(stderr, "real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KB  csw %ld/%ld\n", wallNanoseconds / 1e9, \
+            usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6, \
+            usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6, \
+            usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include "smallsh.h"
+
+/*
+Timeout globals.
+*/
+// Set by the 'timeout' prefix for the command it runs. 0 for none.
+long long pendingTimeoutNanoseconds = 0;
+long long pendingGraceNanoseconds = 0;
+// Default timeout for background commands, set with 'bgtimeout'. 0 for none.
+long long backgroundTimeoutNanoseconds = 0;
+// Time between SIGTERM and SIGKILL, for the background default and for 'timeout' without -k.
+long long defaultGraceNanoseconds = 2000000000LL;
+
+
+
+/*
+Reads a duration: a number, which may have a fraction, with an optional unit of ms, s, m or h (seconds if none).
+Returns 0 with the duration in nanoseconds, or -1 if it is not valid.
+*/
+int parseDuration(char* durationText, long long* nanoseconds) {
+    char* unitText;
+    double value;
+
+    errno = 0;
+    value = strtod(durationText, &unitText);
+    if ((unitText == durationText) || (errno != 0) || (value < 0)) {
+        return -1;
+    }
+
+    double unitSeconds = 1;
+    if (strcmp(unitText, "ms") == 0) {
+        unitSeconds = 0.001;
+    }
+    else if (strcmp(unitText, "m") == 0) {
+        unitSeconds = 60;
+    }
+    else if (strcmp(unitText, "h") == 0) {
+        unitSeconds = 3600;
+    }
+    else if ((strcmp(unitText, "s") != 0) && (unitText[0] != '\0')) {
+        return -1;
+    }
+
+    // Anything past a year is as good as no limit, and keeps the value well inside a long long.
+    if (value * unitSeconds > 31536000.0) {
+        return -1;
+    }
+    *nanoseconds = (long long)(value * unitSeconds * 1e9);
+    return 0;
+}
+
+
+
+/*
+Prints a duration in the largest unit that keeps it whole, e.g. "1.5s" or "200ms".
+*/
+void printDuration(long long nanoseconds) {
+    if ((nanoseconds % 1000000000LL) == 0) {
+        printf("%llds", nanoseconds / 1000000000LL);
+    }
+    else if ((nanoseconds % 1000000LL) == 0) {
+        printf("%lldms", nanoseconds / 1000000LL);
+    }
+    else {
+        printf("%.3fs", nanoseconds / 1e9);
+    }
+}
+
+
+
+/*
+Timer function for a command's timeout, run from the event loop.
+The first time, sends SIGTERM to every process of the command still running, and starts the grace period.
+When the grace period is over, sends SIGKILL to whatever is left.
+Stopped processes are continued, so they can act on the signal.
+*/
+void expireCommandTimeout(void* data) {
+    struct commandTimeout* timeout = data;
+    int killSignal = (timeout->timedOut == 0) ? SIGTERM : SIGKILL;
+    int i = 0;
+
+    timeout->timer = NULL;
+    for (i; i < timeout->processCount; i++) {
+        pid_t processID = timeout->processIDs[i];
+        if ((processID <= 0) || ((timeout->job != NULL) && (findJobByProcess(processID) != timeout->job))) {
+            continue;
+        }
+        kill(processID, killSignal);
+        kill(processID, SIGCONT);
+    }
+
+    if (timeout->timedOut == 0) {
+        timeout->timedOut = 1;
+        timeout->timer = startShellTimer(timeout->graceNanoseconds, expireCommandTimeout, timeout);
+    }
+}
+
+
+
+/*
+Starts the timeout for a command that has just been started.
+processIDs are the command's processes, and stay owned by the caller: a foreground command sets the ones it
+has reaped to -1, and a background job's are checked against the job table through job.
+*/
+void startCommandTimeout(struct commandTimeout* timeout, pid_t* processIDs, int processCount, struct jobEntry* job, \
+        long long timeoutNanoseconds, long long graceNanoseconds) {
+    timeout->processIDs = processIDs;
+    timeout->processCount = processCount;
+    timeout->job = job;
+    timeout->graceNanoseconds = graceNanoseconds;
+    timeout->timedOut = 0;
+    timeout->timer = startShellTimer(timeoutNanoseconds, expireCommandTimeout, timeout);
+}
+
+
+
+/*
+Stops a command's timeout once the command has finished, cancelling a timer still waiting.
+timedOut is kept, for the exit status.
+*/
+void stopCommandTimeout(struct commandTimeout* timeout) {
+    if (timeout->timer != NULL) {
+        cancelShellTimer(timeout->timer);
+        timeout->timer = NULL;
+    }
+}
+
+
+
+/*
+Runs the 'timeout' prefix.
+timeout [-k grace] duration command args...
+Runs the rest of the line, and sends its processes SIGTERM if it is still running after duration,
+then SIGKILL after the grace period (default 2s). A command that timed out has exit status 124.
+Durations are seconds, or a number with ms, s, m or h. Builtins run inside the shell and are not affected.
+Input: commandStructure
+*/
+void timeoutCommand(struct commandStructure* command) {
+    long long graceNanoseconds = defaultGraceNanoseconds;
+    long long timeoutNanoseconds;
+    int durationIndex = 1;
+
+    if ((command->argumentCounter > 3) && (strcmp(command->arguments[1], "-k") == 0)) {
+        if (parseDuration(command->arguments[2], &graceNanoseconds) == -1) {
+            printf("Invalid timeout grace period '%s'. Please try again.\n", command->arguments[2]);
+            fflush(stdout);
+            lastExitStatus = 1;
+            return;
+        }
+        durationIndex = 3;
+    }
+    if ((durationIndex + 1 >= command->argumentCounter) || (parseDuration(command->arguments[durationIndex], &timeoutNanoseconds) == -1)) {
+        printf("Invalid timeout command. Use timeout [-k grace] duration command\n");
+        fflush(stdout);
+        lastExitStatus = 1;
+        return;
+    }
+
+    command->arguments += durationIndex + 1;
+    command->argumentCounter -= durationIndex + 1;
+    command->argumentCapacity -= durationIndex + 1;
+    command->command = command->arguments[0];
+
+    long long savedTimeout = pendingTimeoutNanoseconds;
+    long long savedGrace = pendingGraceNanoseconds;
+    pendingTimeoutNanoseconds = timeoutNanoseconds;
+    pendingGraceNanoseconds = graceNanoseconds;
+    shellCommand(command);
+    pendingTimeoutNanoseconds = savedTimeout;
+    pendingGraceNanoseconds = savedGrace;
+}
+
+
+
+/*
+Runs the 'bgtimeout' command, which sets the default timeout for background commands.
+bgtimeout                          shows the current default.
+bgtimeout off                      clears it.
+bgtimeout [-k grace] duration      times out every new background command after duration.
+A 'timeout' prefix on a background command takes the place of the default.
+Input: commandStructure
+*/
+void backgroundTimeoutCommand(struct commandStructure* command) {
+    long long graceNanoseconds = defaultGraceNanoseconds;
+    long long timeoutNanoseconds;
+    int durationIndex = 1;
+
+    lastExitStatus = 0;
+    if (command->argumentCounter == 1) {
+        printf("Background timeout: ");
+        if (backgroundTimeoutNanoseconds == 0) {
+            printf("none");
+        }
+        else {
+            printDuration(backgroundTimeoutNanoseconds);
+            printf(", then SIGKILL after ");
+            printDuration(defaultGraceNanoseconds);
+        }
+        printf("\n");
+    }
+    else if ((command->argumentCounter == 2) && (strcmp(command->arguments[1], "off") == 0)) {
+        backgroundTimeoutNanoseconds = 0;
+    }
+    else {
+        if ((command->argumentCounter == 4) && (strcmp(command->arguments[1], "-k") == 0)) {
+            durationIndex = 3;
+        }
+        if ((durationIndex + 1 != command->argumentCounter) \
+                || ((durationIndex == 3) && (parseDuration(command->arguments[2], &graceNanoseconds) == -1)) \
+                || (parseDuration(command->arguments[durationIndex], &timeoutNanoseconds) == -1)) {
+            printf("Invalid bgtimeout command. Use bgtimeout [-k grace] duration, or bgtimeout off\n");
+            lastExitStatus = 1;
+        }
+        else {
+            backgroundTimeoutNanoseconds = timeoutNanoseconds;
+            defaultGraceNanoseconds = graceNanoseconds;
+        }
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "smallsh.h"
+
+// Events kept by default. Always a power of 2, so the ring index is a mask.
+#define TRACE_DEFAULT_CAPACITY 65536
+// Largest buffer allowed, about 200 MB of events.
+#define TRACE_MAX_CAPACITY 4194304
+
+/*
+Structure for one trace event. Names are copied in, so nothing has to outlive the command arena.
+*/
+struct traceEvent {
+    long long timestamp;
+    int type;
+    // 'B' begins a span, 'E' ends it, 'i' is an instant.
+    char phase;
+    pid_t processID;
+    int value;
+    char name[32];
+};
+
+/*
+Trace globals. traceEnabled itself is in smallsh.h, where the TRACE macros check it.
+*/
+struct traceEvent* traceEvents = NULL;
+unsigned int traceCapacity = 0;
+// Total events recorded since the buffer was cleared. The ring holds the newest traceCapacity of them.
+unsigned long long traceCount = 0;
+// Dump file for SMALLSH_TRACE_FILE, written when the shell exits.
+char* traceExitFile = NULL;
+pid_t traceShellPID = 0;
+
+char* traceTypeNames[] = {"read", "expand", "parse", "spawn", "exec", "exit", "reap"};
+
+
+
+/*
+Records one event. Called through the TRACE macros, so only when tracing is on.
+Takes input of the event type and phase, a PID (0 for the shell itself), a value (line length, wait status),
+and an optional name such as the command being spawned.
+*/
+void recordTraceEvent(int type, char phase, pid_t processID, int value, char* name) {
+    struct traceEvent* event = &traceEvents[traceCount & (traceCapacity - 1)];
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    event->timestamp = now.tv_sec * 1000000000LL + now.tv_nsec;
+    event->type = type;
+    event->phase = phase;
+    event->processID = processID;
+    event->value = value;
+    event->name[0] = '\0';
+    if (name != NULL) {
+        strncpy(event->name, name, sizeof(event->name) - 1);
+        event->name[sizeof(event->name) - 1] = '\0';
+    }
+    traceCount++;
+}
+
+
+
+/*
+Reads a trace buffer size in events. Returns it, or 0 if text is not a whole number from 1 to TRACE_MAX_CAPACITY.
+*/
+unsigned int parseTraceCapacity(char* text) {
+    char* end;
+    unsigned long capacity = strtoul(text, &end, 10);
+
+    if ((end == text) || (*end != '\0') || (text[0] == '-') || (capacity < 1) || (capacity > TRACE_MAX_CAPACITY)) {
+        return 0;
+    }
+    return (unsigned int)capacity;
+}
+
+
+
+/*
+Turns tracing on, allocating the ring buffer up front. capacity, at most TRACE_MAX_CAPACITY, is rounded up
+to a power of 2. 0 keeps the buffer that already exists, or makes one of the default size.
+A buffer of a different size is replaced by a new one, which keeps the newest events that fit.
+If the buffer cannot be allocated, the old one is kept, or tracing stays off if there is none.
+Returns 0, or -1 with a message printed if the buffer could not be allocated.
+*/
+int startTracing(unsigned int capacity) {
+    unsigned int newCapacity = 1;
+
+    if ((capacity == 0) && (traceEvents != NULL)) {
+        capacity = traceCapacity;
+    }
+    if (capacity == 0) {
+        capacity = TRACE_DEFAULT_CAPACITY;
+    }
+    while (newCapacity < capacity) {
+        newCapacity <<= 1;
+    }
+
+    if ((traceEvents == NULL) || (newCapacity != traceCapacity)) {
+        struct traceEvent* newEvents = calloc(newCapacity, sizeof(struct traceEvent));
+        if (newEvents == NULL) {
+            if (traceEvents == NULL) {
+                printf("Could not allocate a trace buffer of %u events. Tracing is off.\n", newCapacity);
+            }
+            else {
+                printf("Could not allocate a trace buffer of %u events. Keeping the buffer of %u events.\n", \
+                        newCapacity, traceCapacity);
+            }
+            fflush(stdout);
+            return -1;
+        }
+
+        // Copy over the newest events that fit, at the same ring positions they would have had.
+        unsigned long long held = (traceCount < traceCapacity) ? traceCount : traceCapacity;
+        unsigned long long eventNumber = traceCount - ((held < newCapacity) ? held : newCapacity);
+        for (eventNumber; eventNumber < traceCount; eventNumber++) {
+            newEvents[eventNumber & (newCapacity - 1)] = traceEvents[eventNumber & (traceCapacity - 1)];
+        }
+        free(traceEvents);
+        traceEvents = newEvents;
+        traceCapacity = newCapacity;
+    }
+    traceShellPID = getpid();
+    traceEnabled = 1;
+    return 0;
+}
+
+
+
+/*
+Writes a JSON string, escaping quotes, backslashes and control characters.
+*/
+void writeTraceString(FILE* output, char* text) {
+    fputc('"', output);
+    for (text; *text != '\0'; text++) {
+        if ((*text == '"') || (*text == '\\')) {
+            fprintf(output, "\\%c", *text);
+        }
+        else if ((unsigned char)*text < 0x20) {
+            fprintf(output, "\\u%04x", *text);
+        }
+        else {
+            fputc(*text, output);
+        }
+    }
+    fputc('"', output);
+}
+
+
+
+/*
+Writes every event still in the ring, oldest first.
+chromeFormat 0 writes one JSON object per line. chromeFormat 1 writes the Trace Event Format that
+chrome://tracing and Perfetto load. Spans go on the shell's row, so each begin meets its end,
+and instants for a child (exec, exit, reap) go on a row of their own for that PID.
+*/
+void dumpTrace(FILE* output, int chromeFormat) {
+    unsigned long long first = (traceCount > traceCapacity) ? traceCount - traceCapacity : 0;
+    unsigned long long i = first;
+
+    if (chromeFormat == 1) {
+        fprintf(output, "{\"traceEvents\": [\n");
+    }
+    for (i; i < traceCount; i++) {
+        struct traceEvent* event = &traceEvents[i & (traceCapacity - 1)];
+        char* eventName = (event->name[0] != '\0') ? event->name : traceTypeNames[event->type];
+        pid_t rowID = ((event->phase == 'i') && (event->processID != 0)) ? event->processID : traceShellPID;
+
+        if (chromeFormat == 1) {
+            fprintf(output, "  {\"name\": ");
+            writeTraceString(output, eventName);
+            fprintf(output, ", \"cat\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d, " \
+                    "\"args\": {\"pid\": %d, \"value\": %d}%s}%s\n", traceTypeNames[event->type], event->phase, \
+                    event->timestamp / 1000.0, traceShellPID, rowID, event->processID, event->value, (event->phase == 'i') ? ", \"s\": \"t\"" : "", (i + 1 < traceCount) ? "," : "");
+        }
+        else {
+            fprintf(output, "{\"ts_ns\": %lld, \"event\": \"%s\", \"phase\": \"%c\", \"pid\": %d, \"value\": %d, \"name\": ", \
+                    event->timestamp, traceTypeNames[event->type], event->phase, event->processID, event->value);
+            writeTraceString(output, event->name);
+            fprintf(output, "}\n");
+        }
+    }
+    if (chromeFormat == 1) {
+        fprintf(output, "]}\n");
+    }
+    fflush(output);
+}
+
+
+
+/*
+Writes the trace to a file, Chrome format if the name ends in ".json", JSON lines otherwise.
+Returns 0, or -1 if the file could not be opened.
+*/
+int dumpTraceToFile(char* fileName) {
+    size_t nameLength = strlen(fileName);
+    int chromeFormat = ((nameLength >= 5) && (strcmp(&fileName[nameLength - 5], ".json") == 0));
+    FILE* output = fopen(fileName, "we");
+
+    if (output == NULL) {
+        return -1;
+    }
+    dumpTrace(output, chromeFormat);
+    fclose(output);
+    return 0;
+}
+
+
+
+/*
+Writes the trace to SMALLSH_TRACE_FILE when the shell exits. Registered with atexit.
+*/
+void dumpTraceAtExit() {
+    if ((getpid() == traceShellPID) && (traceExitFile != NULL)) {
+        dumpTraceToFile(traceExitFile);
+    }
+}
+
+
+
+/*
+Turns tracing on at startup if SMALLSH_TRACE is set, to "on" or to a buffer size in events.
+If SMALLSH_TRACE_FILE is also set, the trace is written there when the shell exits.
+*/
+void initializeTracing() {
+    char* traceSetting = getenv("SMALLSH_TRACE");
+
+    if ((traceSetting == NULL) || (traceSetting[0] == '\0') || (strcmp(traceSetting, "0") == 0) \
+            || (strcmp(traceSetting, "off") == 0)) {
+        return;
+    }
+    unsigned int capacity = 0;
+    if (strcmp(traceSetting, "on") != 0) {
+        capacity = parseTraceCapacity(traceSetting);
+        if (capacity == 0) {
+            fprintf(stderr, "smallsh: SMALLSH_TRACE must be on, off or 1 to %d events.\n", TRACE_MAX_CAPACITY);
+            return;
+        }
+    }
+    if (startTracing(capacity) == -1) {
+        return;
+    }
+
+    traceExitFile = getenv("SMALLSH_TRACE_FILE");
+    if (traceExitFile != NULL) {
+        atexit(dumpTraceAtExit);
+    }
+}
+
+
+
+/*
+Runs the 'trace' command.
+trace                           shows whether tracing is on, and how many events are held.
+trace on [events]               starts recording into a ring buffer of that many events (default 65536, or the
+                                size already in use). A new size replaces the buffer, keeping the newest events.
+trace off                       stops recording. Events recorded so far are kept.
+trace clear                     forgets the recorded events.
+trace dump [jsonl|chrome] [file] writes the events as JSON lines or Chrome trace format.
+Input: commandStructure
+*/
+void traceCommand(struct commandStructure* command) {
+    char* option = (command->argumentCounter > 1) ? command->arguments[1] : "";
+
+    lastExitStatus = 0;
+    if (command->argumentCounter == 1) {
+        unsigned long long held = (traceCount < traceCapacity) ? traceCount : traceCapacity;
+        printf("Tracing %s: %llu events held, %llu recorded, buffer of %u events\n", \
+                (traceEnabled == 1) ? "on" : "off", held, traceCount, traceCapacity);
+    }
+    else if (strcmp(option, "on") == 0) {
+        unsigned int capacity = 0;
+        if (command->argumentCounter > 2) {
+            capacity = parseTraceCapacity(command->arguments[2]);
+            if (capacity == 0) {
+                printf("Invalid trace buffer size. Use 1 to %d events.\n", TRACE_MAX_CAPACITY);
+                fflush(stdout);
+                lastExitStatus = 1;
+                return;
+            }
+        }
+        if (startTracing(capacity) == -1) {
+            lastExitStatus = 1;
+        }
+    }
+    else if (strcmp(option, "off") == 0) {
+        traceEnabled = 0;
+    }
+    else if (strcmp(option, "clear") == 0) {
+        traceCount = 0;
+    }
+    else if ((strcmp(option, "dump") == 0) && (traceEvents != NULL)) {
+        char* format = (command->argumentCounter > 2) ? command->arguments[2] : "jsonl";
+        int chromeFormat = (strcmp(format, "chrome") == 0);
+        if ((chromeFormat == 0) && (strcmp(format, "jsonl") != 0)) {
+            printf("Invalid trace format. Use jsonl or chrome.\n");
+            lastExitStatus = 1;
+        }
+        else if (command->argumentCounter > 3) {
+            FILE* output = fopen(command->arguments[3], "we");
+            if (output == NULL) {
+                printf("Invalid output file '%s'. Please try again.\n", command->arguments[3]);
+                lastExitStatus = 1;
+            }
+            else {
+                dumpTrace(output, chromeFormat);
+                fclose(output);
+            }
+        }
+        else {
+            dumpTrace(stdout, chromeFormat);
+        }
+    }
+    else if (strcmp(option, "dump") == 0) {
+        printf("Nothing traced yet. Use trace on.\n");
+        lastExitStatus = 1;
+    }
+    else {
+        printf("Invalid trace option. Use trace on, off, clear or dump.\n");
+        lastExitStatus = 1;
+    }
+    fflush(stdout);
+}
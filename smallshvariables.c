@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "smallsh.h"
+
+extern char** environ;
+
+/*
+Structure for one shell variable. entry holds the whole "name=value" text, which is exactly what exec wants for an
+exported variable, so the environment is put together from these pointers without copying any text.
+Entries in the same bucket are chained through nextEntry.
+*/
+struct shellVariable {
+    char* entry;
+    size_t nameLength;
+    int exported;
+    // Slot of entry in environmentSlots, or -1 when it is not in the cached environment.
+    int environmentIndex;
+    struct shellVariable* nextEntry;
+};
+
+// Free slots kept in front of the cached environment, for the NAME=value words of one command.
+#define ENVIRONMENT_SPARE_SLOTS 16
+
+/*
+Shell variable globals.
+*/
+// Hash table of variable name to variable. Bucket count is always a power of 2. Filled from environ on first use.
+struct shellVariable** variableBuckets = NULL;
+int variableBucketCount = 0;
+int variableCount = 0;
+int exportedCount = 0;
+// Cached envp for exec: ENVIRONMENT_SPARE_SLOTS free slots, one entry per exported variable, then NULL.
+char** environmentSlots = NULL;
+int environmentSlotCapacity = 0;
+// Set when a variable is exported or an exported one is unset, so the next exec rebuilds environmentSlots.
+// A new value for an exported variable only replaces its slot.
+int environmentStale = 1;
+// Moves on every change to an exported variable. The zygote is only sent the environment again when it has moved.
+unsigned int environmentVersion = 1;
+
+
+
+/*
+FNV-1a hash of a variable name of nameLength characters, which does not have to be NUL-terminated.
+*/
+unsigned int hashVariableName(char* name, size_t nameLength) {
+    unsigned int hash = 2166136261u;
+    size_t i = 0;
+    for (i; i < nameLength; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+
+/*
+Returns the length of name if it is a valid variable name: a letter or '_', then letters, digits and '_'.
+The name ends at the first '=' or NUL. Returns 0 for an invalid name.
+*/
+size_t variableNameLength(char* name) {
+    size_t nameLength = 0;
+
+    if ((name[0] != '_') && !isalpha((unsigned char)name[0])) {
+        return 0;
+    }
+    while ((name[nameLength] == '_') || isalnum((unsigned char)name[nameLength])) {
+        nameLength++;
+    }
+    return ((name[nameLength] == '=') || (name[nameLength] == '\0')) ? nameLength : 0;
+}
+
+
+
+/*
+Returns the length of the name in a NAME=value word, or 0 if the word is not an assignment.
+*/
+size_t assignmentNameLength(char* word) {
+    size_t nameLength = variableNameLength(word);
+    return (word[nameLength] == '=') ? nameLength : 0;
+}
+
+
+
+/*
+Doubles the bucket count of the variable table and rehashes every variable.
+*/
+void growVariableTable() {
+    int newBucketCount = (variableBucketCount == 0) ? 64 : variableBucketCount * 2;
+    struct shellVariable** newBuckets = calloc(newBucketCount, sizeof(struct shellVariable*));
+    int i = 0;
+
+    for (i; i < variableBucketCount; i++) {
+        struct shellVariable* variable = variableBuckets[i];
+        while (variable != NULL) {
+            struct shellVariable* nextEntry = variable->nextEntry;
+            unsigned int bucket = hashVariableName(variable->entry, variable->nameLength) & (newBucketCount - 1);
+            variable->nextEntry = newBuckets[bucket];
+            newBuckets[bucket] = variable;
+            variable = nextEntry;
+        }
+    }
+
+    free(variableBuckets);
+    variableBuckets = newBuckets;
+    variableBucketCount = newBucketCount;
+}
+
+
+
+/*
+Fills the variable table from the environment the shell was started with. Every variable in it is exported.
+*/
+void importEnvironment() {
+    char** entry = environ;
+
+    growVariableTable();
+    for (entry; *entry != NULL; entry++) {
+        size_t nameLength = assignmentNameLength(*entry);
+        if (nameLength > 0) {
+            setVariable(*entry, nameLength, &(*entry)[nameLength + 1], 1);
+        }
+    }
+}
+
+
+
+/*
+Finds a variable by a name of nameLength characters.
+Returns the variable, or NULL if it is not set.
+*/
+struct shellVariable* findVariable(char* name, size_t nameLength) {
+    if (variableBuckets == NULL) {
+        importEnvironment();
+    }
+
+    unsigned int bucket = hashVariableName(name, nameLength) & (variableBucketCount - 1);
+    struct shellVariable* variable = variableBuckets[bucket];
+    while (variable != NULL) {
+        if ((variable->nameLength == nameLength) && (memcmp(variable->entry, name, nameLength) == 0)) {
+            return variable;
+        }
+        variable = variable->nextEntry;
+    }
+    return NULL;
+}
+
+
+
+/*
+Returns the value of a variable, or NULL if it is not set. Used where the shell itself reads one, like $name, PATH and HOME.
+*/
+char* getVariable(char* name) {
+    struct shellVariable* variable = findVariable(name, strlen(name));
+    return (variable != NULL) ? &variable->entry[variable->nameLength + 1] : NULL;
+}
+
+
+
+/*
+Sets a variable, from a name of nameLength characters and a value. A value of NULL keeps the current value,
+or sets an empty one for a new variable. export 1 also exports it, and 0 leaves it exported or not as it was.
+*/
+void setVariable(char* name, size_t nameLength, char* value, int export) {
+    struct shellVariable* variable = findVariable(name, nameLength);
+
+    if ((variable != NULL) && (value == NULL)) {
+        value = &variable->entry[nameLength + 1];
+    }
+    if (value == NULL) {
+        value = "";
+    }
+    char* entry = malloc(nameLength + strlen(value) + 2);
+    memcpy(entry, name, nameLength);
+    entry[nameLength] = '=';
+    strcpy(&entry[nameLength + 1], value);
+
+    if (variable == NULL) {
+        if ((variableCount + 1) * 4 > variableBucketCount * 3) {
+            growVariableTable();
+        }
+        unsigned int bucket = hashVariableName(name, nameLength) & (variableBucketCount - 1);
+        variable = malloc(sizeof(struct shellVariable));
+        variable->nameLength = nameLength;
+        variable->exported = 0;
+        variable->environmentIndex = -1;
+        variable->nextEntry = variableBuckets[bucket];
+        variableBuckets[bucket] = variable;
+        variableCount++;
+    }
+    else {
+        free(variable->entry);
+    }
+    variable->entry = entry;
+
+    if ((export == 1) && (variable->exported == 0)) {
+        variable->exported = 1;
+        exportedCount++;
+        environmentStale = 1;
+    }
+    if (variable->exported == 1) {
+        environmentVersion++;
+        if (variable->environmentIndex != -1) {
+            environmentSlots[variable->environmentIndex] = entry;
+        }
+    }
+}
+
+
+
+/*
+Removes a variable, if it is set.
+*/
+void unsetVariable(char* name) {
+    size_t nameLength = strlen(name);
+
+    if (variableBuckets == NULL) {
+        importEnvironment();
+    }
+
+    unsigned int bucket = hashVariableName(name, nameLength) & (variableBucketCount - 1);
+    struct shellVariable** link = &variableBuckets[bucket];
+    while (*link != NULL) {
+        struct shellVariable* variable = *link;
+        if ((variable->nameLength == nameLength) && (memcmp(variable->entry, name, nameLength) == 0)) {
+            *link = variable->nextEntry;
+            if (variable->exported == 1) {
+                exportedCount--;
+                environmentStale = 1;
+                environmentVersion++;
+            }
+            free(variable->entry);
+            free(variable);
+            variableCount--;
+            return;
+        }
+        link = &variable->nextEntry;
+    }
+}
+
+
+
+/*
+Returns the cached environment of exported variables, as envp for exec.
+It is only put together again after a variable was exported or unset, and then just from the pointers in the table.
+The array belongs to the shell, and stays valid until the next change.
+*/
+char** shellEnvironment() {
+    if (variableBuckets == NULL) {
+        importEnvironment();
+    }
+    if (environmentStale == 0) {
+        return &environmentSlots[ENVIRONMENT_SPARE_SLOTS];
+    }
+
+    if (ENVIRONMENT_SPARE_SLOTS + exportedCount + 1 > environmentSlotCapacity) {
+        environmentSlotCapacity = (ENVIRONMENT_SPARE_SLOTS + exportedCount + 1) * 2;
+        free(environmentSlots);
+        environmentSlots = malloc(environmentSlotCapacity * sizeof(char*));
+    }
+
+    int slot = ENVIRONMENT_SPARE_SLOTS;
+    int i = 0;
+    for (i; i < variableBucketCount; i++) {
+        struct shellVariable* variable = variableBuckets[i];
+        for (variable; variable != NULL; variable = variable->nextEntry) {
+            variable->environmentIndex = -1;
+            if (variable->exported == 1) {
+                environmentSlots[slot] = variable->entry;
+                variable->environmentIndex = slot++;
+            }
+        }
+    }
+    environmentSlots[slot] = NULL;
+    environmentStale = 0;
+    return &environmentSlots[ENVIRONMENT_SPARE_SLOTS];
+}
+
+
+
+/*
+Returns 1 if the NAME=value word at index is the last one for its name among a stage's assignments.
+*/
+int isLastAssignment(struct commandStructure* stage, int index) {
+    size_t nameLength = assignmentNameLength(stage->assignments[index]);
+    int i = index + 1;
+
+    for (i; i < stage->assignmentCount; i++) {
+        if ((assignmentNameLength(stage->assignments[i]) == nameLength) \
+                && (memcmp(stage->assignments[i], stage->assignments[index], nameLength) == 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+
+/*
+Returns the environment for one stage's program: the cached environment with the stage's NAME=value words on top.
+A word for an exported variable takes over that variable's slot, and any other word goes into a free slot in
+front of the cached entries, so the environment is not copied. Only with more new names than free slots is a
+copy of the pointers made, in the command arena. The last word for a name is the one that counts.
+restoreEnvironment puts the slots back once the program has been started.
+*/
+char** commandEnvironment(struct commandStructure* stage) {
+    char** environment = shellEnvironment();
+    int frontCount = 0;
+    int i = 0;
+
+    if (stage->assignmentCount == 0) {
+        return environment;
+    }
+
+    for (i; i < stage->assignmentCount; i++) {
+        struct shellVariable* variable = findVariable(stage->assignments[i], assignmentNameLength(stage->assignments[i]));
+        if ((variable != NULL) && (variable->environmentIndex != -1)) {
+            environmentSlots[variable->environmentIndex] = stage->assignments[i];
+        }
+        else if (isLastAssignment(stage, i) == 1) {
+            frontCount++;
+        }
+    }
+
+    char** front = environment - frontCount;
+    if (frontCount > ENVIRONMENT_SPARE_SLOTS) {
+        front = arenaAllocate(&commandArena, (frontCount + exportedCount + 1) * sizeof(char*));
+        memcpy(&front[frontCount], environment, (exportedCount + 1) * sizeof(char*));
+    }
+    frontCount = 0;
+    for (i = 0; i < stage->assignmentCount; i++) {
+        struct shellVariable* variable = findVariable(stage->assignments[i], assignmentNameLength(stage->assignments[i]));
+        if (((variable == NULL) || (variable->environmentIndex == -1)) && (isLastAssignment(stage, i) == 1)) {
+            front[frontCount++] = stage->assignments[i];
+        }
+    }
+    return front;
+}
+
+
+
+/*
+Puts back the slots that commandEnvironment gave to a stage's NAME=value words.
+*/
+void restoreEnvironment(struct commandStructure* stage) {
+    int i = 0;
+
+    for (i; i < stage->assignmentCount; i++) {
+        struct shellVariable* variable = findVariable(stage->assignments[i], assignmentNameLength(stage->assignments[i]));
+        if ((variable != NULL) && (variable->environmentIndex != -1)) {
+            environmentSlots[variable->environmentIndex] = variable->entry;
+        }
+    }
+}
+
+
+
+/*
+Sets a shell variable for each NAME=value word of a command that has nothing else on it.
+A variable that is already exported stays exported, with the new value.
+*/
+void assignVariables(struct commandStructure* command) {
+    int i = 0;
+
+    for (i; i < command->assignmentCount; i++) {
+        size_t nameLength = assignmentNameLength(command->assignments[i]);
+        setVariable(command->assignments[i], nameLength, &command->assignments[i][nameLength + 1], 0);
+    }
+    lastExitStatus = 0;
+}
+
+
+
+/*
+Compares two environment entries for qsort.
+*/
+int compareEnvironmentEntries(const void* first, const void* second) {
+    return strcmp(*(char**)first, *(char**)second);
+}
+
+
+
+/*
+Runs the 'export' command.
+export                 prints every exported variable, sorted by name.
+export NAME=value ...  sets and exports each variable.
+export NAME ...        exports each variable, as an empty one if it is not set.
+*/
+void exportCommand(struct commandStructure* command) {
+    int i = 1;
+
+    lastExitStatus = 0;
+    if (command->argumentCounter == 1) {
+        char** environment = shellEnvironment();
+        char** sorted = malloc((exportedCount + 1) * sizeof(char*));
+        memcpy(sorted, environment, (exportedCount + 1) * sizeof(char*));
+        qsort(sorted, exportedCount, sizeof(char*), compareEnvironmentEntries);
+        for (i = 0; i < exportedCount; i++) {
+            printf("export %s\n", sorted[i]);
+        }
+        free(sorted);
+        fflush(stdout);
+        return;
+    }
+
+    for (i; i < command->argumentCounter; i++) {
+        char* argument = command->arguments[i];
+        size_t nameLength = variableNameLength(argument);
+        if (nameLength == 0) {
+            printf("export: %s: not a valid variable name\n", argument);
+            fflush(stdout);
+            lastExitStatus = 1;
+        }
+        else if (argument[nameLength] == '=') {
+            setVariable(argument, nameLength, &argument[nameLength + 1], 1);
+        }
+        else {
+            setVariable(argument, nameLength, NULL, 1);
+        }
+    }
+}
+
+
+
+/*
+Runs the 'unset' command, which removes each named variable.
+*/
+void unsetCommand(struct commandStructure* command) {
+    int i = 1;
+
+    lastExitStatus = 0;
+    for (i; i < command->argumentCounter; i++) {
+        size_t nameLength = variableNameLength(command->arguments[i]);
+        if ((nameLength == 0) || (command->arguments[i][nameLength] != '\0')) {
+            printf("unset: %s: not a valid variable name\n", command->arguments[i]);
+            fflush(stdout);
+            lastExitStatus = 1;
+            continue;
+        }
+        unsetVariable(command->arguments[i]);
+    }
+}
+
+
+
+/*
+Runs 'env' with no arguments, which prints the environment exec is given, one variable per line.
+With arguments, 'env' is the program of that name. Returns the exit status, 0.
+*/
+int printEnvironment() {
+    char** entry = shellEnvironment();
+
+    for (entry; *entry != NULL; entry++) {
+        printf("%s\n", *entry);
+    }
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,613 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "smallsh.h"
+
+/*
+Message types sent by the zygote.
+*/
+// Answer to one spawn request: the child PID, or the errno that stopped it from starting.
+#define ZYGOTE_SPAWN_REPLY 1
+// A child of the zygote exited, was killed, stopped or continued.
+#define ZYGOTE_CHILD_EVENT 2
+
+// Largest spawn request: the header, then the program path, every argument and any environment, NUL-separated.
+#define ZYGOTE_MESSAGE_SIZE 131072
+
+/*
+Header of a spawn request. stdin, stdout and stderr for the child travel with it as SCM_RIGHTS.
+policy is the child's run policy, with active 0 when there is none.
+The environment is only sent when the shell's has changed since the last one the zygote kept, or when the
+command has NAME=value words. Otherwise environmentCount is -1 and the zygote uses the one it kept.
+*/
+struct zygoteRequest {
+    int background;
+    int argumentCount;
+    // Number of environment entries after the arguments, or -1 for none.
+    int environmentCount;
+    // 1 if the zygote should keep the environment sent, for later requests that send none.
+    int keepEnvironment;
+    struct runPolicy policy;
+};
+
+/*
+Message from the zygote to the shell. Spawn replies use processID and error,
+child events use processID, childExit and usage, like the results of wait4.
+*/
+struct zygoteMessage {
+    int type;
+    pid_t processID;
+    int error;
+    int childExit;
+    struct rusage usage;
+};
+
+/*
+Zygote globals, on the shell's side.
+*/
+pid_t zygotePID = -1;
+// Child events already received, but not yet collected through waitForChild.
+struct zygoteMessage* zygoteEvents = NULL;
+int zygoteEventCount = 0;
+int zygoteEventCapacity = 0;
+// PIDs started by the zygote that have not exited yet.
+pid_t* zygoteChildren = NULL;
+int zygoteChildCount = 0;
+int zygoteChildCapacity = 0;
+// environmentVersion of the environment the zygote has kept, or 0 if it has none from the shell yet.
+unsigned int zygoteEnvironmentVersion = 0;
+
+
+
+/*
+Sends one message to the shell from the zygote, retrying if interrupted.
+*/
+void sendZygoteMessage(int socketFd, struct zygoteMessage* message) {
+    while ((send(socketFd, message, sizeof(struct zygoteMessage), 0) == -1) && (errno == EINTR)) {
+    }
+}
+
+
+
+/*
+Starts one child inside the zygote with posix_spawn, from the zygote's own small address space.
+Exec failures come back as an errno, the same way as for the posix_spawn engine.
+The child gets an empty signal mask. The zygote ignores SIGINT, SIGTSTP and SIGQUIT, and ignored signals
+stay ignored across exec, so the ones the child should act on are put back to default: SIGQUIT always,
+SIGINT for foreground children and SIGTSTP for background ones. This matches children of the other engines.
+A child with a run policy is forked instead, which is cheap from the zygote, and applies the policy before exec.
+Returns the child PID, or -1 with the error in spawnError.
+*/
+pid_t zygoteSpawn(char* programPath, char** arguments, char** environment, int childFds[3], int background, \
+        struct runPolicy* policy, int* spawnError) {
+    posix_spawn_file_actions_t fileActions;
+    posix_spawnattr_t spawnAttributes;
+    sigset_t childMask;
+    sigset_t defaultSignals;
+    pid_t childPID = -1;
+    int i = 0;
+
+    sigemptyset(&defaultSignals);
+    sigaddset(&defaultSignals, (background == 1) ? SIGTSTP : SIGINT);
+    sigaddset(&defaultSignals, SIGCHLD);
+    sigaddset(&defaultSignals, SIGQUIT);
+    if (policy->active == 1) {
+        return spawnWithRunPolicy(programPath, arguments, environment, childFds, background, &defaultSignals, policy, \
+                spawnError);
+    }
+
+    posix_spawn_file_actions_init(&fileActions);
+    for (i; i < 3; i++) {
+        posix_spawn_file_actions_adddup2(&fileActions, childFds[i], i);
+    }
+
+    posix_spawnattr_init(&spawnAttributes);
+    sigemptyset(&childMask);
+    posix_spawnattr_setsigmask(&spawnAttributes, &childMask);
+    posix_spawnattr_setsigdefault(&spawnAttributes, &defaultSignals);
+    posix_spawnattr_setflags(&spawnAttributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    *spawnError = posix_spawn(&childPID, programPath, &fileActions, &spawnAttributes, arguments, environment);
+
+    posix_spawnattr_destroy(&spawnAttributes);
+    posix_spawn_file_actions_destroy(&fileActions);
+    return (*spawnError == 0) ? childPID : -1;
+}
+
+
+
+/*
+Splits count NUL-separated strings, starting at *text, into a new NULL-terminated array of pointers into the text.
+Moves *text past the last one.
+*/
+char** splitZygoteStrings(char** text, int count) {
+    char** strings = malloc((count + 1) * sizeof(char*));
+    int i = 0;
+
+    for (i; i < count; i++) {
+        strings[i] = *text;
+        *text += strlen(*text) + 1;
+    }
+    strings[count] = NULL;
+    return strings;
+}
+
+
+
+/*
+Main loop of the zygote process. Never returns.
+Waits on the socket for spawn requests and on a signalfd for SIGCHLD. Each request is answered with a
+spawn reply, and every state change of its children is sent back as a child event with its rusage.
+Exits when the shell closes its end of the socket.
+Children get the environment the zygote kept from the shell, which is environ until the first one arrives.
+*/
+void runZygote(int socketFd) {
+    static char requestBuffer[ZYGOTE_MESSAGE_SIZE];
+    char** keptEnvironment = environ;
+    char* keptEnvironmentText = NULL;
+    char controlBuffer[CMSG_SPACE(3 * sizeof(int))];
+    struct sigaction ignoreAction = {0};
+    sigset_t childSignals;
+
+    // Terminal signals are for the shell and its children, not for the helper.
+    ignoreAction.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignoreAction, NULL);
+    sigaction(SIGTSTP, &ignoreAction, NULL);
+    sigaction(SIGQUIT, &ignoreAction, NULL);
+    sigemptyset(&childSignals);
+    sigaddset(&childSignals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignals, NULL);
+    int signalFd = signalfd(-1, &childSignals, SFD_CLOEXEC);
+
+    struct pollfd waitFds[2];
+    waitFds[0].fd = socketFd;
+    waitFds[0].events = POLLIN;
+    waitFds[1].fd = signalFd;
+    waitFds[1].events = POLLIN;
+
+    while (1) {
+        if (poll(waitFds, 2, -1) == -1) {
+            continue;
+        }
+
+        if (waitFds[1].revents != 0) {
+            struct signalfd_siginfo signalInfo;
+            struct zygoteMessage event = {0};
+            pid_t processID;
+
+            read(signalFd, &signalInfo, sizeof(signalInfo));
+            event.type = ZYGOTE_CHILD_EVENT;
+            while ((processID = wait4(-1, &event.childExit, WNOHANG | WUNTRACED | WCONTINUED, &event.usage)) > 0) {
+                event.processID = processID;
+                sendZygoteMessage(socketFd, &event);
+            }
+        }
+
+        if (waitFds[0].revents == 0) {
+            continue;
+        }
+
+        struct iovec requestVector = {requestBuffer, sizeof(requestBuffer) - 1};
+        struct msghdr requestHeader = {0};
+        requestHeader.msg_iov = &requestVector;
+        requestHeader.msg_iovlen = 1;
+        requestHeader.msg_control = controlBuffer;
+        requestHeader.msg_controllen = sizeof(controlBuffer);
+
+        ssize_t requestLength = recvmsg(socketFd, &requestHeader, MSG_CMSG_CLOEXEC);
+        if ((requestLength == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if (requestLength <= 0) {
+            _exit(0);
+        }
+
+        int childFds[3] = {-1, -1, -1};
+        struct cmsghdr* control = CMSG_FIRSTHDR(&requestHeader);
+        if ((control != NULL) && (control->cmsg_type == SCM_RIGHTS)) {
+            memcpy(childFds, CMSG_DATA(control), 3 * sizeof(int));
+        }
+
+        // Split the path, arguments and environment back out of the request.
+        struct zygoteRequest* request = (struct zygoteRequest*)requestBuffer;
+        char* text = requestBuffer + sizeof(struct zygoteRequest);
+        char* programPath = text;
+        char** environment = keptEnvironment;
+        int i = 0;
+        requestBuffer[requestLength] = '\0';
+        text += strlen(text) + 1;
+        char** arguments = splitZygoteStrings(&text, request->argumentCount);
+
+        if ((request->environmentCount >= 0) && (request->keepEnvironment == 1)) {
+            // The environment is the rest of the request. Copied, since the buffer is reused.
+            size_t textLength = requestBuffer + requestLength - text;
+            char* newText = malloc(textLength + 1);
+            memcpy(newText, text, textLength);
+            newText[textLength] = '\0';
+            if (keptEnvironment != environ) {
+                free(keptEnvironment);
+            }
+            free(keptEnvironmentText);
+            keptEnvironmentText = newText;
+            keptEnvironment = splitZygoteStrings(&newText, request->environmentCount);
+            environment = keptEnvironment;
+        }
+        else if (request->environmentCount >= 0) {
+            environment = splitZygoteStrings(&text, request->environmentCount);
+        }
+
+        struct zygoteMessage reply = {0};
+        reply.type = ZYGOTE_SPAWN_REPLY;
+        reply.processID = zygoteSpawn(programPath, arguments, environment, childFds, request->background, \
+                &request->policy, &reply.error);
+        sendZygoteMessage(socketFd, &reply);
+
+        free(arguments);
+        if (environment != keptEnvironment) {
+            free(environment);
+        }
+        for (i = 0; i < 3; i++) {
+            close(childFds[i]);
+        }
+    }
+}
+
+
+
+/*
+Forks the zygote, if it is not already running. Called when the zygote engine is selected, which for
+SMALLSH_SPAWN=zygote is at startup, while the shell is still small. The two processes talk over a
+SOCK_SEQPACKET socketpair, so every request and reply is one message.
+Returns 0, or -1 if the zygote could not be started.
+*/
+int startZygote() {
+    int socketPair[2];
+
+    if (zygoteSocket != -1) {
+        return 0;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socketPair) == -1) {
+        return -1;
+    }
+
+    pid_t childPID = fork();
+    if (childPID == -1) {
+        close(socketPair[0]);
+        close(socketPair[1]);
+        return -1;
+    }
+    if (childPID == 0) {
+        close(socketPair[0]);
+        runZygote(socketPair[1]);
+    }
+
+    close(socketPair[1]);
+    zygoteSocket = socketPair[0];
+    zygotePID = childPID;
+    zygoteEnvironmentVersion = 0;
+    return 0;
+}
+
+
+
+/*
+Forgets the zygote after it has exited, and goes back to posix_spawn for new children.
+Events it already sent stay queued for waitForChild. Children it started that had not exited yet can no longer
+be reported, so each gets an exit event with LOST_CHILD_EXIT, and their jobs finish as failed.
+*/
+void closeZygote() {
+    struct zygoteMessage lostEvent = {0};
+    int i = 0;
+
+    close(zygoteSocket);
+    zygoteSocket = -1;
+    zygotePID = -1;
+    lostEvent.type = ZYGOTE_CHILD_EVENT;
+    lostEvent.childExit = LOST_CHILD_EXIT;
+    for (i; i < zygoteChildCount; i++) {
+        if (zygoteEventCount == zygoteEventCapacity) {
+            zygoteEventCapacity = (zygoteEventCapacity == 0) ? 64 : zygoteEventCapacity * 2;
+            zygoteEvents = realloc(zygoteEvents, zygoteEventCapacity * sizeof(struct zygoteMessage));
+        }
+        lostEvent.processID = zygoteChildren[i];
+        zygoteEvents[zygoteEventCount++] = lostEvent;
+    }
+    zygoteChildCount = 0;
+    if (spawnEngine == SPAWN_ENGINE_ZYGOTE) {
+        spawnEngine = SPAWN_ENGINE_POSIX;
+    }
+    printf("Spawn helper exited. Using posix_spawn.\n");
+    fflush(stdout);
+}
+
+
+
+/*
+Returns 1 if a PID was started by the zygote and has not exited yet.
+*/
+int isZygoteChild(pid_t processID) {
+    int i = 0;
+    for (i; i < zygoteChildCount; i++) {
+        if (zygoteChildren[i] == processID) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Receives one message from the zygote. Child events are queued for waitForChild, and a child that
+has exited or been killed is no longer counted as running.
+flags is passed to recv, MSG_DONTWAIT for a non-blocking check.
+Returns 1 with a copy of the message, 0 if there was none waiting, -1 if the zygote has gone.
+*/
+int receiveZygoteMessage(struct zygoteMessage* message, int flags) {
+    ssize_t messageLength;
+    int i = 0;
+
+    while (((messageLength = recv(zygoteSocket, message, sizeof(struct zygoteMessage), flags)) == -1) && (errno == EINTR)) {
+    }
+    if ((messageLength == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        return 0;
+    }
+    if (messageLength <= 0) {
+        closeZygote();
+        return -1;
+    }
+
+    if (message->type == ZYGOTE_CHILD_EVENT) {
+        if (zygoteEventCount == zygoteEventCapacity) {
+            zygoteEventCapacity = (zygoteEventCapacity == 0) ? 64 : zygoteEventCapacity * 2;
+            zygoteEvents = realloc(zygoteEvents, zygoteEventCapacity * sizeof(struct zygoteMessage));
+        }
+        zygoteEvents[zygoteEventCount++] = *message;
+
+        if (WIFEXITED(message->childExit) || WIFSIGNALED(message->childExit)) {
+            for (i; i < zygoteChildCount; i++) {
+                if (zygoteChildren[i] == message->processID) {
+                    zygoteChildren[i] = zygoteChildren[--zygoteChildCount];
+                    break;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+
+
+/*
+Receives every message the zygote has already sent, without blocking.
+*/
+void drainZygoteMessages() {
+    struct zygoteMessage message;
+    while ((zygoteSocket != -1) && (receiveZygoteMessage(&message, MSG_DONTWAIT) == 1)) {
+    }
+}
+
+
+
+/*
+Starts a child through the zygote, for a program path already found by lookupCommandPath.
+The path, arguments, background flag and run policy (NULL for none) are sent as one message, with the child's stdin, stdout and
+stderr attached as SCM_RIGHTS. Fds of -1 send the shell's own stdin, stdout or stderr instead.
+The environment goes along only when the zygote does not already have it: after the shell's has changed, which the
+zygote then keeps, or for a command with NAME=value words, which it uses just once.
+Returns the child PID, or -1 if it could not be started (message printed).
+*/
+pid_t spawnWithZygote(struct commandStructure* stage, char* programPath, char** environment, int childFds[3], int background, \
+        struct runPolicy* policy) {
+    static char requestBuffer[ZYGOTE_MESSAGE_SIZE];
+    struct zygoteRequest* request = (struct zygoteRequest*)requestBuffer;
+    size_t requestLength = sizeof(struct zygoteRequest);
+    int sentFds[3];
+    int i = 0;
+
+    request->background = background;
+    request->argumentCount = stage->argumentCounter;
+    if (policy != NULL) {
+        request->policy = *policy;
+    }
+    else {
+        request->policy.active = 0;
+    }
+    int sendEnvironment = (stage->assignmentCount > 0) || (zygoteEnvironmentVersion != environmentVersion);
+    int environmentCount = 0;
+    while ((sendEnvironment == 1) && (environment[environmentCount] != NULL)) {
+        environmentCount++;
+    }
+    request->environmentCount = (sendEnvironment == 1) ? environmentCount : -1;
+    request->keepEnvironment = (stage->assignmentCount == 0);
+    for (i = -1; i < stage->argumentCounter + environmentCount; i++) {
+        char* text = programPath;
+        if (i >= stage->argumentCounter) {
+            text = environment[i - stage->argumentCounter];
+        }
+        else if (i >= 0) {
+            text = stage->arguments[i];
+        }
+        size_t textLength = strlen(text) + 1;
+        if (requestLength + textLength >= ZYGOTE_MESSAGE_SIZE) {
+            printSpawnError(E2BIG, background);
+            return -1;
+        }
+        memcpy(&requestBuffer[requestLength], text, textLength);
+        requestLength += textLength;
+    }
+
+    for (i = 0; i < 3; i++) {
+        sentFds[i] = (childFds[i] != -1) ? childFds[i] : i;
+    }
+
+    char controlBuffer[CMSG_SPACE(sizeof(sentFds))] = {0};
+    struct iovec requestVector = {requestBuffer, requestLength};
+    struct msghdr requestHeader = {0};
+    requestHeader.msg_iov = &requestVector;
+    requestHeader.msg_iovlen = 1;
+    requestHeader.msg_control = controlBuffer;
+    requestHeader.msg_controllen = sizeof(controlBuffer);
+    struct cmsghdr* control = CMSG_FIRSTHDR(&requestHeader);
+    control->cmsg_level = SOL_SOCKET;
+    control->cmsg_type = SCM_RIGHTS;
+    control->cmsg_len = CMSG_LEN(sizeof(sentFds));
+    memcpy(CMSG_DATA(control), sentFds, sizeof(sentFds));
+
+    ssize_t sent;
+    while (((sent = sendmsg(zygoteSocket, &requestHeader, MSG_NOSIGNAL)) == -1) && (errno == EINTR)) {
+    }
+    if (sent == -1) {
+        printSpawnError(errno, background);
+        return -1;
+    }
+
+    // Child events can arrive ahead of the reply. They are queued on the way.
+    struct zygoteMessage reply;
+    while (1) {
+        if (receiveZygoteMessage(&reply, 0) == -1) {
+            printSpawnError(EAGAIN, background);
+            return -1;
+        }
+        if (reply.type == ZYGOTE_SPAWN_REPLY) {
+            break;
+        }
+    }
+
+    if ((request->environmentCount >= 0) && (request->keepEnvironment == 1)) {
+        zygoteEnvironmentVersion = environmentVersion;
+    }
+    if (reply.processID == -1) {
+        printSpawnError(reply.error, background);
+        return -1;
+    }
+
+    if (zygoteChildCount == zygoteChildCapacity) {
+        zygoteChildCapacity = (zygoteChildCapacity == 0) ? 64 : zygoteChildCapacity * 2;
+        zygoteChildren = realloc(zygoteChildren, zygoteChildCapacity * sizeof(pid_t));
+    }
+    zygoteChildren[zygoteChildCount++] = reply.processID;
+    return reply.processID;
+}
+
+
+
+/*
+Takes the oldest queued zygote event for a PID (or any PID for -1) off the queue.
+Stop and continue events are only wanted with WUNTRACED and WCONTINUED, and are dropped otherwise,
+the same way wait4 would not report them.
+Returns 1 and fills in the event, or 0 if there is none.
+*/
+int takeZygoteEvent(pid_t processID, int options, struct zygoteMessage* event) {
+    int i = 0;
+
+    while (i < zygoteEventCount) {
+        struct zygoteMessage* queued = &zygoteEvents[i];
+        if ((processID != -1) && (queued->processID != processID)) {
+            i++;
+            continue;
+        }
+
+        int wanted = 1;
+        if (WIFSTOPPED(queued->childExit)) {
+            wanted = ((options & WUNTRACED) != 0);
+        }
+        else if (WIFCONTINUED(queued->childExit)) {
+            wanted = ((options & WCONTINUED) != 0);
+        }
+
+        *event = *queued;
+        memmove(queued, queued + 1, (zygoteEventCount - i - 1) * sizeof(struct zygoteMessage));
+        zygoteEventCount--;
+        if (wanted == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+Waits for a child like wait4, whether the shell started it itself or the zygote did.
+Children of the shell are waited for with wait4 directly. Children of the zygote are reported through
+messages on its socket, so those are received and queued, and then taken from the queue.
+With PID -1 both are watched, by polling the zygote socket and the shell's signalfd for SIGCHLD.
+The zygote itself is never returned: if it exits, it is forgotten and the wait carries on.
+Returns the PID, 0 for WNOHANG with nothing ready, or -1 with errno set (ECHILD, or EINTR).
+*/
+pid_t waitForChild(pid_t processID, int* childExit, int options, struct rusage* usage) {
+    struct zygoteMessage event;
+    pid_t waitResult;
+
+    while (1) {
+        if (zygoteSocket == -1) {
+            // Events left from a zygote that has exited come first.
+            if (takeZygoteEvent(processID, options, &event) == 1) {
+                *childExit = event.childExit;
+                *usage = event.usage;
+                return event.processID;
+            }
+            return wait4(processID, childExit, options, usage);
+        }
+
+        drainZygoteMessages();
+        if (takeZygoteEvent(processID, options, &event) == 1) {
+            *childExit = event.childExit;
+            *usage = event.usage;
+            return event.processID;
+        }
+
+        if ((processID != -1) && (isZygoteChild(processID) == 0)) {
+            // Not the zygote's, so it can only be the shell's own child.
+            return wait4(processID, childExit, options, usage);
+        }
+
+        if (processID == -1) {
+            waitResult = wait4(-1, childExit, options | WNOHANG, usage);
+            if ((waitResult > 0) && (waitResult == zygotePID)) {
+                closeZygote();
+                continue;
+            }
+            if (waitResult > 0) {
+                return waitResult;
+            }
+            if ((zygoteChildCount == 0) && ((options & WNOHANG) == 0)) {
+                // Nothing can come from the zygote, so block in wait4. Callers only wait for any child
+                // while they know one is running, so this does not end up waiting on the zygote alone.
+                waitResult = wait4(-1, childExit, options, usage);
+                if ((waitResult > 0) && (waitResult == zygotePID)) {
+                    closeZygote();
+                    continue;
+                }
+                return waitResult;
+            }
+        }
+
+        if ((options & WNOHANG) != 0) {
+            return 0;
+        }
+
+        struct pollfd waitFds[2];
+        waitFds[0].fd = zygoteSocket;
+        waitFds[0].events = POLLIN;
+        waitFds[1].fd = (processID == -1) ? shellSignalFd : -1;
+        waitFds[1].events = POLLIN;
+        if (poll(waitFds, 2, -1) == -1) {
+            return -1;
+        }
+        if (waitFds[1].revents != 0) {
+            handleShellSignals(0);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+x="a b"
+y=$x
+echo "[$y]"
+x=$(echo a b)
+echo "[$x]"
+z=$(printf 'p\nq')
+echo "[$z]"
+w=pre$x"s t"
+echo "[$w]"
+q=$x sh -c 'echo "[$q]"'
+echo $x | v=$x sh -c 'echo "<$v>"; cat'
+for i in a=$x; do echo "<$i>"; done
+echo k=$x
+g=$(echo '|;<>&')
+echo "[$g]"
+X=Y=oops
+$X
+echo "[$Y]"